@@ -0,0 +1,38 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include "PointCloudFile.h"
+
+// Converts any file GeometryLoader reads into ImViz's point cloud format.
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "Usage: %s <source> <dest> [maxPointsPerNode] [maxPointsInMemory]\n"
+            "Octree cells of up to maxPointsInMemory points (default 33554432) are built in memory at about 33 bytes per point.\n"
+            "Larger ones are split through temporary files next to <dest>, which need up to 48 bytes per point of disk space.\n", argv[0]);
+        return 1;
+    }
+
+    PointCloudWriteOptions options;
+    if (argc > 3)
+    {
+        options.maxPointsPerNode = (uint32_t)strtoul(argv[3], nullptr, 10);
+    }
+    if (argc > 4)
+    {
+        options.maxPointsInMemory = (size_t)strtoull(argv[4], nullptr, 10);
+    }
+
+    if (!ConvertToPointCloudFile(argv[1], argv[2], options))
+    {
+        return 1;
+    }
+
+    PointCloudFile file;
+    if (file.Open(argv[2]))
+    {
+        printf("Wrote %llu points in %u nodes to %s\n", (unsigned long long)file.GetHeader()->numPoints, file.GetNodeCount(), argv[2]);
+    }
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <GL/gl3w.h>
+#include <GLFW/glfw3.h>
+
+#include "Im3D.h"
+
+/*
+    Times View3d drawing the same point cloud with PointRendering::Raster, at 1 and 5 pixels, and PointRendering::Compute.
+    The window stays hidden. Any GL 4.3 implementation will do, including software ones such as Mesa's llvmpipe
+    (LIBGL_ALWAYS_SOFTWARE=1, under Xvfb on machines without a display).
+*/
+
+namespace
+{
+    // A cloud filling the view, in the shape of a noisy sphere shell so depth testing has something to do.
+    void GeneratePoints(size_t numPoints, std::vector<Vec3>& positions, std::vector<Vec3>& colors)
+    {
+        positions.resize(numPoints);
+        colors.resize(numPoints);
+        uint32_t state = 12345;
+        auto random = [&state]() {
+            state = state * 1664525u + 1013904223u;
+            return (state >> 8) * (1.f / 16777216.f);
+        };
+        for (size_t i = 0; i < numPoints; ++i)
+        {
+            Vec3 p{ 2.f * random() - 1.f, 2.f * random() - 1.f, 2.f * random() - 1.f };
+            const float length = sqrtf(p.x * p.x + p.y * p.y + p.z * p.z) + 1e-6f;
+            const float radius = 2.f + 0.5f * random();
+            positions[i] = Vec3{ p.x * radius / length, p.y * radius / length, p.z * radius / length };
+            colors[i] = Vec3{ 0.5f + 0.5f * p.x, 0.5f + 0.5f * p.y, 0.5f + 0.5f * p.z };
+        }
+    }
+
+    // Milliseconds per frame, waiting for the GPU to finish each one.
+    double TimeFrames(View3d& view, View3d::BufferHandle buffer, int numFrames)
+    {
+        // Warm up, so shader compilation and first use allocations aren't counted.
+        for (int i = 0; i < 2; ++i)
+        {
+            view.DrawBuffer(buffer);
+            view.Render();
+        }
+        glFinish();
+
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < numFrames; ++i)
+        {
+            view.DrawBuffer(buffer);
+            view.Render();
+            glFinish();
+        }
+        const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count() / numFrames;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const size_t numPoints = argc > 1 ? strtoull(argv[1], nullptr, 10) : 4000000;
+    const int numFrames = argc > 2 ? atoi(argv[2]) : 10;
+    const int width = argc > 3 ? atoi(argv[3]) : 1280;
+    const int height = argc > 4 ? atoi(argv[4]) : 720;
+    if (numPoints == 0 || numFrames <= 0 || width <= 0 || height <= 0)
+    {
+        fprintf(stderr, "Usage: %s [numPoints] [numFrames] [width] [height]\n", argv[0]);
+        return 1;
+    }
+
+    if (!glfwInit())
+    {
+        fprintf(stderr, "Failed to initialize GLFW\n");
+        return 1;
+    }
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow* window = glfwCreateWindow(64, 64, "PointRenderBenchmark", nullptr, nullptr);
+    if (window == nullptr)
+    {
+        fprintf(stderr, "Failed to create a GL 4.3 context\n");
+        glfwTerminate();
+        return 1;
+    }
+    glfwMakeContextCurrent(window);
+    glfwSwapInterval(0);
+    if (gl3wInit() != 0)
+    {
+        fprintf(stderr, "Failed to initialize OpenGL loader!\n");
+        return 1;
+    }
+    printf("%s, %s\n", (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION));
+
+    std::vector<Vec3> positions, colors;
+    GeneratePoints(numPoints, positions, colors);
+
+    int result = 0;
+    {
+        View3d view(ImVec2((float)width, (float)height));
+        view.SetBackgroundColor(0, 0, 0);
+        view.SetCamera(0, Vec3{ 0, 0, -8 }, Vec3{ 0, 0, 0 }, Vec3{ 0, 1, 0 });
+        View3d::BufferHandle buffer = view.CreateBuffer();
+        view.AppendVertices(buffer, positions.data(), colors.data(), numPoints);
+
+        printf("%zu points, %dx%d, %d frames\n", numPoints, width, height, numFrames);
+        // Compute points cover a pixel each, so raster at 1 pixel is the like for like comparison.
+        // The default 5 pixels is timed too, as what switching costs or saves as the view is set up out of the box.
+        view.SetPointSize(5.f);
+        const double raster5Ms = TimeFrames(view, buffer, numFrames);
+        printf("raster (5 px): %8.2f ms/frame, %8.1f Mpoints/s\n", raster5Ms, numPoints / (raster5Ms * 1000.0));
+        view.SetPointSize(1.f);
+        const double rasterMs = TimeFrames(view, buffer, numFrames);
+        printf("raster (1 px): %8.2f ms/frame, %8.1f Mpoints/s\n", rasterMs, numPoints / (rasterMs * 1000.0));
+
+        if (view.SetPointRendering(PointRendering::Compute))
+        {
+            const double computeMs = TimeFrames(view, buffer, numFrames);
+            printf("compute:       %8.2f ms/frame, %8.1f Mpoints/s, %.2fx raster at 1 px\n", computeMs, numPoints / (computeMs * 1000.0), rasterMs / computeMs);
+        }
+        else
+        {
+            fprintf(stderr, "Compute point rendering isn't supported here\n");
+            result = 1;
+        }
+        view.DestroyBuffer(buffer);
+    }
+
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    return result;
+}
@@ -77,6 +77,24 @@ void testLoop(const AppContext* ctx, void* userData)
     }
     ImGui::End();
 
+    if (ImGui::Begin("Frame pacing"))
+    {
+        const char* vsyncModes[] = { "Off", "On", "Adaptive" };
+        int vsync = (int)ctx->pacing->vsync;
+        if (ImGui::Combo("Vsync", &vsync, vsyncModes, IM_ARRAYSIZE(vsyncModes)))
+        {
+            ctx->pacing->vsync = (VsyncMode)vsync;
+        }
+        ImGui::SliderFloat("Target FPS (0 = uncapped)", &ctx->pacing->targetFps, 0, 240);
+
+        const FrameStats* stats = ctx->frameStats;
+        ImGui::Text("Frame %.2f ms (avg %.2f), CPU %.2f ms", stats->frameTimeMs, stats->averageFrameTimeMs, stats->cpuTimeMs);
+        ImGui::Text("Input to present %.2f ms (avg %.2f)", stats->inputLatencyMs, stats->averageInputLatencyMs);
+        ImGui::Text("Late frames: %llu of %llu", (unsigned long long)stats->lateFrames, (unsigned long long)stats->frameCount);
+        ImGui::PlotLines("Frame times", stats->recentFrameTimesMs, RecentFrameCount, stats->recentFrameOffset, nullptr, 0.f, 50.f, ImVec2(0, 80));
+    }
+    ImGui::End();
+
 
 }
 
@@ -1,6 +1,16 @@
 #include "Application.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <mmsystem.h>
+#endif
 
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
@@ -37,11 +47,150 @@ namespace
     {
         printf("%s\n", message);
     }
+
+    using Clock = std::chrono::steady_clock;
+
+    float ToMs(Clock::duration d)
+    {
+        return std::chrono::duration<float, std::milli>(d).count();
+    }
+
+    // Weight of the latest frame in FrameStats' running averages.
+    constexpr float AverageWeight = 0.05f;
+    // The frame rate cap stops sleeping this long before the deadline, on top of the worst recent sleep overshoot.
+    constexpr float SpinMarginMs = 0.2f;
+    // Per frame, so the overshoot estimate recovers from a one-off hiccup within a few hundred frames.
+    constexpr float OvershootDecay = 0.99f;
+
+    VsyncMode SetSwapInterval(VsyncMode mode)
+    {
+        if (mode == VsyncMode::Adaptive && !glfwExtensionSupported("WGL_EXT_swap_control_tear") && !glfwExtensionSupported("GLX_EXT_swap_control_tear"))
+        {
+            mode = VsyncMode::On;
+        }
+        glfwSwapInterval(mode == VsyncMode::Off ? 0 : mode == VsyncMode::On ? 1 : -1);
+        return mode;
+    }
+
+    /*
+        Caps the frame rate and keeps FrameStats up to date.
+        The cap waits before input is polled rather than after the swap, so the wait doesn't add to the latency.
+        OS sleeps overshoot by an unpredictable amount, so the wait sleeps until shortly before the deadline and
+        spins the rest of the way. How early to wake up is learned from the overshoots seen so far.
+    */
+    class FramePacer
+    {
+    public:
+        void Initialize(const FramePacingSettings& settings, FrameStats& stats)
+        {
+            requestedVsync = settings.vsync;
+            stats.activeVsync = SetSwapInterval(settings.vsync);
+            const GLFWvidmode* mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+            stats.refreshRate = mode != nullptr ? (float)mode->refreshRate : 0.f;
+        }
+
+        // Waits until the next frame is due. Call right before polling input.
+        void WaitForFrame(const FramePacingSettings& settings, FrameStats& stats)
+        {
+            if (settings.vsync != requestedVsync)
+            {
+                requestedVsync = settings.vsync;
+                stats.activeVsync = SetSwapInterval(settings.vsync);
+            }
+
+            Clock::time_point now = Clock::now();
+            if (settings.targetFps <= 0.f)
+            {
+                hasDeadline = false;
+                frameStart = now;
+                return;
+            }
+
+            const auto interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(1.f / settings.targetFps));
+            // After a long stall, start over instead of rushing out frames to catch up.
+            if (!hasDeadline || now - deadline > interval)
+            {
+                deadline = now;
+                hasDeadline = true;
+            }
+
+            const Clock::duration spinMargin = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float, std::milli>(sleepOvershootMs + SpinMarginMs));
+            if (deadline - now > spinMargin)
+            {
+                const Clock::duration sleep = deadline - now - spinMargin;
+                std::this_thread::sleep_for(sleep);
+                const Clock::time_point woke = Clock::now();
+                const float overshootMs = ToMs(woke - now - sleep);
+                sleepOvershootMs = std::max(overshootMs, sleepOvershootMs * OvershootDecay);
+                now = woke;
+            }
+            while (now < deadline)
+            {
+                std::this_thread::yield();
+                now = Clock::now();
+            }
+
+            frameStart = now;
+            deadline += interval;
+        }
+
+        void MarkInputPolled()
+        {
+            inputPolled = Clock::now();
+        }
+
+        // Call right before swapping buffers, since the swap blocks for vsync.
+        void MarkFrameSubmitted(FrameStats& stats)
+        {
+            stats.cpuTimeMs = ToMs(Clock::now() - frameStart);
+        }
+
+        // Call once the buffers have been swapped.
+        void EndFrame(const FramePacingSettings& settings, FrameStats& stats)
+        {
+            const Clock::time_point swapped = Clock::now();
+            stats.inputLatencyMs = ToMs(swapped - inputPolled);
+
+            if (stats.frameCount > 0)
+            {
+                const float frameTimeMs = ToMs(swapped - lastSwapped);
+                stats.frameTimeMs = frameTimeMs;
+                stats.averageFrameTimeMs = stats.frameCount == 1 ? frameTimeMs : stats.averageFrameTimeMs + AverageWeight * (frameTimeMs - stats.averageFrameTimeMs);
+                stats.averageInputLatencyMs = stats.frameCount == 1 ? stats.inputLatencyMs : stats.averageInputLatencyMs + AverageWeight * (stats.inputLatencyMs - stats.averageInputLatencyMs);
+
+                float intervalMs = settings.targetFps > 0.f ? 1000.f / settings.targetFps : 0.f;
+                if (stats.activeVsync != VsyncMode::Off && stats.refreshRate > 0.f)
+                {
+                    intervalMs = std::max(intervalMs, 1000.f / stats.refreshRate);
+                }
+                stats.lastFrameLate = intervalMs > 0.f && frameTimeMs > intervalMs * (1.f + settings.lateFrameTolerance);
+                stats.lateFrames += stats.lastFrameLate ? 1 : 0;
+
+                const int bin = std::min((int)(frameTimeMs / FrameTimeHistogramBinMs), FrameTimeHistogramBins - 1);
+                stats.frameTimeHistogram[bin]++;
+                stats.recentFrameTimesMs[stats.recentFrameOffset] = frameTimeMs;
+                stats.recentFrameOffset = (stats.recentFrameOffset + 1) % RecentFrameCount;
+            }
+
+            lastSwapped = swapped;
+            stats.frameCount++;
+        }
+
+    private:
+        VsyncMode requestedVsync{ VsyncMode::On };
+        bool hasDeadline{ false };
+        Clock::time_point deadline;
+        Clock::time_point frameStart;
+        Clock::time_point inputPolled;
+        Clock::time_point lastSwapped;
+        float sleepOvershootMs{ 1.f };
+    };
 }
 
 struct Application::ApplicationImpl
 {
     GLFWwindow* window;
+    FramePacer pacer;
 
     bool InitializeGLFW(const AppCreationInfo& info)
     {
@@ -64,7 +213,6 @@ struct Application::ApplicationImpl
         }
 
         glfwMakeContextCurrent(window);
-        glfwSwapInterval(1);//enable vsync
 
         bool err = gl3wInit() != 0;
         if (err)
@@ -104,12 +252,25 @@ Application::Application(const AppCreationInfo& info) : impl{ std::make_unique<A
     ImGui_ImplGlfw_InitForOpenGL(impl->window, true);
     ImGui_ImplOpenGL3_Init("#version 130");
 
+    FramePacingSettings pacing = info.pacing;
+    FrameStats frameStats{};
+    impl->pacer.Initialize(pacing, frameStats);
+#ifdef _WIN32
+    // The default timer resolution of ~15ms would leave the frame rate cap mostly spinning.
+    timeBeginPeriod(1);
+#endif
+
     AppContext ctx{};
+    ctx.pacing = &pacing;
+    ctx.frameStats = &frameStats;
 
     while (!glfwWindowShouldClose(impl->window))
     {
+        impl->pacer.WaitForFrame(pacing, frameStats);
+
         // Process user input
         glfwPollEvents();
+        impl->pacer.MarkInputPolled();
 
         //Start the Dear ImGui frame
         //impl->ImGuiNewFrame();
@@ -133,9 +294,15 @@ Application::Application(const AppCreationInfo& info) : impl{ std::make_unique<A
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
         
 
+        impl->pacer.MarkFrameSubmitted(frameStats);
         glfwSwapBuffers(impl->window);
+        impl->pacer.EndFrame(pacing, frameStats);
     }
 
+#ifdef _WIN32
+    timeEndPeriod(1);
+#endif
+
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
@@ -0,0 +1,152 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/*
+    Append-only storage for one frame of recorded geometry, in chunks of a power of two elements.
+    Growing adds a chunk rather than moving what's there, so elements keep their address, recording
+    a huge frame copies nothing, and the old and new storage are never both held at once. Indices are
+    still contiguous across chunks, so they can be used as offsets into a GPU buffer uploaded chunk by chunk.
+
+    Clear() keeps the chunks for the next frame. Every trimAfterFrames frames, chunks beyond the peak
+    usage since the last trim are freed, and more than maxRetainedBytes are never kept.
+*/
+template<typename T>
+class FrameArena
+{
+    static constexpr size_t FloorLog2(size_t n)
+    {
+        return n <= 1 ? 0 : 1 + FloorLog2(n / 2);
+    }
+
+public:
+    // About 4MB per chunk, rounded down to a power of two elements.
+    static constexpr size_t ChunkShift = FloorLog2(((size_t)4 << 20) / sizeof(T));
+    static constexpr size_t ChunkSize = (size_t)1 << ChunkShift;
+    static constexpr size_t ChunkMask = ChunkSize - 1;
+
+    size_t Size() const { return size; }
+    bool Empty() const { return size == 0; }
+
+    T& operator[](size_t i) { return chunks[i >> ChunkShift][i & ChunkMask]; }
+    const T& operator[](size_t i) const { return chunks[i >> ChunkShift][i & ChunkMask]; }
+    T& Back() { return (*this)[size - 1]; }
+    const T& Back() const { return (*this)[size - 1]; }
+
+    // Appends count elements, left as they were last used, and returns the index of the first.
+    size_t Grow(size_t count)
+    {
+        const size_t first = size;
+        const size_t numChunks = (first + count + ChunkMask) >> ChunkShift;
+        while (chunks.size() < numChunks)
+        {
+            chunks.emplace_back(new T[ChunkSize]);
+        }
+        size += count;
+        peak = std::max(peak, size);
+        return first;
+    }
+
+    void PushBack(const T& value)
+    {
+        (*this)[Grow(1)] = value;
+    }
+
+    // Calls f(T* elements, size_t firstIndex, size_t count) for each contiguous piece of the range.
+    template<typename F>
+    void ForEachSpan(size_t first, size_t count, F f)
+    {
+        while (count > 0)
+        {
+            const size_t n = std::min(count, ChunkSize - (first & ChunkMask));
+            f(&(*this)[first], first, n);
+            first += n;
+            count -= n;
+        }
+    }
+
+    template<typename F>
+    void ForEachSpan(size_t first, size_t count, F f) const
+    {
+        while (count > 0)
+        {
+            const size_t n = std::min(count, ChunkSize - (first & ChunkMask));
+            f(&(*this)[first], first, n);
+            first += n;
+            count -= n;
+        }
+    }
+
+    void Clear()
+    {
+        lastFrameSize = size;
+        recentPeak = std::max(recentPeak, size);
+        size_t keep = chunks.size();
+        if (++framesSinceTrim >= trimAfterFrames)
+        {
+            keep = (recentPeak + ChunkMask) >> ChunkShift;
+            recentPeak = 0;
+            framesSinceTrim = 0;
+        }
+        keep = std::min(keep, maxRetainedBytes / (ChunkSize * sizeof(T)));
+        if (keep < chunks.size())
+        {
+            chunks.resize(keep);
+        }
+        size = 0;
+    }
+
+    void SetTrimPolicy(size_t maxRetained, uint32_t trimFrames)
+    {
+        maxRetainedBytes = maxRetained;
+        trimAfterFrames = std::max<uint32_t>(trimFrames, 1);
+    }
+
+    size_t GetLastFrameBytes() const { return lastFrameSize * sizeof(T); }
+    size_t GetPeakBytes() const { return peak * sizeof(T); }
+    size_t GetReservedBytes() const { return chunks.size() * ChunkSize * sizeof(T); }
+
+    class Iterator
+    {
+    public:
+        Iterator(FrameArena* arena, size_t index) : arena{ arena }, index{ index } {}
+        T& operator*() const { return (*arena)[index]; }
+        Iterator& operator++() { ++index; return *this; }
+        bool operator!=(const Iterator& other) const { return index != other.index; }
+
+    private:
+        FrameArena* arena;
+        size_t index;
+    };
+
+    class ConstIterator
+    {
+    public:
+        ConstIterator(const FrameArena* arena, size_t index) : arena{ arena }, index{ index } {}
+        const T& operator*() const { return (*arena)[index]; }
+        ConstIterator& operator++() { ++index; return *this; }
+        bool operator!=(const ConstIterator& other) const { return index != other.index; }
+
+    private:
+        const FrameArena* arena;
+        size_t index;
+    };
+
+    Iterator begin() { return Iterator(this, 0); }
+    Iterator end() { return Iterator(this, size); }
+    ConstIterator begin() const { return ConstIterator(this, 0); }
+    ConstIterator end() const { return ConstIterator(this, size); }
+
+private:
+    std::vector<std::unique_ptr<T[]>> chunks;
+    size_t size{ 0 };
+    size_t peak{ 0 };
+    size_t lastFrameSize{ 0 };
+    size_t recentPeak{ 0 };
+    uint32_t framesSinceTrim{ 0 };
+    size_t maxRetainedBytes{ SIZE_MAX };
+    uint32_t trimAfterFrames{ 120 };
+};
@@ -0,0 +1,482 @@
+#include "GeometryKernels.h"
+#include "GeometryKernelsInternal.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IM3D_HAS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(IM3D_AVX2_KERNELS) && defined(_MSC_VER)
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+namespace
+{
+    // The kernels run at memory bandwidth, so a worker needs plenty of points to pay for its thread.
+    constexpr size_t MinPointsPerWorker = 256 * 1024;
+    constexpr size_t MinTrianglesPerWorker = 128 * 1024;
+
+    enum class KernelIsa
+    {
+        Scalar,
+        Sse2,
+        Avx2
+    };
+
+#if defined(IM3D_AVX2_KERNELS)
+    bool CpuHasAvx2()
+    {
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+        {
+            return false;
+        }
+        __cpuid(info, 1);
+        const bool osxsave = (info[2] & (1 << 27)) != 0;
+        const bool avx = (info[2] & (1 << 28)) != 0;
+        const bool fma = (info[2] & (1 << 12)) != 0;
+        // The OS has to save the upper halves of the registers too.
+        if (!osxsave || !avx || !fma || (_xgetbv(0) & 6) != 6)
+        {
+            return false;
+        }
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+    }
+#endif
+
+    KernelIsa GetKernelIsa()
+    {
+        static const KernelIsa isa = []() {
+#if defined(IM3D_AVX2_KERNELS)
+            if (CpuHasAvx2())
+            {
+                return KernelIsa::Avx2;
+            }
+#endif
+#if IM3D_HAS_SSE2
+            return KernelIsa::Sse2;
+#else
+            return KernelIsa::Scalar;
+#endif
+        }();
+        return isa;
+    }
+
+#if IM3D_HAS_SSE2
+    // Four packed Vec3s to x, y and z lanes, and back.
+    inline void Transpose(__m128 a, __m128 b, __m128 c, __m128& x, __m128& y, __m128& z)
+    {
+        x = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+        y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+        z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+    }
+
+    inline void Untranspose(__m128 x, __m128 y, __m128 z, __m128& a, __m128& b, __m128& c)
+    {
+        __m128 xyLow = _mm_unpacklo_ps(x, y);
+        __m128 xyHigh = _mm_unpackhi_ps(x, y);
+        __m128 yzLow = _mm_unpacklo_ps(y, z);
+        __m128 yzHigh = _mm_unpackhi_ps(y, z);
+        a = _mm_shuffle_ps(xyLow, _mm_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 1, 0));
+        b = _mm_shuffle_ps(yzLow, xyHigh, _MM_SHUFFLE(1, 0, 3, 2));
+        c = _mm_shuffle_ps(_mm_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2)), yzHigh, _MM_SHUFFLE(3, 2, 2, 0));
+    }
+
+    struct AffineSse2
+    {
+        __m128 m[12];
+
+        explicit AffineSse2(const float matrix[16])
+        {
+            for (int column = 0; column < 4; ++column)
+            {
+                for (int row = 0; row < 3; ++row)
+                {
+                    m[3 * column + row] = _mm_set1_ps(matrix[4 * column + row]);
+                }
+            }
+        }
+
+        void Apply(__m128 x, __m128 y, __m128 z, __m128& outX, __m128& outY, __m128& outZ) const
+        {
+            outX = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0], x), _mm_mul_ps(m[3], y)), _mm_add_ps(_mm_mul_ps(m[6], z), m[9]));
+            outY = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[1], x), _mm_mul_ps(m[4], y)), _mm_add_ps(_mm_mul_ps(m[7], z), m[10]));
+            outZ = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[2], x), _mm_mul_ps(m[5], y)), _mm_add_ps(_mm_mul_ps(m[8], z), m[11]));
+        }
+    };
+#endif
+
+    void TransformPointsRange(KernelIsa isa, const float m[16], const Vec3* points, Vec3* out, size_t count)
+    {
+#if defined(IM3D_AVX2_KERNELS)
+        if (isa == KernelIsa::Avx2)
+        {
+            Avx2Kernels::TransformPoints(m, points, out, count);
+            return;
+        }
+#endif
+        size_t i = 0;
+#if IM3D_HAS_SSE2
+        if (isa == KernelIsa::Sse2)
+        {
+            const AffineSse2 affine(m);
+            for (; i + 4 <= count; i += 4)
+            {
+                const float* f = &points[i].x;
+                __m128 x, y, z;
+                Transpose(_mm_loadu_ps(f), _mm_loadu_ps(f + 4), _mm_loadu_ps(f + 8), x, y, z);
+                affine.Apply(x, y, z, x, y, z);
+                __m128 a, b, c;
+                Untranspose(x, y, z, a, b, c);
+                float* o = &out[i].x;
+                _mm_storeu_ps(o, a);
+                _mm_storeu_ps(o + 4, b);
+                _mm_storeu_ps(o + 8, c);
+            }
+        }
+#endif
+        for (; i < count; ++i)
+        {
+            const Vec3 p = points[i];
+            TransformPointScalar(m, p.x, p.y, p.z, out[i].x, out[i].y, out[i].z);
+        }
+    }
+
+    void TransformPointsRange(KernelIsa isa, const float m[16], const float* x, const float* y, const float* z, float* outX, float* outY, float* outZ, size_t count)
+    {
+#if defined(IM3D_AVX2_KERNELS)
+        if (isa == KernelIsa::Avx2)
+        {
+            Avx2Kernels::TransformPoints(m, x, y, z, outX, outY, outZ, count);
+            return;
+        }
+#endif
+        size_t i = 0;
+#if IM3D_HAS_SSE2
+        if (isa == KernelIsa::Sse2)
+        {
+            const AffineSse2 affine(m);
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128 tx, ty, tz;
+                affine.Apply(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i), _mm_loadu_ps(z + i), tx, ty, tz);
+                _mm_storeu_ps(outX + i, tx);
+                _mm_storeu_ps(outY + i, ty);
+                _mm_storeu_ps(outZ + i, tz);
+            }
+        }
+#endif
+        for (; i < count; ++i)
+        {
+            const float px = x[i], py = y[i], pz = z[i];
+            TransformPointScalar(m, px, py, pz, outX[i], outY[i], outZ[i]);
+        }
+    }
+
+    void ComputeBoundsRange(KernelIsa isa, const Vec3* points, size_t count, Vec3& boundsMin, Vec3& boundsMax)
+    {
+#if defined(IM3D_AVX2_KERNELS)
+        if (isa == KernelIsa::Avx2)
+        {
+            Avx2Kernels::ComputeBounds(points, count, boundsMin, boundsMax);
+            return;
+        }
+#endif
+        size_t i = 0;
+#if IM3D_HAS_SSE2
+        if (isa == KernelIsa::Sse2 && count >= 4)
+        {
+            // Four points are three registers of x y z x, y z x y and z x y z. Keeping a min and max per
+            // register needs no shuffling in the loop, and the lanes are sorted out once at the end.
+            __m128 minA = _mm_set1_ps(FLT_MAX), minB = minA, minC = minA;
+            __m128 maxA = _mm_set1_ps(-FLT_MAX), maxB = maxA, maxC = maxA;
+            for (; i + 4 <= count; i += 4)
+            {
+                const float* f = &points[i].x;
+                __m128 a = _mm_loadu_ps(f), b = _mm_loadu_ps(f + 4), c = _mm_loadu_ps(f + 8);
+                minA = _mm_min_ps(minA, a);
+                minB = _mm_min_ps(minB, b);
+                minC = _mm_min_ps(minC, c);
+                maxA = _mm_max_ps(maxA, a);
+                maxB = _mm_max_ps(maxB, b);
+                maxC = _mm_max_ps(maxC, c);
+            }
+            float mins[12], maxs[12];
+            _mm_storeu_ps(mins, minA);
+            _mm_storeu_ps(mins + 4, minB);
+            _mm_storeu_ps(mins + 8, minC);
+            _mm_storeu_ps(maxs, maxA);
+            _mm_storeu_ps(maxs + 4, maxB);
+            _mm_storeu_ps(maxs + 8, maxC);
+            for (int j = 0; j < 12; j += 3)
+            {
+                ExpandBoundsScalar(mins[j], mins[j + 1], mins[j + 2], boundsMin, boundsMax);
+                ExpandBoundsScalar(maxs[j], maxs[j + 1], maxs[j + 2], boundsMin, boundsMax);
+            }
+        }
+#endif
+        for (; i < count; ++i)
+        {
+            ExpandBoundsScalar(points[i].x, points[i].y, points[i].z, boundsMin, boundsMax);
+        }
+    }
+
+#if IM3D_HAS_SSE2
+    void ComputeRangeSse2(const float* values, size_t count, float& minValue, float& maxValue)
+    {
+        size_t i = 0;
+        __m128 lowest = _mm_set1_ps(minValue), highest = _mm_set1_ps(maxValue);
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 v = _mm_loadu_ps(values + i);
+            lowest = _mm_min_ps(lowest, v);
+            highest = _mm_max_ps(highest, v);
+        }
+        float lanes[8];
+        _mm_storeu_ps(lanes, lowest);
+        _mm_storeu_ps(lanes + 4, highest);
+        for (int j = 0; j < 4; ++j)
+        {
+            minValue = lanes[j] < minValue ? lanes[j] : minValue;
+            maxValue = lanes[4 + j] > maxValue ? lanes[4 + j] : maxValue;
+        }
+        for (; i < count; ++i)
+        {
+            minValue = values[i] < minValue ? values[i] : minValue;
+            maxValue = values[i] > maxValue ? values[i] : maxValue;
+        }
+    }
+#endif
+
+    void ComputeBoundsRange(KernelIsa isa, const float* x, const float* y, const float* z, size_t count, Vec3& boundsMin, Vec3& boundsMax)
+    {
+#if defined(IM3D_AVX2_KERNELS)
+        if (isa == KernelIsa::Avx2)
+        {
+            Avx2Kernels::ComputeBounds(x, y, z, count, boundsMin, boundsMax);
+            return;
+        }
+#endif
+#if IM3D_HAS_SSE2
+        if (isa == KernelIsa::Sse2)
+        {
+            ComputeRangeSse2(x, count, boundsMin.x, boundsMax.x);
+            ComputeRangeSse2(y, count, boundsMin.y, boundsMax.y);
+            ComputeRangeSse2(z, count, boundsMin.z, boundsMax.z);
+            return;
+        }
+#endif
+        for (size_t i = 0; i < count; ++i)
+        {
+            ExpandBoundsScalar(x[i], y[i], z[i], boundsMin, boundsMax);
+        }
+    }
+
+    void RotateVectorsRange(KernelIsa isa, const Quat* rotations, const Vec3* vectors, Vec3* out, size_t count)
+    {
+#if defined(IM3D_AVX2_KERNELS)
+        if (isa == KernelIsa::Avx2)
+        {
+            Avx2Kernels::RotateVectors(rotations, vectors, out, count);
+            return;
+        }
+#endif
+        size_t i = 0;
+#if IM3D_HAS_SSE2
+        if (isa == KernelIsa::Sse2)
+        {
+            const __m128 two = _mm_set1_ps(2.f);
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128 qx = _mm_loadu_ps(&rotations[i].x);
+                __m128 qy = _mm_loadu_ps(&rotations[i + 1].x);
+                __m128 qz = _mm_loadu_ps(&rotations[i + 2].x);
+                __m128 qw = _mm_loadu_ps(&rotations[i + 3].x);
+                _MM_TRANSPOSE4_PS(qx, qy, qz, qw);
+
+                const float* f = &vectors[i].x;
+                __m128 vx, vy, vz;
+                Transpose(_mm_loadu_ps(f), _mm_loadu_ps(f + 4), _mm_loadu_ps(f + 8), vx, vy, vz);
+
+                // t = 2 u x v, v' = v + w t + u x t
+                __m128 tx = _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(qy, vz), _mm_mul_ps(qz, vy)));
+                __m128 ty = _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(qz, vx), _mm_mul_ps(qx, vz)));
+                __m128 tz = _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(qx, vy), _mm_mul_ps(qy, vx)));
+                __m128 rx = _mm_add_ps(_mm_add_ps(vx, _mm_mul_ps(qw, tx)), _mm_sub_ps(_mm_mul_ps(qy, tz), _mm_mul_ps(qz, ty)));
+                __m128 ry = _mm_add_ps(_mm_add_ps(vy, _mm_mul_ps(qw, ty)), _mm_sub_ps(_mm_mul_ps(qz, tx), _mm_mul_ps(qx, tz)));
+                __m128 rz = _mm_add_ps(_mm_add_ps(vz, _mm_mul_ps(qw, tz)), _mm_sub_ps(_mm_mul_ps(qx, ty), _mm_mul_ps(qy, tx)));
+
+                __m128 a, b, c;
+                Untranspose(rx, ry, rz, a, b, c);
+                float* o = &out[i].x;
+                _mm_storeu_ps(o, a);
+                _mm_storeu_ps(o + 4, b);
+                _mm_storeu_ps(o + 8, c);
+            }
+        }
+#endif
+        for (; i < count; ++i)
+        {
+            out[i] = RotateVectorScalar(rotations[i], vectors[i]);
+        }
+    }
+
+    // Splits [0, count) across workers and merges their bounds.
+    template<typename Fn>
+    void ParallelBounds(size_t count, Vec3& boundsMin, Vec3& boundsMax, Fn&& fn)
+    {
+        const size_t numWorkers = ChooseWorkerCount(count, MinPointsPerWorker);
+        std::vector<Vec3> workerMin(numWorkers, Vec3{ FLT_MAX, FLT_MAX, FLT_MAX });
+        std::vector<Vec3> workerMax(numWorkers, Vec3{ -FLT_MAX, -FLT_MAX, -FLT_MAX });
+        ParallelFor(count, numWorkers, [&](size_t begin, size_t end, size_t worker) {
+            fn(begin, end, workerMin[worker], workerMax[worker]);
+        });
+
+        boundsMin = Vec3{ FLT_MAX, FLT_MAX, FLT_MAX };
+        boundsMax = Vec3{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        for (size_t worker = 0; worker < numWorkers; ++worker)
+        {
+            boundsMin.x = std::min(boundsMin.x, workerMin[worker].x);
+            boundsMin.y = std::min(boundsMin.y, workerMin[worker].y);
+            boundsMin.z = std::min(boundsMin.z, workerMin[worker].z);
+            boundsMax.x = std::max(boundsMax.x, workerMax[worker].x);
+            boundsMax.y = std::max(boundsMax.y, workerMax[worker].y);
+            boundsMax.z = std::max(boundsMax.z, workerMax[worker].z);
+        }
+    }
+}
+
+void TransformPoints(const float matrix[16], const Vec3* points, Vec3* out, size_t numPoints)
+{
+    const KernelIsa isa = GetKernelIsa();
+    ParallelFor(numPoints, ChooseWorkerCount(numPoints, MinPointsPerWorker), [&](size_t begin, size_t end, size_t) {
+        TransformPointsRange(isa, matrix, points + begin, out + begin, end - begin);
+    });
+}
+
+void TransformPoints(const float matrix[16], const float* x, const float* y, const float* z, float* outX, float* outY, float* outZ, size_t numPoints)
+{
+    const KernelIsa isa = GetKernelIsa();
+    ParallelFor(numPoints, ChooseWorkerCount(numPoints, MinPointsPerWorker), [&](size_t begin, size_t end, size_t) {
+        TransformPointsRange(isa, matrix, x + begin, y + begin, z + begin, outX + begin, outY + begin, outZ + begin, end - begin);
+    });
+}
+
+void ComputeBounds(const Vec3* points, size_t numPoints, Vec3& boundsMin, Vec3& boundsMax)
+{
+    const KernelIsa isa = GetKernelIsa();
+    ParallelBounds(numPoints, boundsMin, boundsMax, [&](size_t begin, size_t end, Vec3& workerMin, Vec3& workerMax) {
+        ComputeBoundsRange(isa, points + begin, end - begin, workerMin, workerMax);
+    });
+}
+
+void ComputeBounds(const float* x, const float* y, const float* z, size_t numPoints, Vec3& boundsMin, Vec3& boundsMax)
+{
+    const KernelIsa isa = GetKernelIsa();
+    ParallelBounds(numPoints, boundsMin, boundsMax, [&](size_t begin, size_t end, Vec3& workerMin, Vec3& workerMax) {
+        ComputeBoundsRange(isa, x + begin, y + begin, z + begin, end - begin, workerMin, workerMax);
+    });
+}
+
+void ComputeNormals(const Vec3* positions, size_t numVertices, const unsigned int* indices, size_t numIndices, Vec3* normals)
+{
+    // Face normals in parallel, scattered to the vertices on one thread, since triangles share vertices.
+    // Their length is twice the triangle's area, which weights the sum.
+    const size_t numTriangles = numIndices / 3;
+    std::vector<Vec3> faceNormals(numTriangles);
+    ParallelFor(numTriangles, ChooseWorkerCount(numTriangles, MinTrianglesPerWorker), [&](size_t begin, size_t end, size_t) {
+        for (size_t t = begin; t < end; ++t)
+        {
+            const unsigned int i0 = indices[3 * t], i1 = indices[3 * t + 1], i2 = indices[3 * t + 2];
+            if (i0 >= numVertices || i1 >= numVertices || i2 >= numVertices)
+            {
+                faceNormals[t] = Vec3{ 0.f, 0.f, 0.f };
+                continue;
+            }
+            const Vec3 p0 = positions[i0], p1 = positions[i1], p2 = positions[i2];
+            const float ax = p1.x - p0.x, ay = p1.y - p0.y, az = p1.z - p0.z;
+            const float bx = p2.x - p0.x, by = p2.y - p0.y, bz = p2.z - p0.z;
+            faceNormals[t] = Vec3{ ay * bz - az * by, az * bx - ax * bz, ax * by - ay * bx };
+        }
+    });
+
+    for (size_t v = 0; v < numVertices; ++v)
+    {
+        normals[v] = Vec3{ 0.f, 0.f, 0.f };
+    }
+    for (size_t t = 0; t < numTriangles; ++t)
+    {
+        const Vec3 n = faceNormals[t];
+        for (int corner = 0; corner < 3; ++corner)
+        {
+            const unsigned int index = indices[3 * t + corner];
+            if (index < numVertices)
+            {
+                normals[index].x += n.x;
+                normals[index].y += n.y;
+                normals[index].z += n.z;
+            }
+        }
+    }
+
+    ParallelFor(numVertices, ChooseWorkerCount(numVertices, MinPointsPerWorker), [&](size_t begin, size_t end, size_t) {
+        for (size_t v = begin; v < end; ++v)
+        {
+            Vec3& n = normals[v];
+            const float lengthSquared = n.x * n.x + n.y * n.y + n.z * n.z;
+            if (lengthSquared > 0.f)
+            {
+                const float scale = 1.f / sqrtf(lengthSquared);
+                n.x *= scale;
+                n.y *= scale;
+                n.z *= scale;
+            }
+        }
+    });
+}
+
+void QuaternionRotateBatch(const Quat& q, const Vec3* vectors, Vec3* out, size_t numVectors)
+{
+    // One rotation for all of them is just a matrix, which is cheaper per vector than the quaternion.
+    const float matrix[16] = {
+        1.f - 2.f * (q.y * q.y + q.z * q.z), 2.f * (q.x * q.y + q.w * q.z), 2.f * (q.x * q.z - q.w * q.y), 0.f,
+        2.f * (q.x * q.y - q.w * q.z), 1.f - 2.f * (q.x * q.x + q.z * q.z), 2.f * (q.y * q.z + q.w * q.x), 0.f,
+        2.f * (q.x * q.z + q.w * q.y), 2.f * (q.y * q.z - q.w * q.x), 1.f - 2.f * (q.x * q.x + q.y * q.y), 0.f,
+        0.f, 0.f, 0.f, 1.f };
+    TransformPoints(matrix, vectors, out, numVectors);
+}
+
+void QuaternionRotateBatch(const Quat* rotations, const Vec3* vectors, Vec3* out, size_t numVectors)
+{
+    const KernelIsa isa = GetKernelIsa();
+    ParallelFor(numVectors, ChooseWorkerCount(numVectors, MinPointsPerWorker), [&](size_t begin, size_t end, size_t) {
+        RotateVectorsRange(isa, rotations + begin, vectors + begin, out + begin, end - begin);
+    });
+}
+
+const char* GetGeometryKernelIsa()
+{
+    switch (GetKernelIsa())
+    {
+    case KernelIsa::Avx2:
+        return "AVX2";
+    case KernelIsa::Sse2:
+        return "SSE2";
+    default:
+        return "scalar";
+    }
+}
@@ -0,0 +1,230 @@
+#include "GeometryKernelsInternal.h"
+
+// The whole file is compiled for AVX2 and FMA, see lib/CMakeLists.txt. Nothing here may run before
+// GeometryKernels.cpp has checked the CPU, so avoid anything, like std::min, that the linker could share
+// with code outside it.
+#if defined(IM3D_AVX2_KERNELS)
+
+#include <cfloat>
+#include <immintrin.h>
+
+namespace
+{
+    // Eight packed Vec3s, as three registers holding four points per 128 bit lane, to x, y and z lanes and back.
+    // The 256 bit shuffles work within lanes, so this is the SSE transpose done on both halves at once.
+    inline void Transpose(__m256 a, __m256 b, __m256 c, __m256& x, __m256& y, __m256& z)
+    {
+        x = _mm256_shuffle_ps(a, _mm256_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+        y = _mm256_shuffle_ps(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)), _mm256_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+        z = _mm256_shuffle_ps(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), _mm256_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+    }
+
+    inline void Untranspose(__m256 x, __m256 y, __m256 z, __m256& a, __m256& b, __m256& c)
+    {
+        __m256 xyLow = _mm256_unpacklo_ps(x, y);
+        __m256 xyHigh = _mm256_unpackhi_ps(x, y);
+        __m256 yzLow = _mm256_unpacklo_ps(y, z);
+        __m256 yzHigh = _mm256_unpackhi_ps(y, z);
+        a = _mm256_shuffle_ps(xyLow, _mm256_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 1, 0));
+        b = _mm256_shuffle_ps(yzLow, xyHigh, _MM_SHUFFLE(1, 0, 3, 2));
+        c = _mm256_shuffle_ps(_mm256_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2)), yzHigh, _MM_SHUFFLE(3, 2, 2, 0));
+    }
+
+    // Points i to i + 3 go in the low lanes, i + 4 to i + 7 in the high ones.
+    inline void LoadPoints(const float* f, __m256& a, __m256& b, __m256& c)
+    {
+        a = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(f)), _mm_loadu_ps(f + 12), 1);
+        b = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(f + 4)), _mm_loadu_ps(f + 16), 1);
+        c = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(f + 8)), _mm_loadu_ps(f + 20), 1);
+    }
+
+    inline void StorePoints(float* f, __m256 a, __m256 b, __m256 c)
+    {
+        _mm_storeu_ps(f, _mm256_castps256_ps128(a));
+        _mm_storeu_ps(f + 4, _mm256_castps256_ps128(b));
+        _mm_storeu_ps(f + 8, _mm256_castps256_ps128(c));
+        _mm_storeu_ps(f + 12, _mm256_extractf128_ps(a, 1));
+        _mm_storeu_ps(f + 16, _mm256_extractf128_ps(b, 1));
+        _mm_storeu_ps(f + 20, _mm256_extractf128_ps(c, 1));
+    }
+
+    struct AffineAvx2
+    {
+        __m256 m[12];
+
+        explicit AffineAvx2(const float matrix[16])
+        {
+            for (int column = 0; column < 4; ++column)
+            {
+                for (int row = 0; row < 3; ++row)
+                {
+                    m[3 * column + row] = _mm256_set1_ps(matrix[4 * column + row]);
+                }
+            }
+        }
+
+        void Apply(__m256 x, __m256 y, __m256 z, __m256& outX, __m256& outY, __m256& outZ) const
+        {
+            outX = _mm256_fmadd_ps(m[0], x, _mm256_fmadd_ps(m[3], y, _mm256_fmadd_ps(m[6], z, m[9])));
+            outY = _mm256_fmadd_ps(m[1], x, _mm256_fmadd_ps(m[4], y, _mm256_fmadd_ps(m[7], z, m[10])));
+            outZ = _mm256_fmadd_ps(m[2], x, _mm256_fmadd_ps(m[5], y, _mm256_fmadd_ps(m[8], z, m[11])));
+        }
+    };
+
+    void ComputeRange(const float* values, size_t count, float& minValue, float& maxValue)
+    {
+        size_t i = 0;
+        __m256 lowest = _mm256_set1_ps(minValue), highest = _mm256_set1_ps(maxValue);
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 v = _mm256_loadu_ps(values + i);
+            lowest = _mm256_min_ps(lowest, v);
+            highest = _mm256_max_ps(highest, v);
+        }
+        float lanes[16];
+        _mm256_storeu_ps(lanes, lowest);
+        _mm256_storeu_ps(lanes + 8, highest);
+        for (int j = 0; j < 8; ++j)
+        {
+            minValue = lanes[j] < minValue ? lanes[j] : minValue;
+            maxValue = lanes[8 + j] > maxValue ? lanes[8 + j] : maxValue;
+        }
+        for (; i < count; ++i)
+        {
+            minValue = values[i] < minValue ? values[i] : minValue;
+            maxValue = values[i] > maxValue ? values[i] : maxValue;
+        }
+    }
+}
+
+namespace Avx2Kernels
+{
+    void TransformPoints(const float m[16], const Vec3* points, Vec3* out, size_t count)
+    {
+        const AffineAvx2 affine(m);
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 a, b, c, x, y, z;
+            LoadPoints(&points[i].x, a, b, c);
+            Transpose(a, b, c, x, y, z);
+            affine.Apply(x, y, z, x, y, z);
+            Untranspose(x, y, z, a, b, c);
+            StorePoints(&out[i].x, a, b, c);
+        }
+        for (; i < count; ++i)
+        {
+            const Vec3 p = points[i];
+            TransformPointScalar(m, p.x, p.y, p.z, out[i].x, out[i].y, out[i].z);
+        }
+    }
+
+    void TransformPoints(const float m[16], const float* x, const float* y, const float* z, float* outX, float* outY, float* outZ, size_t count)
+    {
+        const AffineAvx2 affine(m);
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 tx, ty, tz;
+            affine.Apply(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), _mm256_loadu_ps(z + i), tx, ty, tz);
+            _mm256_storeu_ps(outX + i, tx);
+            _mm256_storeu_ps(outY + i, ty);
+            _mm256_storeu_ps(outZ + i, tz);
+        }
+        for (; i < count; ++i)
+        {
+            const float px = x[i], py = y[i], pz = z[i];
+            TransformPointScalar(m, px, py, pz, outX[i], outY[i], outZ[i]);
+        }
+    }
+
+    void ComputeBounds(const Vec3* points, size_t count, Vec3& boundsMin, Vec3& boundsMax)
+    {
+        size_t i = 0;
+        if (count >= 8)
+        {
+            // Eight points are exactly three registers, so each register always holds the same components
+            // in the same lanes, and the lanes are sorted out once at the end.
+            __m256 minA = _mm256_set1_ps(FLT_MAX), minB = minA, minC = minA;
+            __m256 maxA = _mm256_set1_ps(-FLT_MAX), maxB = maxA, maxC = maxA;
+            for (; i + 8 <= count; i += 8)
+            {
+                const float* f = &points[i].x;
+                __m256 a = _mm256_loadu_ps(f), b = _mm256_loadu_ps(f + 8), c = _mm256_loadu_ps(f + 16);
+                minA = _mm256_min_ps(minA, a);
+                minB = _mm256_min_ps(minB, b);
+                minC = _mm256_min_ps(minC, c);
+                maxA = _mm256_max_ps(maxA, a);
+                maxB = _mm256_max_ps(maxB, b);
+                maxC = _mm256_max_ps(maxC, c);
+            }
+            float mins[24], maxs[24];
+            _mm256_storeu_ps(mins, minA);
+            _mm256_storeu_ps(mins + 8, minB);
+            _mm256_storeu_ps(mins + 16, minC);
+            _mm256_storeu_ps(maxs, maxA);
+            _mm256_storeu_ps(maxs + 8, maxB);
+            _mm256_storeu_ps(maxs + 16, maxC);
+            for (int j = 0; j < 24; j += 3)
+            {
+                ExpandBoundsScalar(mins[j], mins[j + 1], mins[j + 2], boundsMin, boundsMax);
+                ExpandBoundsScalar(maxs[j], maxs[j + 1], maxs[j + 2], boundsMin, boundsMax);
+            }
+        }
+        for (; i < count; ++i)
+        {
+            ExpandBoundsScalar(points[i].x, points[i].y, points[i].z, boundsMin, boundsMax);
+        }
+    }
+
+    void ComputeBounds(const float* x, const float* y, const float* z, size_t count, Vec3& boundsMin, Vec3& boundsMax)
+    {
+        ComputeRange(x, count, boundsMin.x, boundsMax.x);
+        ComputeRange(y, count, boundsMin.y, boundsMax.y);
+        ComputeRange(z, count, boundsMin.z, boundsMax.z);
+    }
+
+    void RotateVectors(const Quat* rotations, const Vec3* vectors, Vec3* out, size_t count)
+    {
+        const __m256 two = _mm256_set1_ps(2.f);
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            // Quaternion j in the low lane, j + 4 in the high one, then a 4x4 transpose within each lane.
+            const float* q = &rotations[i].x;
+            __m256 r0 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(q)), _mm_loadu_ps(q + 16), 1);
+            __m256 r1 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(q + 4)), _mm_loadu_ps(q + 20), 1);
+            __m256 r2 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(q + 8)), _mm_loadu_ps(q + 24), 1);
+            __m256 r3 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(q + 12)), _mm_loadu_ps(q + 28), 1);
+            __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+            __m256 t1 = _mm256_unpacklo_ps(r2, r3);
+            __m256 t2 = _mm256_unpackhi_ps(r0, r1);
+            __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+            __m256 qx = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+            __m256 qy = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+            __m256 qz = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+            __m256 qw = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2));
+
+            __m256 a, b, c, vx, vy, vz;
+            LoadPoints(&vectors[i].x, a, b, c);
+            Transpose(a, b, c, vx, vy, vz);
+
+            // t = 2 u x v, v' = v + w t + u x t
+            __m256 tx = _mm256_mul_ps(two, _mm256_fmsub_ps(qy, vz, _mm256_mul_ps(qz, vy)));
+            __m256 ty = _mm256_mul_ps(two, _mm256_fmsub_ps(qz, vx, _mm256_mul_ps(qx, vz)));
+            __m256 tz = _mm256_mul_ps(two, _mm256_fmsub_ps(qx, vy, _mm256_mul_ps(qy, vx)));
+            __m256 rx = _mm256_fmadd_ps(qw, tx, _mm256_add_ps(vx, _mm256_fmsub_ps(qy, tz, _mm256_mul_ps(qz, ty))));
+            __m256 ry = _mm256_fmadd_ps(qw, ty, _mm256_add_ps(vy, _mm256_fmsub_ps(qz, tx, _mm256_mul_ps(qx, tz))));
+            __m256 rz = _mm256_fmadd_ps(qw, tz, _mm256_add_ps(vz, _mm256_fmsub_ps(qx, ty, _mm256_mul_ps(qy, tx))));
+
+            Untranspose(rx, ry, rz, a, b, c);
+            StorePoints(&out[i].x, a, b, c);
+        }
+        for (; i < count; ++i)
+        {
+            out[i] = RotateVectorScalar(rotations[i], vectors[i]);
+        }
+    }
+}
+
+#endif
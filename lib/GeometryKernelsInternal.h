@@ -0,0 +1,55 @@
+#pragma once
+#include "GeometryKernels.h"
+
+/*
+    Pieces shared by the kernel translation units. GeometryKernelsAvx2.cpp is built with AVX2 code generation,
+    so everything defined here has internal linkage: an inline function with external linkage could have its
+    AVX2 copy picked by the linker and end up called on CPUs without AVX2.
+*/
+
+namespace
+{
+    // Scalar versions, for the tails the vector loops leave over.
+    inline void TransformPointScalar(const float m[16], float x, float y, float z, float& outX, float& outY, float& outZ)
+    {
+        outX = m[0] * x + m[4] * y + m[8] * z + m[12];
+        outY = m[1] * x + m[5] * y + m[9] * z + m[13];
+        outZ = m[2] * x + m[6] * y + m[10] * z + m[14];
+    }
+
+    // v + 2w(u x v) + 2u x (u x v), for q = (u, w).
+    inline Vec3 RotateVectorScalar(const Quat& q, const Vec3& v)
+    {
+        float tx = 2.f * (q.y * v.z - q.z * v.y);
+        float ty = 2.f * (q.z * v.x - q.x * v.z);
+        float tz = 2.f * (q.x * v.y - q.y * v.x);
+        return Vec3{
+            v.x + q.w * tx + (q.y * tz - q.z * ty),
+            v.y + q.w * ty + (q.z * tx - q.x * tz),
+            v.z + q.w * tz + (q.x * ty - q.y * tx) };
+    }
+
+    // Bounds accumulate into boundsMin and boundsMax, which the caller initializes.
+    inline void ExpandBoundsScalar(float x, float y, float z, Vec3& boundsMin, Vec3& boundsMax)
+    {
+        boundsMin.x = x < boundsMin.x ? x : boundsMin.x;
+        boundsMin.y = y < boundsMin.y ? y : boundsMin.y;
+        boundsMin.z = z < boundsMin.z ? z : boundsMin.z;
+        boundsMax.x = x > boundsMax.x ? x : boundsMax.x;
+        boundsMax.y = y > boundsMax.y ? y : boundsMax.y;
+        boundsMax.z = z > boundsMax.z ? z : boundsMax.z;
+    }
+}
+
+// Implemented in GeometryKernelsAvx2.cpp, which the build only compiles on x86, defining IM3D_AVX2_KERNELS.
+// Only call these after checking the CPU supports AVX2 and FMA.
+#if defined(IM3D_AVX2_KERNELS)
+namespace Avx2Kernels
+{
+    void TransformPoints(const float m[16], const Vec3* points, Vec3* out, size_t count);
+    void TransformPoints(const float m[16], const float* x, const float* y, const float* z, float* outX, float* outY, float* outZ, size_t count);
+    void ComputeBounds(const Vec3* points, size_t count, Vec3& boundsMin, Vec3& boundsMax);
+    void ComputeBounds(const float* x, const float* y, const float* z, size_t count, Vec3& boundsMin, Vec3& boundsMax);
+    void RotateVectors(const Quat* rotations, const Vec3* vectors, Vec3* out, size_t count);
+}
+#endif
@@ -0,0 +1,1295 @@
+#include "GeometryLoader.h"
+#include "MappedFile.h"
+#include "Parallel.h"
+#include "Util.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    constexpr size_t AsciiChunkBytes = 4 << 20;
+    constexpr size_t BinaryChunkRecords = 1 << 20;
+    // How far parsing may run ahead of uploading, in chunks.
+    constexpr size_t MaxChunksInFlight = 32;
+    // Lines at the start of an XYZ file looked at to tell 0-255 colors from 0-1 ones.
+    constexpr size_t XyzColorSampleLines = 1000;
+
+    enum class FileFormat
+    {
+        PlyAscii,
+        PlyBinary,
+        Obj,
+        XyzAscii,
+        RawBinary
+    };
+
+    enum class PlyType
+    {
+        Int8,
+        UInt8,
+        Int16,
+        UInt16,
+        Int32,
+        UInt32,
+        Float32,
+        Float64,
+        Invalid
+    };
+
+    struct PlyProperty
+    {
+        std::string name;
+        PlyType type{ PlyType::Invalid };
+        bool isList{ false };
+        PlyType countType{ PlyType::Invalid };
+    };
+
+    struct PlyElement
+    {
+        std::string name;
+        size_t count{ 0 };
+        std::vector<PlyProperty> properties;
+        size_t recordSize{ 0 }; // Zero if the element has list properties, so records vary in size.
+
+        // Property indices we care about, -1 if absent.
+        int x{ -1 }, y{ -1 }, z{ -1 };
+        int red{ -1 }, green{ -1 }, blue{ -1 };
+        int vertexIndices{ -1 };
+
+        // Filled in while scanning the file.
+        size_t firstLine{ 0 };
+        size_t byteOffset{ 0 };
+    };
+
+    // A range of the file parsed as one unit. Chunks are uploaded in order.
+    struct ChunkTask
+    {
+        size_t begin{ 0 };
+        size_t end{ 0 };
+        size_t firstLine{ 0 };   // ASCII PLY: index of the first line in the body.
+        size_t firstVertex{ 0 }; // Index of the first vertex defined in the chunk, to resolve OBJ's relative indices.
+        int element{ -1 };       // Binary PLY: the element the records belong to.
+        size_t numRecords{ 0 };
+    };
+
+    struct ParsedChunk
+    {
+        std::vector<Vec3> positions;
+        std::vector<Vec3> colors; // Empty, or one per position.
+        std::vector<unsigned int> indices;
+        // Points straight into the mapping when the file already holds packed float positions.
+        const Vec3* mappedPositions{ nullptr };
+        size_t numMappedPositions{ 0 };
+        // Set when the chunk can't be parsed in a way that keeps later indices right, which fails the whole load.
+        bool failed{ false };
+
+        size_t GetUploadBytes() const
+        {
+            return (positions.size() + colors.size() + numMappedPositions) * sizeof(Vec3) + indices.size() * sizeof(unsigned int);
+        }
+    };
+
+    bool IsLineSpace(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == ',';
+    }
+
+    const char* FindLineEnd(const char* p, const char* end)
+    {
+        const char* newline = (const char*)memchr(p, '\n', end - p);
+        return newline == nullptr ? end : newline;
+    }
+
+    const char* SkipToken(const char* p, const char* end)
+    {
+        while (p < end && !IsLineSpace(*p) && *p != '\n')
+        {
+            ++p;
+        }
+        return p;
+    }
+
+    double Pow10(int exponent)
+    {
+        static const double table[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+        if (exponent >= 0 && exponent <= 22)
+        {
+            return table[exponent];
+        }
+        if (exponent < 0 && exponent >= -22)
+        {
+            return 1.0 / table[-exponent];
+        }
+        return pow(10.0, exponent);
+    }
+
+    /*
+        Parses the next number on the line, skipping leading whitespace. Returns false at the end of the line.
+        strtod is locale dependent and much slower, and these files are all digits.
+        Tokens which aren't numbers are skipped and read as NaN.
+    */
+    bool ParseNumber(const char*& p, const char* end, double& out)
+    {
+        while (p < end && IsLineSpace(*p))
+        {
+            ++p;
+        }
+        if (p >= end || *p == '\n')
+        {
+            return false;
+        }
+
+        const char* start = p;
+        bool negative = false;
+        if (*p == '-' || *p == '+')
+        {
+            negative = *p == '-';
+            ++p;
+        }
+
+        uint64_t mantissa = 0;
+        int exponent = 0;
+        int digits = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p, ++digits)
+        {
+            if (mantissa < 1000000000000000000ull)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+            }
+            else
+            {
+                exponent++;
+            }
+        }
+        if (p < end && *p == '.')
+        {
+            for (++p; p < end && *p >= '0' && *p <= '9'; ++p, ++digits)
+            {
+                if (mantissa < 1000000000000000000ull)
+                {
+                    mantissa = mantissa * 10 + (*p - '0');
+                    exponent--;
+                }
+            }
+        }
+        if (digits > 0 && p < end && (*p == 'e' || *p == 'E'))
+        {
+            ++p;
+            bool negativeExponent = false;
+            if (p < end && (*p == '-' || *p == '+'))
+            {
+                negativeExponent = *p == '-';
+                ++p;
+            }
+            int e = 0;
+            for (; p < end && *p >= '0' && *p <= '9'; ++p)
+            {
+                e = std::min(e * 10 + (*p - '0'), 100000);
+            }
+            exponent += negativeExponent ? -e : e;
+        }
+
+        if (digits == 0 || (p < end && !IsLineSpace(*p) && *p != '\n'))
+        {
+            p = SkipToken(start, end);
+            out = NAN;
+            return true;
+        }
+
+        double value = (double)mantissa * Pow10(exponent);
+        out = negative ? -value : value;
+        return true;
+    }
+
+    // Parses an OBJ face corner such as "7", "7/1" or "-2//3", keeping only the position index.
+    bool ParseFaceIndex(const char*& p, const char* end, long long& out)
+    {
+        while (p < end && IsLineSpace(*p))
+        {
+            ++p;
+        }
+        if (p >= end || *p == '\n')
+        {
+            return false;
+        }
+
+        bool negative = false;
+        if (*p == '-')
+        {
+            negative = true;
+            ++p;
+        }
+        long long value = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p)
+        {
+            value = value * 10 + (*p - '0');
+        }
+        p = SkipToken(p, end);
+        out = negative ? -value : value;
+        return true;
+    }
+
+    PlyType ParsePlyType(const std::string& name)
+    {
+        if (name == "char" || name == "int8") return PlyType::Int8;
+        if (name == "uchar" || name == "uint8") return PlyType::UInt8;
+        if (name == "short" || name == "int16") return PlyType::Int16;
+        if (name == "ushort" || name == "uint16") return PlyType::UInt16;
+        if (name == "int" || name == "int32") return PlyType::Int32;
+        if (name == "uint" || name == "uint32") return PlyType::UInt32;
+        if (name == "float" || name == "float32") return PlyType::Float32;
+        if (name == "double" || name == "float64") return PlyType::Float64;
+        return PlyType::Invalid;
+    }
+
+    size_t GetPlyTypeSize(PlyType type)
+    {
+        switch (type)
+        {
+        case PlyType::Int8:
+        case PlyType::UInt8:
+            return 1;
+        case PlyType::Int16:
+        case PlyType::UInt16:
+            return 2;
+        case PlyType::Int32:
+        case PlyType::UInt32:
+        case PlyType::Float32:
+            return 4;
+        case PlyType::Float64:
+            return 8;
+        default:
+            return 0;
+        }
+    }
+
+    // Scale bringing a color channel of this type into [0,1].
+    float GetColorScale(PlyType type)
+    {
+        switch (type)
+        {
+        case PlyType::UInt8:
+            return 1.f / 255.f;
+        case PlyType::UInt16:
+            return 1.f / 65535.f;
+        case PlyType::Float32:
+        case PlyType::Float64:
+            return 1.f;
+        default:
+            return 1.f / 255.f;
+        }
+    }
+
+    double ReadPlyValue(const char* p, PlyType type, bool swapBytes)
+    {
+        unsigned char bytes[8];
+        size_t size = GetPlyTypeSize(type);
+        memcpy(bytes, p, size);
+        if (swapBytes)
+        {
+            for (size_t i = 0; i < size / 2; ++i)
+            {
+                std::swap(bytes[i], bytes[size - 1 - i]);
+            }
+        }
+
+        switch (type)
+        {
+        case PlyType::Int8: { int8_t v; memcpy(&v, bytes, 1); return v; }
+        case PlyType::UInt8: { uint8_t v; memcpy(&v, bytes, 1); return v; }
+        case PlyType::Int16: { int16_t v; memcpy(&v, bytes, 2); return v; }
+        case PlyType::UInt16: { uint16_t v; memcpy(&v, bytes, 2); return v; }
+        case PlyType::Int32: { int32_t v; memcpy(&v, bytes, 4); return v; }
+        case PlyType::UInt32: { uint32_t v; memcpy(&v, bytes, 4); return v; }
+        case PlyType::Float32: { float v; memcpy(&v, bytes, 4); return v; }
+        case PlyType::Float64: { double v; memcpy(&v, bytes, 8); return v; }
+        default: return 0;
+        }
+    }
+
+    // A PLY list length, or false for one that's negative, fractional, NaN or absurdly long.
+    bool ToListCount(double value, size_t& out)
+    {
+        if (!(value >= 0.0 && value <= (double)UINT32_MAX) || value != floor(value))
+        {
+            return false;
+        }
+        out = (size_t)value;
+        return true;
+    }
+
+    // Face indices go straight to the GPU, so anything outside [0, numVertices) drops the face rather than being clamped.
+    bool ToVertexIndex(double value, size_t numVertices, unsigned int& out)
+    {
+        if (!(value >= 0.0 && value < (double)numVertices && value <= (double)UINT32_MAX) || value != floor(value))
+        {
+            return false;
+        }
+        out = (unsigned int)value;
+        return true;
+    }
+
+    // Fan triangulation of a polygon, which is exact for the convex faces these files hold in practice.
+    void AppendPolygon(const std::vector<unsigned int>& polygon, std::vector<unsigned int>& indices)
+    {
+        for (size_t i = 2; i < polygon.size(); ++i)
+        {
+            indices.push_back(polygon[0]);
+            indices.push_back(polygon[i - 1]);
+            indices.push_back(polygon[i]);
+        }
+    }
+
+    void AppendVertex(ParsedChunk& chunk, const Vec3& position, const Vec3* color)
+    {
+        // Colors are only stored once some vertex has one, and earlier vertices are then backfilled with white.
+        if (color != nullptr || !chunk.colors.empty())
+        {
+            chunk.colors.resize(chunk.positions.size(), Vec3{ 1.f, 1.f, 1.f });
+            chunk.colors.push_back(color != nullptr ? *color : Vec3{ 1.f, 1.f, 1.f });
+        }
+        chunk.positions.push_back(position);
+    }
+}
+
+struct GeometryLoader::Impl
+{
+    MappedFile file;
+    FileFormat format{ FileFormat::XyzAscii };
+    bool swapBytes{ false };
+    size_t bodyOffset{ 0 };
+    float xyzColorScale{ 1.f };
+    std::vector<PlyElement> elements;
+    size_t numPlyVertices{ 0 }; // Faces may only index these.
+    std::vector<ChunkTask> tasks;
+
+    View3d::BufferHandle buffer{ 0 };
+    bool opened{ false };
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable chunkConsumed;
+    std::map<size_t, ParsedChunk> readyChunks; // Keyed by task index.
+    size_t nextChunkToUpload{ 0 }; // Guarded by mutex.
+
+    std::atomic<size_t> nextTask{ 0 };
+    std::atomic<size_t> bytesParsed{ 0 };
+    std::atomic<bool> parsingFinished{ false };
+    std::atomic<bool> cancelled{ false };
+    std::atomic<bool> failed{ false };
+    size_t verticesUploaded{ 0 };
+    size_t trianglesUploaded{ 0 };
+    bool done{ false };
+
+    ~Impl()
+    {
+        Stop();
+    }
+
+    void Stop()
+    {
+        // Set under the lock, or it could land between the worker checking it and going to sleep, and the wakeup be lost.
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            cancelled = true;
+        }
+        chunkConsumed.notify_all();
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+    }
+
+    bool ParsePlyHeader(const char* path)
+    {
+        const char* data = file.GetData();
+        const char* end = data + file.GetSize();
+        const char* p = data;
+        bool hasFormat = false;
+
+        while (p < end)
+        {
+            const char* lineEnd = FindLineEnd(p, end);
+            std::string line(p, lineEnd);
+            p = lineEnd < end ? lineEnd + 1 : end;
+            if (!line.empty() && line.back() == '\r')
+            {
+                line.pop_back();
+            }
+
+            char keyword[32] = {};
+            sscanf(line.c_str(), "%31s", keyword);
+            if (strcmp(keyword, "format") == 0)
+            {
+                char kind[64] = {};
+                sscanf(line.c_str(), "format %63s", kind);
+                if (strcmp(kind, "ascii") == 0)
+                {
+                    format = FileFormat::PlyAscii;
+                }
+                else if (strcmp(kind, "binary_little_endian") == 0)
+                {
+                    format = FileFormat::PlyBinary;
+                    swapBytes = !IsLittleEndianHost();
+                }
+                else if (strcmp(kind, "binary_big_endian") == 0)
+                {
+                    format = FileFormat::PlyBinary;
+                    swapBytes = IsLittleEndianHost();
+                }
+                else
+                {
+                    fprintf(stderr, "%s: unknown PLY format %s\n", path, kind);
+                    return false;
+                }
+                hasFormat = true;
+            }
+            else if (strcmp(keyword, "element") == 0)
+            {
+                char name[64] = {};
+                unsigned long long count = 0;
+                if (sscanf(line.c_str(), "element %63s %llu", name, &count) != 2)
+                {
+                    fprintf(stderr, "%s: malformed PLY element: %s\n", path, line.c_str());
+                    return false;
+                }
+                PlyElement element;
+                element.name = name;
+                element.count = (size_t)count;
+                elements.push_back(element);
+            }
+            else if (strcmp(keyword, "property") == 0)
+            {
+                if (elements.empty())
+                {
+                    fprintf(stderr, "%s: PLY property outside an element\n", path);
+                    return false;
+                }
+                PlyProperty property;
+                char a[64] = {}, b[64] = {}, c[64] = {};
+                if (sscanf(line.c_str(), "property list %63s %63s %63s", a, b, c) == 3)
+                {
+                    property.isList = true;
+                    property.countType = ParsePlyType(a);
+                    property.type = ParsePlyType(b);
+                    property.name = c;
+                }
+                else if (sscanf(line.c_str(), "property %63s %63s", a, b) == 2)
+                {
+                    property.type = ParsePlyType(a);
+                    property.name = b;
+                }
+                if (property.type == PlyType::Invalid || (property.isList && property.countType == PlyType::Invalid))
+                {
+                    fprintf(stderr, "%s: unsupported PLY property: %s\n", path, line.c_str());
+                    return false;
+                }
+                elements.back().properties.push_back(property);
+            }
+            else if (strcmp(keyword, "end_header") == 0)
+            {
+                bodyOffset = p - data;
+                break;
+            }
+        }
+
+        if (!hasFormat || bodyOffset == 0)
+        {
+            fprintf(stderr, "%s: incomplete PLY header\n", path);
+            return false;
+        }
+
+        for (PlyElement& element : elements)
+        {
+            element.recordSize = 0;
+            bool fixedSize = true;
+            for (int i = 0; i < (int)element.properties.size(); ++i)
+            {
+                const PlyProperty& property = element.properties[i];
+                fixedSize = fixedSize && !property.isList;
+                element.recordSize += GetPlyTypeSize(property.type);
+
+                const std::string& name = property.name;
+                if (name == "x") element.x = i;
+                else if (name == "y") element.y = i;
+                else if (name == "z") element.z = i;
+                else if (name == "red" || name == "r" || name == "diffuse_red") element.red = i;
+                else if (name == "green" || name == "g" || name == "diffuse_green") element.green = i;
+                else if (name == "blue" || name == "b" || name == "diffuse_blue") element.blue = i;
+                else if (property.isList && (name == "vertex_indices" || name == "vertex_index")) element.vertexIndices = i;
+            }
+            if (!fixedSize)
+            {
+                element.recordSize = 0;
+            }
+        }
+        for (const PlyElement& element : elements)
+        {
+            numPlyVertices += IsVertexElement(element) ? element.count : 0;
+        }
+        return true;
+    }
+
+    bool IsVertexElement(const PlyElement& element) const
+    {
+        return element.name == "vertex" && element.x >= 0 && element.y >= 0 && element.z >= 0;
+    }
+
+    bool IsFaceElement(const PlyElement& element) const
+    {
+        return element.name == "face" && element.vertexIndices >= 0;
+    }
+
+    bool HasColor(const PlyElement& element) const
+    {
+        return element.red >= 0 && element.green >= 0 && element.blue >= 0;
+    }
+
+    // Splits [begin, end) into chunks of roughly AsciiChunkBytes, each ending on a line boundary.
+    void SplitAsciiBody(size_t begin, size_t end)
+    {
+        const char* data = file.GetData();
+        while (begin < end)
+        {
+            size_t chunkEnd = std::min(begin + AsciiChunkBytes, end);
+            if (chunkEnd < end)
+            {
+                chunkEnd = FindLineEnd(data + chunkEnd, data + end) - data;
+                chunkEnd = std::min(chunkEnd + 1, end);
+            }
+            ChunkTask task;
+            task.begin = begin;
+            task.end = chunkEnd;
+            tasks.push_back(task);
+            begin = chunkEnd;
+        }
+    }
+
+    /*
+        Chunks are parsed independently, but ASCII PLY lines only make sense given their index in the body,
+        and OBJ faces may index vertices relative to the current one. Both are fixed up by counting lines
+        (or vertex lines) in every chunk in parallel, then summing those counts.
+    */
+    void CountAsciiLines()
+    {
+        const char* data = file.GetData();
+        std::vector<size_t> lines(tasks.size());
+        std::vector<size_t> vertices(tasks.size());
+        const bool countVertices = format == FileFormat::Obj;
+
+        ParallelFor(tasks.size(), ChooseWorkerCount(tasks.size(), 1), [&](size_t begin, size_t end, size_t)
+        {
+            for (size_t t = begin; t < end && !cancelled; ++t)
+            {
+                const char* p = data + tasks[t].begin;
+                const char* chunkEnd = data + tasks[t].end;
+                size_t numLines = 0;
+                size_t numVertices = 0;
+                while (p < chunkEnd)
+                {
+                    if (countVertices && chunkEnd - p > 1 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+                    {
+                        numVertices++;
+                    }
+                    const char* lineEnd = FindLineEnd(p, chunkEnd);
+                    numLines++;
+                    p = lineEnd + 1;
+                }
+                lines[t] = numLines;
+                vertices[t] = numVertices;
+            }
+        });
+
+        size_t line = 0;
+        size_t vertex = 0;
+        for (size_t t = 0; t < tasks.size(); ++t)
+        {
+            tasks[t].firstLine = line;
+            tasks[t].firstVertex = vertex;
+            line += lines[t];
+            vertex += vertices[t];
+        }
+    }
+
+    // Size of the binary record at p, or 0 if it runs past the end of the file.
+    size_t GetBinaryRecordSize(const PlyElement& element, const char* p, const char* end) const
+    {
+        if (element.recordSize != 0)
+        {
+            return end - p >= (ptrdiff_t)element.recordSize ? element.recordSize : 0;
+        }
+        const char* start = p;
+        for (const PlyProperty& property : element.properties)
+        {
+            if (property.isList)
+            {
+                size_t countSize = GetPlyTypeSize(property.countType);
+                if (end - p < (ptrdiff_t)countSize)
+                {
+                    return 0;
+                }
+                size_t count;
+                if (!ToListCount(ReadPlyValue(p, property.countType, swapBytes), count)
+                    || count * GetPlyTypeSize(property.type) > (size_t)(end - p) - countSize)
+                {
+                    return 0;
+                }
+                p += countSize + count * GetPlyTypeSize(property.type);
+            }
+            else
+            {
+                if (end - p < (ptrdiff_t)GetPlyTypeSize(property.type))
+                {
+                    return 0;
+                }
+                p += GetPlyTypeSize(property.type);
+            }
+        }
+        return p - start;
+    }
+
+    bool BuildBinaryTasks()
+    {
+        const char* data = file.GetData();
+        const char* end = data + file.GetSize();
+        size_t offset = bodyOffset;
+
+        for (int e = 0; e < (int)elements.size(); ++e)
+        {
+            PlyElement& element = elements[e];
+            element.byteOffset = offset;
+            const bool wanted = IsVertexElement(element) || IsFaceElement(element);
+
+            if (element.recordSize != 0)
+            {
+                // Fixed size records are split by arithmetic alone.
+                if (offset + element.count * element.recordSize > file.GetSize())
+                {
+                    fprintf(stderr, "PLY file is truncated\n");
+                    return false;
+                }
+                for (size_t first = 0; wanted && first < element.count; first += BinaryChunkRecords)
+                {
+                    ChunkTask task;
+                    task.element = e;
+                    task.numRecords = std::min(BinaryChunkRecords, element.count - first);
+                    task.begin = offset + first * element.recordSize;
+                    task.end = task.begin + task.numRecords * element.recordSize;
+                    tasks.push_back(task);
+                }
+                offset += element.count * element.recordSize;
+                continue;
+            }
+
+            // Variable size records have to be walked to find where each chunk starts.
+            ChunkTask task;
+            task.element = e;
+            task.begin = offset;
+            for (size_t record = 0; record < element.count; ++record)
+            {
+                if (cancelled)
+                {
+                    return false;
+                }
+                size_t size = GetBinaryRecordSize(element, data + offset, end);
+                if (size == 0)
+                {
+                    fprintf(stderr, "PLY file is truncated\n");
+                    return false;
+                }
+                offset += size;
+                task.numRecords++;
+                if (task.numRecords == BinaryChunkRecords || record + 1 == element.count)
+                {
+                    task.end = offset;
+                    if (wanted)
+                    {
+                        tasks.push_back(task);
+                    }
+                    task.begin = offset;
+                    task.numRecords = 0;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool BuildTasks()
+    {
+        switch (format)
+        {
+        case FileFormat::PlyBinary:
+            return BuildBinaryTasks();
+        case FileFormat::RawBinary:
+        {
+            const size_t numPoints = file.GetSize() / sizeof(Vec3);
+            for (size_t first = 0; first < numPoints; first += BinaryChunkRecords)
+            {
+                ChunkTask task;
+                task.numRecords = std::min(BinaryChunkRecords, numPoints - first);
+                task.begin = first * sizeof(Vec3);
+                task.end = task.begin + task.numRecords * sizeof(Vec3);
+                tasks.push_back(task);
+            }
+            return true;
+        }
+        default:
+            SplitAsciiBody(bodyOffset, file.GetSize());
+            if (format != FileFormat::XyzAscii)
+            {
+                CountAsciiLines();
+            }
+            else
+            {
+                ChooseXyzColorScale();
+            }
+            return !cancelled;
+        }
+    }
+
+    void ParsePlyAsciiChunk(const ChunkTask& task, ParsedChunk& chunk)
+    {
+        const char* p = file.GetData() + task.begin;
+        const char* end = file.GetData() + task.end;
+        size_t line = task.firstLine;
+        std::vector<double> values;
+        std::vector<unsigned int> polygon;
+
+        // Elements are laid out one after the other, one record per line.
+        size_t elementIndex = 0;
+        size_t elementEnd = elements.empty() ? 0 : elements[0].count;
+        while (p < end)
+        {
+            const char* lineEnd = FindLineEnd(p, end);
+            while (elementIndex < elements.size() && line >= elementEnd)
+            {
+                elementIndex++;
+                elementEnd += elementIndex < elements.size() ? elements[elementIndex].count : 0;
+            }
+            if (elementIndex >= elements.size())
+            {
+                break;
+            }
+
+            const PlyElement& element = elements[elementIndex];
+            if (IsVertexElement(element))
+            {
+                values.clear();
+                double value;
+                const char* q = p;
+                while (ParseNumber(q, lineEnd, value))
+                {
+                    values.push_back(value);
+                }
+                // Skipping a short line would shift every later face index, so the file is treated as corrupt instead.
+                // Vertex elements with list properties would shift the values too, and aren't worth supporting.
+                if (values.size() < element.properties.size())
+                {
+                    fprintf(stderr, "PLY vertex %zu has %zu values, expected %zu\n", line - (elementEnd - element.count),
+                        values.size(), element.properties.size());
+                    chunk.failed = true;
+                    return;
+                }
+                Vec3 position{ (float)values[element.x], (float)values[element.y], (float)values[element.z] };
+                if (HasColor(element))
+                {
+                    Vec3 color{
+                        (float)values[element.red] * GetColorScale(element.properties[element.red].type),
+                        (float)values[element.green] * GetColorScale(element.properties[element.green].type),
+                        (float)values[element.blue] * GetColorScale(element.properties[element.blue].type) };
+                    AppendVertex(chunk, position, &color);
+                }
+                else
+                {
+                    AppendVertex(chunk, position, nullptr);
+                }
+            }
+            else if (IsFaceElement(element))
+            {
+                const char* q = p;
+                double value;
+                for (int i = 0; i < (int)element.properties.size(); ++i)
+                {
+                    const PlyProperty& property = element.properties[i];
+                    size_t count = 1;
+                    if (property.isList && ParseNumber(q, lineEnd, value) && !ToListCount(value, count))
+                    {
+                        count = 0;
+                    }
+                    polygon.clear();
+                    bool valid = true;
+                    unsigned int index = 0;
+                    for (size_t j = 0; j < count && ParseNumber(q, lineEnd, value); ++j)
+                    {
+                        valid = valid && ToVertexIndex(value, numPlyVertices, index);
+                        polygon.push_back(index);
+                    }
+                    if (i == element.vertexIndices && valid)
+                    {
+                        AppendPolygon(polygon, chunk.indices);
+                    }
+                }
+            }
+
+            line++;
+            p = lineEnd + 1;
+        }
+    }
+
+    void ParseObjChunk(const ChunkTask& task, ParsedChunk& chunk)
+    {
+        const char* p = file.GetData() + task.begin;
+        const char* end = file.GetData() + task.end;
+        std::vector<unsigned int> polygon;
+
+        while (p < end)
+        {
+            const char* lineEnd = FindLineEnd(p, end);
+            if (lineEnd - p > 1 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+            {
+                const char* q = p + 2;
+                double values[6];
+                int numValues = 0;
+                while (numValues < 6 && ParseNumber(q, lineEnd, values[numValues]))
+                {
+                    numValues++;
+                }
+                // Faces count vertex lines, so one that can't be read can't be skipped either.
+                if (numValues < 3)
+                {
+                    fprintf(stderr, "OBJ vertex %zu has %d values, expected at least 3\n", (size_t)(task.firstVertex + chunk.positions.size() + 1), numValues);
+                    chunk.failed = true;
+                    return;
+                }
+                Vec3 position{ (float)values[0], (float)values[1], (float)values[2] };
+                Vec3 color{ (float)values[3], (float)values[4], (float)values[5] };
+                AppendVertex(chunk, position, numValues == 6 ? &color : nullptr);
+            }
+            else if (lineEnd - p > 1 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+            {
+                // Negative indices count back from the last vertex defined before this line.
+                const long long numDefined = (long long)(task.firstVertex + chunk.positions.size());
+                const char* q = p + 2;
+                long long index;
+                polygon.clear();
+                bool valid = true;
+                while (ParseFaceIndex(q, lineEnd, index))
+                {
+                    const long long resolved = index < 0 ? numDefined + index : index - 1;
+                    valid = valid && resolved >= 0 && resolved < numDefined && resolved <= (long long)UINT32_MAX;
+                    polygon.push_back((unsigned int)resolved);
+                }
+                if (valid)
+                {
+                    AppendPolygon(polygon, chunk.indices);
+                }
+            }
+            p = lineEnd + 1;
+        }
+    }
+
+    // Reads up to six numbers from an XYZ line. Returns how many, or 0 for lines which don't start with a position, like headers.
+    static int ParseXyzLine(const char* p, const char* lineEnd, double values[6])
+    {
+        int numValues = 0;
+        while (numValues < 6 && ParseNumber(p, lineEnd, values[numValues]))
+        {
+            numValues++;
+        }
+        if (numValues < 3 || std::isnan(values[0]) || std::isnan(values[1]) || std::isnan(values[2]))
+        {
+            return 0;
+        }
+        return numValues;
+    }
+
+    /*
+        Colors come as either [0,1] floats or [0,255] integers. This is decided once for the whole file, from its first
+        lines, since a chunk which happens to hold only dark points can't tell by itself.
+    */
+    void ChooseXyzColorScale()
+    {
+        const char* p = file.GetData() + bodyOffset;
+        const char* end = file.GetData() + file.GetSize();
+        xyzColorScale = 1.f;
+        for (size_t line = 0; p < end && line < XyzColorSampleLines; ++line)
+        {
+            const char* lineEnd = FindLineEnd(p, end);
+            double values[6];
+            if (ParseXyzLine(p, lineEnd, values) == 6 && (values[3] > 1.0 || values[4] > 1.0 || values[5] > 1.0))
+            {
+                xyzColorScale = 1.f / 255.f;
+                return;
+            }
+            p = lineEnd + 1;
+        }
+    }
+
+    void ParseXyzChunk(const ChunkTask& task, ParsedChunk& chunk)
+    {
+        const char* p = file.GetData() + task.begin;
+        const char* end = file.GetData() + task.end;
+        while (p < end)
+        {
+            const char* lineEnd = FindLineEnd(p, end);
+            double values[6];
+            const int numValues = ParseXyzLine(p, lineEnd, values);
+            if (numValues >= 3)
+            {
+                Vec3 position{ (float)values[0], (float)values[1], (float)values[2] };
+                if (numValues == 6)
+                {
+                    const float scale = xyzColorScale;
+                    Vec3 color{ (float)values[3] * scale, (float)values[4] * scale, (float)values[5] * scale };
+                    AppendVertex(chunk, position, &color);
+                }
+                else
+                {
+                    AppendVertex(chunk, position, nullptr);
+                }
+            }
+            p = lineEnd + 1;
+        }
+    }
+
+    void ParsePlyBinaryChunk(const ChunkTask& task, ParsedChunk& chunk)
+    {
+        const PlyElement& element = elements[task.element];
+        const char* p = file.GetData() + task.begin;
+        const char* end = file.GetData() + task.end;
+
+        if (IsVertexElement(element))
+        {
+            // Packed float positions in native byte order are handed to the GPU straight from the mapping.
+            const bool packedPositions = element.recordSize == sizeof(Vec3) && element.x == 0 && element.y == 1 && element.z == 2
+                && element.properties[0].type == PlyType::Float32 && element.properties[1].type == PlyType::Float32
+                && element.properties[2].type == PlyType::Float32 && !swapBytes;
+            if (packedPositions && ((uintptr_t)p % alignof(float)) == 0)
+            {
+                chunk.mappedPositions = (const Vec3*)p;
+                chunk.numMappedPositions = task.numRecords;
+                return;
+            }
+
+            // Offsets are the same for every record, since vertices with lists aren't supported.
+            std::vector<size_t> offsets(element.properties.size());
+            size_t offset = 0;
+            for (size_t i = 0; i < element.properties.size(); ++i)
+            {
+                offsets[i] = offset;
+                offset += GetPlyTypeSize(element.properties[i].type);
+            }
+            if (element.recordSize == 0)
+            {
+                return;
+            }
+
+            const bool hasColor = HasColor(element);
+            chunk.positions.resize(task.numRecords);
+            if (hasColor)
+            {
+                chunk.colors.resize(task.numRecords);
+            }
+            for (size_t r = 0; r < task.numRecords; ++r, p += element.recordSize)
+            {
+                auto read = [&](int property) { return (float)ReadPlyValue(p + offsets[property], element.properties[property].type, swapBytes); };
+                chunk.positions[r] = Vec3{ read(element.x), read(element.y), read(element.z) };
+                if (hasColor)
+                {
+                    chunk.colors[r] = Vec3{
+                        read(element.red) * GetColorScale(element.properties[element.red].type),
+                        read(element.green) * GetColorScale(element.properties[element.green].type),
+                        read(element.blue) * GetColorScale(element.properties[element.blue].type) };
+                }
+            }
+            return;
+        }
+
+        std::vector<unsigned int> polygon;
+        for (size_t r = 0; r < task.numRecords && p < end; ++r)
+        {
+            for (int i = 0; i < (int)element.properties.size(); ++i)
+            {
+                const PlyProperty& property = element.properties[i];
+                const size_t valueSize = GetPlyTypeSize(property.type);
+                if (!property.isList)
+                {
+                    p += valueSize;
+                    continue;
+                }
+                // Already checked while the records were walked, see GetBinaryRecordSize().
+                size_t count = 0;
+                ToListCount(ReadPlyValue(p, property.countType, swapBytes), count);
+                p += GetPlyTypeSize(property.countType);
+                if (i == element.vertexIndices)
+                {
+                    polygon.resize(count);
+                    bool valid = true;
+                    for (size_t j = 0; j < count && valid; ++j)
+                    {
+                        valid = ToVertexIndex(ReadPlyValue(p + j * valueSize, property.type, swapBytes), numPlyVertices, polygon[j]);
+                    }
+                    if (valid)
+                    {
+                        AppendPolygon(polygon, chunk.indices);
+                    }
+                }
+                p += count * valueSize;
+            }
+        }
+    }
+
+    void ParseTask(const ChunkTask& task, ParsedChunk& chunk)
+    {
+        switch (format)
+        {
+        case FileFormat::PlyAscii:
+            ParsePlyAsciiChunk(task, chunk);
+            break;
+        case FileFormat::PlyBinary:
+            ParsePlyBinaryChunk(task, chunk);
+            break;
+        case FileFormat::Obj:
+            ParseObjChunk(task, chunk);
+            break;
+        case FileFormat::XyzAscii:
+            ParseXyzChunk(task, chunk);
+            break;
+        case FileFormat::RawBinary:
+            chunk.mappedPositions = (const Vec3*)(file.GetData() + task.begin);
+            chunk.numMappedPositions = task.numRecords;
+            break;
+        }
+    }
+
+    void WorkerLoop()
+    {
+        for (;;)
+        {
+            const size_t t = nextTask++;
+            if (t >= tasks.size())
+            {
+                return;
+            }
+
+            {
+                // Don't run too far ahead of the uploads, or a fast parser would buffer the whole file in memory.
+                std::unique_lock<std::mutex> lock(mutex);
+                chunkConsumed.wait(lock, [&]() { return cancelled || t < nextChunkToUpload + MaxChunksInFlight; });
+            }
+            if (cancelled)
+            {
+                return;
+            }
+
+            ParsedChunk chunk;
+            ParseTask(tasks[t], chunk);
+            bytesParsed += tasks[t].end - tasks[t].begin;
+            if (chunk.failed)
+            {
+                // Stops the load. Whatever was uploaded before stays in the buffer.
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    failed = true;
+                    cancelled = true;
+                }
+                chunkConsumed.notify_all();
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            readyChunks.emplace(t, std::move(chunk));
+        }
+    }
+
+    void Run()
+    {
+        if (!BuildTasks())
+        {
+            failed = !cancelled;
+            parsingFinished = true;
+            return;
+        }
+
+        const size_t numWorkers = ChooseWorkerCount(tasks.size(), 1);
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < numWorkers; ++i)
+        {
+            workers.emplace_back([this]() { WorkerLoop(); });
+        }
+        WorkerLoop();
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+
+        // Anything before the body, like the PLY header, counts as parsed too.
+        bytesParsed = file.GetSize();
+        parsingFinished = true;
+    }
+};
+
+GeometryLoader::GeometryLoader() : impl(std::make_unique<GeometryLoader::Impl>())
+{
+}
+
+GeometryLoader::~GeometryLoader() = default;
+
+bool GeometryLoader::Open(const char* path)
+{
+    // Start over, so a loader can be reused for another file.
+    impl = std::make_unique<GeometryLoader::Impl>();
+
+    if (!impl->file.Open(path))
+    {
+        return false;
+    }
+
+    std::string extension = strrchr(path, '.') != nullptr ? strrchr(path, '.') + 1 : "";
+    for (char& c : extension)
+    {
+        c = (char)tolower((unsigned char)c);
+    }
+
+    const char* data = impl->file.GetData();
+    if (impl->file.GetSize() >= 4 && memcmp(data, "ply", 3) == 0 && (data[3] == '\n' || data[3] == '\r'))
+    {
+        if (!impl->ParsePlyHeader(path))
+        {
+            return false;
+        }
+    }
+    else if (extension == "obj")
+    {
+        impl->format = FileFormat::Obj;
+    }
+    else if (extension == "xyz" || extension == "txt" || extension == "pts" || extension == "csv")
+    {
+        impl->format = FileFormat::XyzAscii;
+    }
+    else if (extension == "bin" || extension == "raw")
+    {
+        impl->format = FileFormat::RawBinary;
+        if (!IsLittleEndianHost())
+        {
+            fprintf(stderr, "%s: raw float files are only supported on little endian hosts\n", path);
+            return false;
+        }
+    }
+    else
+    {
+        fprintf(stderr, "%s: unrecognized file type\n", path);
+        return false;
+    }
+
+    impl->opened = true;
+    impl->thread = std::thread([impl = impl.get()]() { impl->Run(); });
+    return true;
+}
+
+void GeometryLoader::Update(View3d& view, size_t maxUploadBytes)
+{
+    if (!impl->opened || impl->done)
+    {
+        return;
+    }
+    if (impl->buffer == 0)
+    {
+        impl->buffer = view.CreateBuffer();
+    }
+
+    struct Target
+    {
+        View3d* view;
+        View3d::BufferHandle buffer;
+    } target{ &view, impl->buffer };
+
+    Update([](const Vec3* positions, const Vec3* colors, size_t numVertices, const unsigned int* indices, size_t numIndices, void* userData)
+    {
+        Target* target = (Target*)userData;
+        if (numVertices > 0)
+        {
+            target->view->AppendVertices(target->buffer, positions, colors, numVertices);
+        }
+        if (numIndices > 0)
+        {
+            target->view->AppendTriangles(target->buffer, indices, numIndices);
+        }
+    }, &target, maxUploadBytes);
+}
+
+void GeometryLoader::Update(GeometrySinkFn sink, void* userData, size_t maxBytes)
+{
+    if (!impl->opened || impl->done)
+    {
+        return;
+    }
+
+    // Take the next chunks in file order, then hand them over without holding the lock.
+    std::vector<ParsedChunk> chunks;
+    {
+        std::lock_guard<std::mutex> lock(impl->mutex);
+        size_t bytes = 0;
+        auto it = impl->readyChunks.find(impl->nextChunkToUpload);
+        while (it != impl->readyChunks.end() && bytes < maxBytes)
+        {
+            bytes += it->second.GetUploadBytes();
+            chunks.push_back(std::move(it->second));
+            impl->readyChunks.erase(it);
+            it = impl->readyChunks.find(++impl->nextChunkToUpload);
+        }
+    }
+    impl->chunkConsumed.notify_all();
+
+    for (const ParsedChunk& chunk : chunks)
+    {
+        const Vec3* positions = chunk.mappedPositions != nullptr ? chunk.mappedPositions : chunk.positions.data();
+        const size_t numVertices = chunk.mappedPositions != nullptr ? chunk.numMappedPositions : chunk.positions.size();
+        const Vec3* colors = chunk.colors.empty() ? nullptr : chunk.colors.data();
+        sink(positions, colors, numVertices, chunk.indices.data(), chunk.indices.size(), userData);
+        impl->verticesUploaded += numVertices;
+        impl->trianglesUploaded += chunk.indices.size() / 3;
+    }
+
+    if (impl->parsingFinished)
+    {
+        std::lock_guard<std::mutex> lock(impl->mutex);
+        if (impl->failed || impl->nextChunkToUpload >= impl->tasks.size())
+        {
+            impl->done = true;
+        }
+    }
+    if (impl->done && impl->thread.joinable())
+    {
+        impl->thread.join();
+    }
+}
+
+LoadProgress GeometryLoader::GetProgress() const
+{
+    LoadProgress progress;
+    progress.bytesTotal = impl->file.GetSize();
+    progress.bytesParsed = impl->bytesParsed;
+    progress.verticesUploaded = impl->verticesUploaded;
+    progress.trianglesUploaded = impl->trianglesUploaded;
+    progress.done = impl->done;
+    progress.failed = impl->failed;
+    return progress;
+}
+
+View3d::BufferHandle GeometryLoader::GetBuffer() const
+{
+    return impl->buffer;
+}
@@ -0,0 +1,134 @@
+#include "HiZ.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+void HiZPyramid::Build(const float* depths, int width, int height, int block, int fbWidth, int fbHeight, const float m[16])
+{
+    memcpy(clipFromWorld, m, sizeof(clipFromWorld));
+    blockSize = block;
+    framebufferWidth = fbWidth;
+    framebufferHeight = fbHeight;
+
+    // Levels are reused from the last build when the size hasn't changed, which is nearly always.
+    size_t numLevels = 1;
+    for (int w = width, h = height; w > 1 || h > 1; w = (w + 1) / 2, h = (h + 1) / 2)
+    {
+        ++numLevels;
+    }
+    levels.resize(numLevels);
+
+    Level& finest = levels[0];
+    finest.width = width;
+    finest.height = height;
+    finest.depths.assign(depths, depths + (size_t)width * height);
+
+    for (size_t k = 1; k < numLevels; ++k)
+    {
+        const Level& source = levels[k - 1];
+        Level& level = levels[k];
+        level.width = (source.width + 1) / 2;
+        level.height = (source.height + 1) / 2;
+        level.depths.resize((size_t)level.width * level.height);
+
+        for (int y = 0; y < level.height; ++y)
+        {
+            const int y0 = 2 * y;
+            const int y1 = std::min(y0 + 1, source.height - 1);
+            const float* row0 = &source.depths[(size_t)y0 * source.width];
+            const float* row1 = &source.depths[(size_t)y1 * source.width];
+            float* out = &level.depths[(size_t)y * level.width];
+            for (int x = 0; x < level.width; ++x)
+            {
+                const int x0 = 2 * x;
+                const int x1 = std::min(x0 + 1, source.width - 1);
+                out[x] = std::max(std::max(row0[x0], row0[x1]), std::max(row1[x0], row1[x1]));
+            }
+        }
+    }
+}
+
+void HiZPyramid::Clear()
+{
+    levels.clear();
+}
+
+bool HiZPyramid::IsEmpty() const
+{
+    return levels.empty();
+}
+
+bool HiZPyramid::IsOccluded(const Vec3& boundsMin, const Vec3& boundsMax) const
+{
+    if (levels.empty() || !(boundsMin.x <= boundsMax.x && boundsMin.y <= boundsMax.y && boundsMin.z <= boundsMax.z))
+    {
+        return false;
+    }
+
+    const float* m = clipFromWorld;
+    float minX = 1.f, minY = 1.f, maxX = -1.f, maxY = -1.f;
+    float nearestDepth = 1.f;
+    for (int corner = 0; corner < 8; ++corner)
+    {
+        const float px = (corner & 1) ? boundsMax.x : boundsMin.x;
+        const float py = (corner & 2) ? boundsMax.y : boundsMin.y;
+        const float pz = (corner & 4) ? boundsMax.z : boundsMin.z;
+
+        const float cx = m[0] * px + m[4] * py + m[8] * pz + m[12];
+        const float cy = m[1] * px + m[5] * py + m[9] * pz + m[13];
+        const float cz = m[2] * px + m[6] * py + m[10] * pz + m[14];
+        const float cw = m[3] * px + m[7] * py + m[11] * pz + m[15];
+
+        // Corners behind the camera, or in front of the near plane, make the projection meaningless.
+        if (!(cw > 0.f) || cz < -cw)
+        {
+            return false;
+        }
+
+        const float invW = 1.f / cw;
+        minX = std::min(minX, cx * invW);
+        maxX = std::max(maxX, cx * invW);
+        minY = std::min(minY, cy * invW);
+        maxY = std::max(maxY, cy * invW);
+        nearestDepth = std::min(nearestDepth, 0.5f * cz * invW + 0.5f);
+    }
+
+    // Off screen entirely: there's nothing to test it against, and frustum culling isn't this class's job.
+    if (maxX < -1.f || minX > 1.f || maxY < -1.f || minY > 1.f)
+    {
+        return false;
+    }
+
+    // Texels are blocks of framebuffer pixels, so the last one in a row or column may be a partial block, and the
+    // scale has to come from the framebuffer rather than the level's size. The rect is widened by a texel on each side
+    // for the rasterizer covering pixels whose centers the projected box only just reaches.
+    const Level& finest = levels[0];
+    const int block = blockSize;
+    auto toTexel = [block](float ndc, int framebufferSize, int size, int widen) {
+        const int texel = (int)floorf((0.5f * ndc + 0.5f) * framebufferSize / block) + widen;
+        return std::min(std::max(texel, 0), size - 1);
+    };
+    const int x0 = toTexel(minX, framebufferWidth, finest.width, -1);
+    const int x1 = toTexel(maxX, framebufferWidth, finest.width, 1);
+    const int y0 = toTexel(minY, framebufferHeight, finest.height, -1);
+    const int y1 = toTexel(maxY, framebufferHeight, finest.height, 1);
+
+    // The finest level at which the rect covers at most 4x4 texels.
+    size_t k = 0;
+    while (k + 1 < levels.size() && ((x1 >> k) - (x0 >> k) > 3 || (y1 >> k) - (y0 >> k) > 3))
+    {
+        ++k;
+    }
+
+    const Level& level = levels[k];
+    float farthest = 0.f;
+    for (int y = y0 >> k; y <= (y1 >> k); ++y)
+    {
+        for (int x = x0 >> k; x <= (x1 >> k); ++x)
+        {
+            farthest = std::max(farthest, level.depths[(size_t)y * level.width + x]);
+        }
+    }
+    return nearestDepth > farthest;
+}
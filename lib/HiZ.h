@@ -0,0 +1,42 @@
+#pragma once
+#include "Im3D.h"
+#include <vector>
+
+/*
+    Hierarchical depth for occlusion culling on the CPU.
+    The finest level comes back from the GPU already reduced: each texel holds the farthest depth of a block of
+    framebuffer pixels, the blocks along the right and top edges being cut short when the framebuffer isn't a multiple
+    of the block size. Each coarser level halves that, rounding up, so texel (x, y) of level k covers texels
+    (x << k, y << k) onwards of the finest level exactly. Rows are stored bottom to top, matching OpenGL.
+*/
+class HiZPyramid
+{
+public:
+    /*
+        depths are window-space, in [0,1], one per blockSize square of a framebuffer of the given size.
+        clipFromWorld is the camera they were rendered with, column-major.
+    */
+    void Build(const float* depths, int width, int height, int blockSize, int framebufferWidth, int framebufferHeight,
+        const float clipFromWorld[16]);
+    void Clear();
+
+    bool IsEmpty() const;
+
+    // True if the box is certainly behind what's in the pyramid, seen from the camera the pyramid was rendered with.
+    // Boxes crossing that camera's near plane never are.
+    bool IsOccluded(const Vec3& boundsMin, const Vec3& boundsMax) const;
+
+private:
+    struct Level
+    {
+        int width;
+        int height;
+        std::vector<float> depths;
+    };
+
+    std::vector<Level> levels;
+    int blockSize{ 1 };
+    int framebufferWidth{ 0 };
+    int framebufferHeight{ 0 };
+    float clipFromWorld[16]{};
+};
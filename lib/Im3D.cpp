@@ -2,6 +2,17 @@
 #include "imgui.h"
 #define IMGUI_DEFINE_MATH_OPERATORS
 #include "imgui_internal.h"
+#include "FrameArena.h"
+#include "HiZ.h"
+#include "Labels.h"
+#include "PointDensity.h"
+#include "Tessellation.h"
+#include "Util.h"
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <GL/gl3w.h>
@@ -14,6 +25,7 @@ namespace
         Vec3 col;
     };
 
+    // Matches PrimitiveType, which is how user layouts choose theirs.
     enum class DrawType : uint8_t
     {
         Points,
@@ -21,27 +33,250 @@ namespace
         LineList,
         Triangles
     };
+    static_assert((int)DrawType::Triangles == (int)PrimitiveType::Triangles, "DrawType and PrimitiveType differ");
 
     struct DrawCmd
     {
         DrawType type;
-        bool isDeferredDraw; // If true, uses the commands vertex + elements arrays to draw from, assuming they've already been uploaded.
-        unsigned int offset;
+        bool isDeferredDraw; // If true, draws from the command's retained buffer, which has already been uploaded.
+        bool isColormapped{ false }; // Recorded vertices hold a scalar in col.x instead of a color.
+        const VertexFormat* format{ nullptr }; // Set for vertices of a user layout, which are in typedVertexData, offset in units of the layout's stride.
+        unsigned int offset; // In vertices, or indices for triangles.
         unsigned int count;
 
-        GLuint vertexArray;
-        GLuint elementsArray;
+        uint32_t buffer;
     };
 
     constexpr Vec3 DefaultColor{ 1.f, 1.f, 1.f };
 
+    // Radius of the view ball as a fraction of the view's half width at the target, which is where it sits.
+    constexpr float ViewBallSize = 0.375f;
+    // Below this, segment counts blow up for no visible difference.
+    constexpr float MinTessellationTolerance = 0.05f;
+
+    /*
+        Writes to a GPU buffer, held back until the next Render() so the ones touching the same or neighbouring
+        bytes go up as a single sub-range upload. Later writes win where they overlap.
+    */
+    struct PendingWrites
+    {
+        struct Write
+        {
+            size_t offset; // In the GPU buffer.
+            size_t size;
+            size_t dataOffset; // In data.
+        };
+        std::vector<Write> writes;
+        std::vector<uint8_t> data;
+
+        void Add(size_t offset, const void* bytes, size_t size)
+        {
+            writes.push_back(Write{ offset, size, data.size() });
+            data.insert(data.end(), (const uint8_t*)bytes, (const uint8_t*)bytes + size);
+        }
+
+        void Flush(GLuint buffer, std::vector<uint32_t>& order, std::vector<uint8_t>& block)
+        {
+            if (writes.empty())
+            {
+                return;
+            }
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+
+            order.resize(writes.size());
+            for (uint32_t i = 0; i < order.size(); ++i)
+            {
+                order[i] = i;
+            }
+            std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return writes[a].offset < writes[b].offset; });
+
+            size_t runStart = 0;
+            while (runStart < order.size())
+            {
+                // Extend the run while the next write starts before or right where the run ends.
+                size_t begin = writes[order[runStart]].offset;
+                size_t end = begin + writes[order[runStart]].size;
+                size_t runEnd = runStart + 1;
+                while (runEnd < order.size() && writes[order[runEnd]].offset <= end)
+                {
+                    end = std::max(end, writes[order[runEnd]].offset + writes[order[runEnd]].size);
+                    ++runEnd;
+                }
+
+                if (runEnd - runStart == 1)
+                {
+                    const Write& write = writes[order[runStart]];
+                    glBufferSubData(GL_COPY_WRITE_BUFFER, write.offset, write.size, data.data() + write.dataOffset);
+                }
+                else
+                {
+                    // Assembled in submission order, so overlapping writes resolve the way they were made.
+                    std::sort(order.begin() + runStart, order.begin() + runEnd);
+                    block.resize(end - begin);
+                    for (size_t i = runStart; i < runEnd; ++i)
+                    {
+                        const Write& write = writes[order[i]];
+                        memcpy(block.data() + (write.offset - begin), data.data() + write.dataOffset, write.size);
+                    }
+                    glBufferSubData(GL_COPY_WRITE_BUFFER, begin, block.size(), block.data());
+                }
+                runStart = runEnd;
+            }
+
+            writes.clear();
+            data.clear();
+        }
+    };
+
+    // Geometry which stays on the GPU between frames, see View3d::CreateBuffer().
+    // Positions and colors live in separate buffers so position-only data can be uploaded as is.
+    struct RetainedBuffer
+    {
+        bool inUse{ false };
+        GLuint positions{ 0 };
+        GLuint colors{ 0 }; // Zero until vertices with colors are appended.
+        GLuint scalars{ 0 }; // Zero until scalars are appended. Buffers with scalars are colormapped.
+        GLuint elements{ 0 };
+        size_t vertexCount{ 0 };
+        size_t scalarCount{ 0 };
+        size_t vertexCapacity{ 0 };
+        size_t indexCount{ 0 };
+        size_t indexCapacity{ 0 };
+        // Of every position written, including overwritten ones, so they only ever grow. Empty while min > max.
+        Vec3 boundsMin{ FLT_MAX, FLT_MAX, FLT_MAX };
+        Vec3 boundsMax{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+        // Appends and updates since the last Render().
+        uint32_t version{ 0 }; // Bumped whenever they're flushed, for progressive rendering to notice.
+        PendingWrites positionWrites;
+        PendingWrites colorWrites;
+        PendingWrites scalarWrites;
+        PendingWrites elementWrites;
+    };
+
+    size_t GrownCapacity(size_t capacity, size_t required)
+    {
+        return std::max(required, std::max<size_t>(capacity + capacity / 2, 1024));
+    }
+
+    // Reallocates the buffer with room for newSize bytes, keeping the first usedBytes. The copy stays on the GPU.
+    void GrowBuffer(GLuint& buffer, size_t usedBytes, size_t newSize)
+    {
+        GLuint grown;
+        glGenBuffers(1, &grown);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+        glBufferData(GL_COPY_WRITE_BUFFER, newSize, nullptr, GL_STATIC_DRAW);
+        if (buffer != 0)
+        {
+            if (usedBytes > 0)
+            {
+                glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, usedBytes);
+            }
+            glDeleteBuffers(1, &buffer);
+        }
+        buffer = grown;
+    }
+
+    void ExpandBounds(RetainedBuffer& buffer, const Vec3* positions, size_t numPositions)
+    {
+        for (size_t i = 0; i < numPositions; ++i)
+        {
+            buffer.boundsMin.x = std::min(buffer.boundsMin.x, positions[i].x);
+            buffer.boundsMin.y = std::min(buffer.boundsMin.y, positions[i].y);
+            buffer.boundsMin.z = std::min(buffer.boundsMin.z, positions[i].z);
+            buffer.boundsMax.x = std::max(buffer.boundsMax.x, positions[i].x);
+            buffer.boundsMax.y = std::max(buffer.boundsMax.y, positions[i].y);
+            buffer.boundsMax.z = std::max(buffer.boundsMax.z, positions[i].z);
+        }
+    }
+
+    // Gives a buffer of position-only vertices colors, which keeps the earlier vertices in the default color.
+    void AddColorStream(RetainedBuffer& buffer)
+    {
+        if (buffer.colors != 0)
+        {
+            return;
+        }
+        GrowBuffer(buffer.colors, 0, buffer.vertexCapacity * sizeof(Vec3));
+        if (buffer.vertexCount > 0)
+        {
+            std::vector<Vec3> fill(buffer.vertexCount, DefaultColor);
+            buffer.colorWrites.Add(0, fill.data(), fill.size() * sizeof(Vec3));
+        }
+    }
+
     GLuint vertShaderHandle;
     GLuint fragShaderHandle;
     GLuint shaderHandle{ 0 };
-    GLuint attribLocationVtxPos;
-    GLuint attribLocationVtxCol;
+    // Bound before linking rather than queried, so every program agrees on where the position goes.
+    constexpr GLuint attribLocationVtxPos = 0;
+    constexpr GLuint attribLocationVtxCol = 1;
+    constexpr GLuint attribLocationVtxScalar = 2;
     GLuint uniformLocationCamFromWorld;
     GLuint uniformLocationClipFromCamera;
+    GLuint uniformLocationUseColormap;
+    GLuint uniformLocationColormap;
+    GLuint uniformLocationColormapSize;
+    GLuint uniformLocationColormapRange;
+
+    GLuint densityShaderHandle{ 0 };
+    GLuint uniformLocationDensity;
+    GLuint uniformLocationDensityColormap;
+    GLuint uniformLocationDensityColormapSize;
+
+    // Built in colormaps, indexed by Colormap. Textures one texel high, which the sampler interpolates along.
+    constexpr int NumBuiltinColormaps = 3;
+    GLuint colormapTextures[NumBuiltinColormaps]{};
+    constexpr int BuiltinColormapSize = 9;
+
+    // Each sampled at 9 evenly spaced stops.
+    constexpr unsigned char BuiltinColormapStops[NumBuiltinColormaps][BuiltinColormapSize][3] = {
+        // Viridis
+        { { 68, 1, 84 }, { 71, 45, 123 }, { 59, 82, 139 }, { 44, 114, 142 }, { 33, 145, 140 },
+          { 40, 174, 128 }, { 94, 201, 98 }, { 173, 220, 48 }, { 253, 231, 37 } },
+        // Jet
+        { { 0, 0, 128 }, { 0, 0, 255 }, { 0, 128, 255 }, { 0, 255, 255 }, { 128, 255, 128 },
+          { 255, 255, 0 }, { 255, 128, 0 }, { 255, 0, 0 }, { 128, 0, 0 } },
+        // Diverging, Moreland's cool to warm.
+        { { 59, 76, 192 }, { 98, 130, 234 }, { 141, 176, 254 }, { 184, 208, 249 }, { 221, 221, 221 },
+          { 245, 196, 173 }, { 244, 154, 123 }, { 222, 96, 77 }, { 180, 4, 38 } }
+    };
+
+    // Texture unit the main shader reads its colormap from, clear of the ones the density pass uses.
+    constexpr int ColormapTextureUnit = 2;
+
+    GLuint CreateColormapTexture(const void* rgb, int size, GLenum format)
+    {
+        GLuint prevTexture;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, (GLint*)&prevTexture);
+
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, size, 1, 0, format, GL_UNSIGNED_BYTE, rgb);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+        glBindTexture(GL_TEXTURE_2D, prevTexture);
+        return texture;
+    }
+
+    void InitializeColormaps()
+    {
+        if (colormapTextures[0] != 0)
+        {
+            return;
+        }
+        for (int i = 0; i < NumBuiltinColormaps; ++i)
+        {
+            colormapTextures[i] = CreateColormapTexture(BuiltinColormapStops[i], BuiltinColormapSize, GL_RGB);
+        }
+    }
 
 
     static bool CheckShader(GLuint handle, const char* desc)
@@ -86,21 +321,40 @@ namespace
             uniform mat4 clipFromCamera;
             in vec3 Position;
             in vec3 Color;
+            in float Scalar;
             out vec4 FragColor;
+            out float FragScalar;
             void main()
             {
                 FragColor = vec4(Color, 1.0);
+                FragScalar = Scalar;
                 gl_Position = clipFromCamera*cameraFromWorld*vec4(Position.xyz, 1);
             }
 )%%";
 
+        // Scalars are mapped per fragment, so triangles show the colormap rather than a blend of its ends.
         constexpr char* fragShaderSource = R"%%(
         #version 130
+        uniform bool UseColormap;
+        uniform sampler2D Colormap;
+        uniform float ColormapSize;
+        uniform vec2 ColormapRange; // Scalar mapped to 0, and 1 / (max - min).
         in vec4 FragColor;
+        in float FragScalar;
         out vec4 OutColor;
         void main()
         {
-            OutColor = FragColor;
+            if (UseColormap)
+            {
+                float t = clamp((FragScalar - ColormapRange.x) * ColormapRange.y, 0.0, 1.0);
+                // Map [0,1] onto the centers of the first and last texels.
+                float u = (0.5 + t * (ColormapSize - 1.0)) / ColormapSize;
+                OutColor = vec4(texture(Colormap, vec2(u, 0.5)).rgb, 1.0);
+            }
+            else
+            {
+                OutColor = FragColor;
+            }
         }
 )%%";
 
@@ -117,14 +371,444 @@ namespace
         shaderHandle = glCreateProgram();
         glAttachShader(shaderHandle, vertShaderHandle);
         glAttachShader(shaderHandle, fragShaderHandle);
+        glBindAttribLocation(shaderHandle, attribLocationVtxPos, "Position");
+        glBindAttribLocation(shaderHandle, attribLocationVtxCol, "Color");
+        glBindAttribLocation(shaderHandle, attribLocationVtxScalar, "Scalar");
         glLinkProgram(shaderHandle);
         CheckProgram(shaderHandle, "shader program");
 
-
-        attribLocationVtxPos = glGetAttribLocation(shaderHandle, "Position");
-        attribLocationVtxCol = glGetAttribLocation(shaderHandle, "Color");
         uniformLocationCamFromWorld = glGetUniformLocation(shaderHandle, "cameraFromWorld");
         uniformLocationClipFromCamera = glGetUniformLocation(shaderHandle, "clipFromCamera");
+        uniformLocationUseColormap = glGetUniformLocation(shaderHandle, "UseColormap");
+        uniformLocationColormap = glGetUniformLocation(shaderHandle, "Colormap");
+        uniformLocationColormapSize = glGetUniformLocation(shaderHandle, "ColormapSize");
+        uniformLocationColormapRange = glGetUniformLocation(shaderHandle, "ColormapRange");
+
+        glUseProgram(shaderHandle);
+        glUniform1i(uniformLocationColormap, ColormapTextureUnit);
+        glUseProgram(0);
+    }
+
+    // Attribute i of attributeNames, if any, is bound to location i.
+    GLuint CreateProgram(const char* vertSource, const char* fragSource, const char* desc, const char* const* attributeNames = nullptr, int numAttributes = 0)
+    {
+        GLuint vert = glCreateShader(GL_VERTEX_SHADER);
+        GLuint frag = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(vert, 1, &vertSource, nullptr);
+        glShaderSource(frag, 1, &fragSource, nullptr);
+        glCompileShader(vert);
+        CheckShader(vert, desc);
+        glCompileShader(frag);
+        CheckShader(frag, desc);
+
+        GLuint program = glCreateProgram();
+        glAttachShader(program, vert);
+        glAttachShader(program, frag);
+        for (int i = 0; i < numAttributes; ++i)
+        {
+            glBindAttribLocation(program, i, attributeNames[i]);
+        }
+        glLinkProgram(program);
+        CheckProgram(program, desc);
+
+        // The program keeps what it needs, these get deleted along with it.
+        glDeleteShader(vert);
+        glDeleteShader(frag);
+        return program;
+    }
+
+    // Shared by the passes which shade the whole framebuffer: generates a covering triangle from gl_VertexID.
+    constexpr const char* FullscreenVertShaderSource = R"%%(
+        #version 130
+        out vec2 UV;
+        void main()
+        {
+            UV = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+            gl_Position = vec4(UV * 2.0 - 1.0, 0.0, 1.0);
+        }
+)%%";
+
+    void InitializeDensityShader()
+    {
+        if (densityShaderHandle != 0)
+        {
+            return;
+        }
+        constexpr const char* fragShaderSource = R"%%(
+        #version 130
+        uniform sampler2D Density;
+        uniform sampler2D Colormap;
+        uniform float ColormapSize;
+        in vec2 UV;
+        out vec4 OutColor;
+        void main()
+        {
+            float d = texture(Density, UV).r;
+            if (d <= 0.0)
+                discard;
+            // Map [0,1] onto the centers of the first and last texels.
+            float u = (0.5 + d * (ColormapSize - 1.0)) / ColormapSize;
+            OutColor = vec4(texture(Colormap, vec2(u, 0.5)).rgb, 1.0);
+        }
+)%%";
+
+        densityShaderHandle = CreateProgram(FullscreenVertShaderSource, fragShaderSource, "density shader");
+        uniformLocationDensity = glGetUniformLocation(densityShaderHandle, "Density");
+        uniformLocationDensityColormap = glGetUniformLocation(densityShaderHandle, "Colormap");
+        uniformLocationDensityColormapSize = glGetUniformLocation(densityShaderHandle, "ColormapSize");
+    }
+
+    GLuint hiZShaderHandle{ 0 };
+    GLuint uniformLocationHiZDepth;
+    GLuint uniformLocationHiZBlockSize;
+
+    // Each output texel takes the farthest depth of a BlockSize square of the depth buffer, for HiZPyramid.
+    void InitializeHiZShader()
+    {
+        if (hiZShaderHandle != 0)
+        {
+            return;
+        }
+        constexpr const char* fragShaderSource = R"%%(
+        #version 130
+        uniform sampler2D Depth;
+        uniform int BlockSize;
+        out vec4 OutDepth;
+        void main()
+        {
+            ivec2 size = textureSize(Depth, 0);
+            ivec2 start = ivec2(gl_FragCoord.xy) * BlockSize;
+            ivec2 end = min(start + BlockSize, size);
+            float farthest = 0.0;
+            for (int y = start.y; y < end.y; ++y)
+            {
+                for (int x = start.x; x < end.x; ++x)
+                {
+                    farthest = max(farthest, texelFetch(Depth, ivec2(x, y), 0).r);
+                }
+            }
+            OutDepth = vec4(farthest);
+        }
+)%%";
+
+        hiZShaderHandle = CreateProgram(FullscreenVertShaderSource, fragShaderSource, "hi-z shader");
+        uniformLocationHiZDepth = glGetUniformLocation(hiZShaderHandle, "Depth");
+        uniformLocationHiZBlockSize = glGetUniformLocation(hiZShaderHandle, "BlockSize");
+    }
+
+    // The reduced depth read back for occlusion culling is at most this wide and high.
+    constexpr int HiZMaxReadbackSize = 256;
+
+    GLuint CreateComputeProgram(const char* const* sources, int numSources, const char* desc)
+    {
+        GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(shader, numSources, sources, nullptr);
+        glCompileShader(shader);
+        bool ok = CheckShader(shader, desc);
+
+        GLuint program = glCreateProgram();
+        glAttachShader(program, shader);
+        glLinkProgram(program);
+        ok = CheckProgram(program, desc) && ok;
+        glDeleteShader(shader);
+        if (!ok)
+        {
+            glDeleteProgram(program);
+            return 0;
+        }
+        return program;
+    }
+
+    /*
+        Points rasterized by compute shaders rather than as GL_POINTS, for clouds so large that the fixed function
+        pipeline is the bottleneck. Each point covers one pixel. The depth pass keeps the nearest depth per pixel with
+        atomicMin, the color pass adds up the colors of the points at exactly that depth, and the resolve pass draws
+        their average into the framebuffer, with its depth, so the points are depth tested against everything else.
+    */
+    constexpr GLuint PointRasterGroupSize = 256;
+    constexpr GLuint PointRasterMaxGroups = 65535; // The least every implementation supports in a dimension.
+    // Storage buffer bindings.
+    constexpr GLuint PointRasterPositionsBinding = 0;
+    constexpr GLuint PointRasterDepthsBinding = 1;
+    constexpr GLuint PointRasterAttributesBinding = 2;
+    constexpr GLuint PointRasterColorsBinding = 3;
+
+    // How the color pass colors points.
+    enum class PointRasterColorSource : GLint
+    {
+        Constant,
+        Colors,
+        Colormap
+    };
+
+    struct PointRasterProgram
+    {
+        GLuint handle{ 0 };
+        GLint uniformLocationClipFromWorld;
+        GLint uniformLocationFramebufferSize;
+        GLint uniformLocationCount;
+        GLint uniformLocationPositionBase;
+        GLint uniformLocationPositionStride;
+
+        bool Initialize(const char* common, const char* main, const char* desc)
+        {
+            const char* sources[] = { common, main };
+            handle = CreateComputeProgram(sources, 2, desc);
+            uniformLocationClipFromWorld = glGetUniformLocation(handle, "ClipFromWorld");
+            uniformLocationFramebufferSize = glGetUniformLocation(handle, "FramebufferSize");
+            uniformLocationCount = glGetUniformLocation(handle, "Count");
+            uniformLocationPositionBase = glGetUniformLocation(handle, "PositionBase");
+            uniformLocationPositionStride = glGetUniformLocation(handle, "PositionStride");
+            return handle != 0;
+        }
+    };
+
+    PointRasterProgram pointDepthProgram;
+    PointRasterProgram pointColorProgram;
+    GLint uniformLocationPointColorSource;
+    GLint uniformLocationPointColor;
+    GLint uniformLocationPointAttributeBase;
+    GLint uniformLocationPointAttributeStride;
+    GLint uniformLocationPointColormap;
+    GLint uniformLocationPointColormapSize;
+    GLint uniformLocationPointColormapRange;
+    GLuint pointResolveShaderHandle{ 0 };
+    GLint uniformLocationPointResolveWidth;
+    GLint64 pointRasterMaxBlockSize; // In bytes, can be more than a GLint holds.
+    GLint pointRasterOffsetAlignment;
+
+    // Needs GL 4.3. Returns false, and leaves the programs alone, if they can't be built.
+    bool InitializePointRasterShaders()
+    {
+        if (pointResolveShaderHandle != 0)
+        {
+            return true;
+        }
+        GLint major = 0, minor = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &major);
+        glGetIntegerv(GL_MINOR_VERSION, &minor);
+        if (major < 4 || (major == 4 && minor < 3))
+        {
+            fprintf(stderr, "Im3D: compute point rendering needs OpenGL 4.3, the context is %d.%d\n", major, minor);
+            return false;
+        }
+
+        // Points are read as floats, Stride apart from Base on, so DrawVerts and retained buffers can be read as they are.
+        // Each dispatch only binds the range of the buffers it reads, as whole buffers may be larger than a binding allows.
+        constexpr const char* commonSource = R"%%(
+        #version 430
+        layout(local_size_x = 256) in;
+        layout(std430, binding = 0) readonly buffer Positions { float positions[]; };
+        layout(std430, binding = 1) buffer Depths { uint depths[]; };
+        uniform mat4 ClipFromWorld;
+        uniform ivec2 FramebufferSize;
+        uniform uint Count;
+        uniform uint PositionBase;
+        uniform uint PositionStride;
+
+        // Depths are compared as bits, which order the same as the values since they're never negative.
+        bool Project(uint i, out uint pixel, out uint depth)
+        {
+            uint p = PositionBase + i * PositionStride;
+            vec4 clip = ClipFromWorld * vec4(positions[p], positions[p + 1], positions[p + 2], 1.0);
+            if (clip.w <= 0.0 || any(greaterThan(abs(clip.xyz), vec3(clip.w))))
+                return false;
+            vec3 ndc = clip.xyz / clip.w;
+            ivec2 xy = min(ivec2((ndc.xy * 0.5 + 0.5) * vec2(FramebufferSize)), FramebufferSize - 1);
+            pixel = uint(xy.y * FramebufferSize.x + xy.x);
+            depth = floatBitsToUint(ndc.z * 0.5 + 0.5);
+            return true;
+        }
+)%%";
+
+        constexpr const char* depthSource = R"%%(
+        void main()
+        {
+            if (gl_GlobalInvocationID.x >= Count)
+                return;
+            uint pixel, depth;
+            if (Project(gl_GlobalInvocationID.x, pixel, depth))
+                atomicMin(depths[pixel], depth);
+        }
+)%%";
+
+        // Colors are summed in 255ths, with the number of points last, four uints per pixel.
+        constexpr const char* colorSource = R"%%(
+        layout(std430, binding = 2) readonly buffer Attributes { float attributes[]; };
+        layout(std430, binding = 3) buffer Colors { uint colors[]; };
+        uniform int ColorSource; // 0 for Color, 1 for rgb attributes, 2 for scalar attributes through the colormap.
+        uniform vec3 Color;
+        uniform uint AttributeBase;
+        uniform uint AttributeStride;
+        uniform sampler2D Colormap;
+        uniform float ColormapSize;
+        uniform vec2 ColormapRange;
+        void main()
+        {
+            if (gl_GlobalInvocationID.x >= Count)
+                return;
+            uint i = gl_GlobalInvocationID.x;
+            uint pixel, depth;
+            if (!Project(i, pixel, depth) || depths[pixel] != depth)
+                return;
+
+            vec3 color = Color;
+            uint a = AttributeBase + i * AttributeStride;
+            if (ColorSource == 1)
+            {
+                color = vec3(attributes[a], attributes[a + 1], attributes[a + 2]);
+            }
+            else if (ColorSource == 2)
+            {
+                float t = clamp((attributes[a] - ColormapRange.x) * ColormapRange.y, 0.0, 1.0);
+                float u = (0.5 + t * (ColormapSize - 1.0)) / ColormapSize;
+                color = textureLod(Colormap, vec2(u, 0.5), 0.0).rgb;
+            }
+            uvec3 c = uvec3(clamp(color, 0.0, 1.0) * 255.0 + 0.5);
+            atomicAdd(colors[4u * pixel], c.r);
+            atomicAdd(colors[4u * pixel + 1u], c.g);
+            atomicAdd(colors[4u * pixel + 2u], c.b);
+            atomicAdd(colors[4u * pixel + 3u], 1u);
+        }
+)%%";
+
+        constexpr const char* resolveSource = R"%%(
+        #version 430
+        layout(std430, binding = 1) readonly buffer Depths { uint depths[]; };
+        layout(std430, binding = 3) readonly buffer Colors { uint colors[]; };
+        uniform int FramebufferWidth;
+        out vec4 OutColor;
+        void main()
+        {
+            uint pixel = uint(gl_FragCoord.y) * uint(FramebufferWidth) + uint(gl_FragCoord.x);
+            uint count = colors[4u * pixel + 3u];
+            if (count == 0u)
+                discard;
+            vec3 sum = vec3(colors[4u * pixel], colors[4u * pixel + 1u], colors[4u * pixel + 2u]);
+            OutColor = vec4(sum / (255.0 * float(count)), 1.0);
+            gl_FragDepth = uintBitsToFloat(depths[pixel]);
+        }
+)%%";
+
+        PointRasterProgram depthProgram, colorProgram;
+        if (!depthProgram.Initialize(commonSource, depthSource, "point depth shader")
+            || !colorProgram.Initialize(commonSource, colorSource, "point color shader"))
+        {
+            glDeleteProgram(depthProgram.handle);
+            glDeleteProgram(colorProgram.handle);
+            return false;
+        }
+        pointDepthProgram = depthProgram;
+        pointColorProgram = colorProgram;
+        uniformLocationPointColorSource = glGetUniformLocation(colorProgram.handle, "ColorSource");
+        uniformLocationPointColor = glGetUniformLocation(colorProgram.handle, "Color");
+        uniformLocationPointAttributeBase = glGetUniformLocation(colorProgram.handle, "AttributeBase");
+        uniformLocationPointAttributeStride = glGetUniformLocation(colorProgram.handle, "AttributeStride");
+        uniformLocationPointColormap = glGetUniformLocation(colorProgram.handle, "Colormap");
+        uniformLocationPointColormapSize = glGetUniformLocation(colorProgram.handle, "ColormapSize");
+        uniformLocationPointColormapRange = glGetUniformLocation(colorProgram.handle, "ColormapRange");
+
+        glGetInteger64v(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &pointRasterMaxBlockSize);
+        glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &pointRasterOffsetAlignment);
+        pointResolveShaderHandle = CreateProgram(FullscreenVertShaderSource, resolveSource, "point resolve shader");
+        uniformLocationPointResolveWidth = glGetUniformLocation(pointResolveShaderHandle, "FramebufferWidth");
+        return true;
+    }
+
+    struct AttributeFormat
+    {
+        GLint components;
+        GLenum type;
+        GLboolean normalized;
+        bool integer; // Read with glVertexAttribIPointer, as an int or uint input.
+        const char* glslType;
+    };
+
+    // Indexed by VertexAttributeType.
+    constexpr AttributeFormat AttributeFormats[] = {
+        { 1, GL_FLOAT, GL_FALSE, false, "float" },
+        { 2, GL_FLOAT, GL_FALSE, false, "vec2" },
+        { 3, GL_FLOAT, GL_FALSE, false, "vec3" },
+        { 4, GL_FLOAT, GL_FALSE, false, "vec4" },
+        { 4, GL_UNSIGNED_BYTE, GL_TRUE, false, "vec4" },
+        { 1, GL_INT, GL_FALSE, true, "int" },
+        { 1, GL_UNSIGNED_INT, GL_FALSE, true, "uint" },
+    };
+
+    // What a view builds for a vertex layout the first time it draws one, so drawing only binds it.
+    struct LayoutState
+    {
+        GLuint program;
+        GLint uniformLocationCamFromWorld;
+        GLint uniformLocationClipFromCamera;
+        GLuint vertexArrayObject;
+    };
+
+    // Builds the program for a vertex layout, declaring one shader input per attribute around the layout's Shade() body.
+    void InitializeLayoutProgram(const VertexFormat& format, LayoutState& layout)
+    {
+        std::string vertSource =
+            "#version 130\n"
+            "uniform mat4 cameraFromWorld;\n"
+            "uniform mat4 clipFromCamera;\n";
+        const char* attributeNames[16];
+        for (uint32_t i = 0; i < format.numAttributes; ++i)
+        {
+            const VertexAttribute& attribute = format.attributes[i];
+            const AttributeFormat& attributeFormat = AttributeFormats[(int)attribute.type];
+            vertSource += "in ";
+            vertSource += attributeFormat.glslType;
+            vertSource += " ";
+            vertSource += attribute.name;
+            vertSource += ";\n";
+            attributeNames[i] = attribute.name;
+        }
+        vertSource += "out vec4 FragColor;\nvec4 Shade()\n{\n";
+        vertSource += format.shader != nullptr ? format.shader : "return vec4(1.0);";
+        vertSource += "\n}\nvoid main()\n{\n    FragColor = Shade();\n    gl_Position = clipFromCamera*cameraFromWorld*vec4(";
+        vertSource += format.attributes[0].name;
+        vertSource += ", 1);\n}\n";
+
+        constexpr const char* fragShaderSource = R"%%(
+        #version 130
+        in vec4 FragColor;
+        out vec4 OutColor;
+        void main()
+        {
+            OutColor = FragColor;
+        }
+)%%";
+
+        layout.program = CreateProgram(vertSource.c_str(), fragShaderSource, "vertex layout shader", attributeNames, (int)format.numAttributes);
+        layout.uniformLocationCamFromWorld = glGetUniformLocation(layout.program, "cameraFromWorld");
+        layout.uniformLocationClipFromCamera = glGetUniformLocation(layout.program, "clipFromCamera");
+    }
+
+    /*
+        Sets up the vertex array of a layout, with its attributes read from the start of buffer. Typed draws start at
+        a multiple of their vertex size, so they pick their vertices with the first vertex of the draw call instead of
+        moving the attributes, and the vertex array never changes after this.
+    */
+    void InitializeLayoutVertexArray(const VertexFormat& format, GLuint buffer, LayoutState& layout)
+    {
+        glGenVertexArrays(1, &layout.vertexArrayObject);
+        glBindVertexArray(layout.vertexArrayObject);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        for (uint32_t i = 0; i < format.numAttributes; ++i)
+        {
+            const VertexAttribute& attribute = format.attributes[i];
+            const AttributeFormat& attributeFormat = AttributeFormats[(int)attribute.type];
+            const GLvoid* pointer = (const GLvoid*)(size_t)attribute.offset;
+            glEnableVertexAttribArray(i);
+            if (attributeFormat.integer)
+            {
+                glVertexAttribIPointer(i, attributeFormat.components, attributeFormat.type, format.stride, pointer);
+            }
+            else
+            {
+                glVertexAttribPointer(i, attributeFormat.components, attributeFormat.type, attributeFormat.normalized, format.stride, pointer);
+            }
+        }
     }
 
 
@@ -260,6 +944,15 @@ namespace
         m[12] = 0; m[13] = 0; m[14] = 2 * n * f / (n - f); m[15] = 0;
     }
 
+    // Same depth mapping as FillProjectionMatrix(), with r and t the half extents of the view.
+    void FillOrthographicMatrix(float n, float f, float r, float t, float m[16])
+    {
+        m[0] = 1 / r; m[1] = 0; m[2] = 0; m[3] = 0;
+        m[4] = 0; m[5] = 1 / t; m[6] = 0; m[7] = 0;
+        m[8] = 0; m[9] = 0; m[10] = 2 / (f - n); m[11] = 0;
+        m[12] = 0; m[13] = 0; m[14] = -(n + f) / (f - n); m[15] = 1;
+    }
+
     Vec3 GetArcballVector(float x, float y)
     {
         Vec3 p{ x, y, 0 };
@@ -276,84 +969,1196 @@ namespace
         }
         return p;
     }
-}
 
+    // Unit vectors u and v with u, v and normal forming a right-handed basis.
+    void GetPerpendicularAxes(const Vec3& normal, Vec3& u, Vec3& v)
+    {
+        const Vec3 n = Normalized(normal);
+        const Vec3 other = fabsf(n.x) < 0.5f ? Vec3{ 1, 0, 0 } : Vec3{ 0, 1, 0 };
+        u = Normalized(Cross(other, n));
+        v = Cross(n, u);
+    }
 
-struct View3d::Impl
-{
-    ImVec2 framebufferSize;
-    GLuint colorTexture;
-    GLuint depthbuffer;
-    GLuint framebuffer;
+    // FNV-1a, used to cheaply detect changes to the recorded scene.
+    uint64_t HashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull)
+    {
+        const uint8_t* bytes = (const uint8_t*)data;
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
 
-    ImVec4 backgroundColor{ 0,0,0,0 };
+    /*
+        Hashes whole buffers, 8 bytes at a time in four independent lanes, so hashing everything recorded each frame
+        runs at close to the speed of uploading it. Every step is a bijection of its lane, so changing any single word
+        always changes the result.
+    */
+    uint64_t HashWords(const void* data, size_t size, uint64_t hash)
+    {
+        const uint8_t* bytes = (const uint8_t*)data;
+        uint64_t lanes[4] = { hash, hash ^ 1, hash ^ 2, hash ^ 3 };
+        size_t i = 0;
+        for (; i + 32 <= size; i += 32)
+        {
+            for (int lane = 0; lane < 4; ++lane)
+            {
+                uint64_t word;
+                memcpy(&word, bytes + i + lane * 8, 8);
+                lanes[lane] = (lanes[lane] ^ word) * 1099511628211ull;
+            }
+        }
+        hash = HashBytes(lanes, sizeof(lanes), hash);
+        return HashBytes(bytes + i, size - i, hash);
+    }
 
-    std::vector<DrawVert> vertexBuffer;
-    std::vector<unsigned int> indexBuffer;
-    std::vector<DrawCmd> drawCommands;
+    GLenum GetDrawMode(DrawType type, bool& hasIndices)
+    {
+        hasIndices = false;
+        switch (type)
+        {
+        case DrawType::Points:
+            return GL_POINTS;
+        case DrawType::Lines:
+            return GL_LINES;
+        case DrawType::LineList:
+            return GL_LINE_STRIP;
+        case DrawType::Triangles:
+            hasIndices = true;
+            return GL_TRIANGLES;
+        default:
+            return GL_POINTS;
+        }
+    }
 
-    GLuint vertexArray;
-    GLuint elementsArray;
+    // Every n-th point is drawn in the first progressive pass, so a coarse version of the scene shows up immediately.
+    constexpr unsigned int ProgressiveCoarseStride = 16;
+    constexpr size_t ProgressiveMinVerticesPerFrame = 4096;
 
-    Vec3 cameraTarget{ 0.f,0.f,0.f };
-    Vec3 cameraPosition{ 0.f,0.f,-10.f };
-    Vec3 cameraUp{ 0,1,0 };
+    enum class ProgressivePass : uint8_t
+    {
+        Coarse,
+        Refine,
+        Done
+    };
 
-    float nearPlane = 0.1;
-    float farPlane = 100;
-    float horizontalFovDegrees = 30.f;
-    float cameraRotateSpeed = 2.f;
-    float cameraZoomSpeed = 5.f;
+    struct ProgressiveState
+    {
+        bool enabled{ false };
+        bool restartRequested{ true };
+        float budgetMs{ 8.f };
+
+        // What the accumulated image currently shows. Any change restarts the accumulation.
+        uint64_t sceneSignature{ 0 };
+        Vec3 cameraPosition{ 0,0,0 };
+        Vec3 cameraTarget{ 0,0,0 };
+        Vec3 cameraUp{ 0,0,0 };
+        float nearPlane{ 0 };
+        float farPlane{ 0 };
+        float horizontalFovDegrees{ 0 };
+        CameraProjection projection{ CameraProjection::Perspective };
+
+        // Cursor into the recorded command list.
+        ProgressivePass pass{ ProgressivePass::Done };
+        size_t commandIndex{ 0 };
+        size_t vertexIndex{ 0 };
+
+        size_t verticesDrawn{ 0 };
+        size_t verticesTotal{ 0 };
+
+        // Throughput estimate turning the time budget into a vertex budget, refined from GPU timer queries.
+        float verticesPerMs{ 100000.f };
+        GLuint timerQueries[2]{ 0, 0 };
+        size_t queryVertices[2]{ 0, 0 };
+        bool queryPending[2]{ false, false };
+        int currentQuery{ 0 };
+    };
 
-    bool Initialize(const ImVec2& fbSize)
+    // A camera onto the recorded scene, with its own render target. See View3d::AddViewport().
+    struct Viewport
     {
-        InitializeShaders();//TODO: Make this only happen on creation of the first 3d view.
+        bool inUse{ false };
+        ImVec2 framebufferSize;
+        GLuint colorTexture{ 0 };
+        GLuint depthTexture{ 0 }; // A texture rather than a renderbuffer, so the Hi-Z pass can read it.
+        GLuint framebuffer{ 0 };
+
+        Vec3 cameraTarget{ 0.f,0.f,0.f };
+        Vec3 cameraPosition{ 0.f,0.f,-10.f };
+        Vec3 cameraUp{ 0,1,0 };
+        CameraProjection projection{ CameraProjection::Perspective };
+
+        float nearPlane = 0.1;
+        float farPlane = 100;
+        float horizontalFovDegrees = 30.f;
+
+        ProgressiveState progressive;
+
+        // Densities and labels depend on the camera, so each viewport projects its own.
+        PointDensityGrid densityGrid;
+        bool hasDensity{ false };
+        GLuint densityTexture{ 0 };
+        std::vector<LabelBatch::ProjectedLabel> labels;
+
+        /*
+            Occlusion culling. After drawing, the depth buffer is reduced on the GPU and read back into a pixel
+            buffer, which is picked up without stalling a frame or more later, once its fence has signalled.
+            Only one readback is in flight at a time. The resources are created on first use.
+        */
+        HiZPyramid hiZ;
+        GLuint hiZTexture{ 0 };
+        GLuint hiZFramebuffer{ 0 };
+        GLuint hiZPixelBuffer{ 0 };
+        GLsync hiZFence{ nullptr };
+        int hiZBlockSize{ 0 };
+        int hiZWidth{ 0 };
+        int hiZHeight{ 0 };
+        float hiZClipFromWorld[16]; // Of the readback in flight.
+        size_t occludedDraws{ 0 }; // Skipped in the last Render().
+
+        // Per pixel storage for compute point rendering, created on first use. See InitializePointRasterShaders().
+        GLuint pointDepthBuffer{ 0 };
+        GLuint pointColorBuffer{ 0 };
+
+        bool Initialize(const ImVec2& fbSize)
+        {
+            framebufferSize = fbSize;
+
+            //Backup framebuffer state.
+            GLuint prevTexture;
+            glGetIntegerv(GL_TEXTURE_BINDING_2D, (GLint*)&prevTexture);
+            GLuint prevFramebuffer;
+            glGetIntegerv(GL_FRAMEBUFFER_BINDING, (GLint*)&prevFramebuffer);
+
+            // Generate framebuffers and textures necessary.
+            glGenTextures(1, &colorTexture);
+            glBindTexture(GL_TEXTURE_2D, colorTexture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, framebufferSize.x, framebufferSize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+            glGenTextures(1, &densityTexture);
+            glBindTexture(GL_TEXTURE_2D, densityTexture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, framebufferSize.x, framebufferSize.y, 0, GL_RED, GL_FLOAT, nullptr);
+            densityGrid.Resize((int)framebufferSize.x, (int)framebufferSize.y);
+
+            glGenTextures(1, &depthTexture);
+            glBindTexture(GL_TEXTURE_2D, depthTexture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, framebufferSize.x, framebufferSize.y, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+
+            glGenFramebuffers(1, &framebuffer);
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+            GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+
+            //Restore framebuffer state
+            glBindFramebuffer(GL_FRAMEBUFFER, prevFramebuffer);
+            glBindTexture(GL_TEXTURE_2D, prevTexture);
+
+            if (status != GL_FRAMEBUFFER_COMPLETE)
+            {
+                fprintf(stderr, "Failed to create framebuffer!");
+                return false;
+            }
 
-        framebufferSize = fbSize;
+            glGenQueries(2, progressive.timerQueries);
+            inUse = true;
+            return true;
+        }
 
-        //Backup framebuffer state.
-        GLuint prevTexture;
-        glGetIntegerv(GL_TEXTURE_BINDING_2D, (GLint*)&prevTexture);
-        GLuint prevRenderbuffer;
-        glGetIntegerv(GL_RENDERBUFFER_BINDING, (GLint*)&prevRenderbuffer);
-        GLuint prevFramebuffer;
-        glGetIntegerv(GL_FRAMEBUFFER_BINDING, (GLint*)&prevFramebuffer);
-
-        // Generate framebuffers and textures necessary.
-        glGenTextures(1, &colorTexture);
-        glBindTexture(GL_TEXTURE_2D, colorTexture);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, framebufferSize.x, framebufferSize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
-
-        glGenRenderbuffers(1, &depthbuffer);
-        glBindRenderbuffer(GL_RENDERBUFFER, depthbuffer);
-        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, framebufferSize.x, framebufferSize.y);
-
-        glGenFramebuffers(1, &framebuffer);
-        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
-        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthbuffer);
-        GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-        if (status != GL_FRAMEBUFFER_COMPLETE)
-        {
-            fprintf(stderr, "Failed to create framebuffer!");
-            return false;
+        void Release()
+        {
+            glDeleteFramebuffers(1, &framebuffer);
+            GLuint textures[3] = { colorTexture, depthTexture, densityTexture };
+            glDeleteTextures(3, textures);
+            ReleaseHiZ();
+            GLuint pointBuffers[2] = { pointDepthBuffer, pointColorBuffer };
+            glDeleteBuffers(2, pointBuffers);
+            glDeleteQueries(2, progressive.timerQueries);
+            *this = Viewport{};
         }
 
-        //Restore framebuffer state
-        glBindFramebuffer(GL_FRAMEBUFFER, prevFramebuffer);
-        glBindRenderbuffer(GL_RENDERBUFFER, prevRenderbuffer);
-        glBindTexture(GL_TEXTURE_2D, prevTexture);
+        void ReleaseHiZ()
+        {
+            if (hiZFence != nullptr)
+            {
+                glDeleteSync(hiZFence);
+                hiZFence = nullptr;
+            }
+            glDeleteFramebuffers(1, &hiZFramebuffer);
+            glDeleteTextures(1, &hiZTexture);
+            glDeleteBuffers(1, &hiZPixelBuffer);
+            hiZFramebuffer = hiZTexture = hiZPixelBuffer = 0;
+            hiZ.Clear();
+        }
 
-        glGenBuffers(1, &vertexArray);
-        glGenBuffers(1, &elementsArray);
+        // Builds the pyramid from the readback in flight if it has arrived. Never waits for it.
+        void PollHiZ()
+        {
+            if (hiZFence == nullptr || glClientWaitSync(hiZFence, 0, 0) == GL_TIMEOUT_EXPIRED)
+            {
+                return;
+            }
+            glDeleteSync(hiZFence);
+            hiZFence = nullptr;
 
-        return true;
-    }
-};
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, hiZPixelBuffer);
+            const void* depths = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (size_t)hiZWidth * hiZHeight * sizeof(float), GL_MAP_READ_BIT);
+            if (depths != nullptr)
+            {
+                hiZ.Build((const float*)depths, hiZWidth, hiZHeight, hiZBlockSize, (int)framebufferSize.x, (int)framebufferSize.y, hiZClipFromWorld);
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+
+        // Reduces the depth buffer just drawn and starts reading it back, unless a readback is still in flight.
+        void StartHiZReadback(const float clipFromWorld[16])
+        {
+            if (hiZFence != nullptr)
+            {
+                return;
+            }
+
+            if (hiZTexture == 0)
+            {
+                // The smallest power of two block which brings the depth buffer down to the readback size.
+                hiZBlockSize = 1;
+                while ((int)framebufferSize.x > hiZBlockSize * HiZMaxReadbackSize || (int)framebufferSize.y > hiZBlockSize * HiZMaxReadbackSize)
+                {
+                    hiZBlockSize *= 2;
+                }
+                hiZWidth = ((int)framebufferSize.x + hiZBlockSize - 1) / hiZBlockSize;
+                hiZHeight = ((int)framebufferSize.y + hiZBlockSize - 1) / hiZBlockSize;
+
+                glGenTextures(1, &hiZTexture);
+                glBindTexture(GL_TEXTURE_2D, hiZTexture);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, hiZWidth, hiZHeight, 0, GL_RED, GL_FLOAT, nullptr);
+
+                glGenFramebuffers(1, &hiZFramebuffer);
+                glBindFramebuffer(GL_FRAMEBUFFER, hiZFramebuffer);
+                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, hiZTexture, 0);
+
+                glGenBuffers(1, &hiZPixelBuffer);
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, hiZPixelBuffer);
+                glBufferData(GL_PIXEL_PACK_BUFFER, (size_t)hiZWidth * hiZHeight * sizeof(float), nullptr, GL_STREAM_READ);
+            }
+
+            glBindFramebuffer(GL_FRAMEBUFFER, hiZFramebuffer);
+            glViewport(0, 0, hiZWidth, hiZHeight);
+            glDisable(GL_DEPTH_TEST);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, depthTexture);
+            glUseProgram(hiZShaderHandle);
+            glUniform1i(uniformLocationHiZDepth, 0);
+            glUniform1i(uniformLocationHiZBlockSize, hiZBlockSize);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, hiZPixelBuffer);
+            glReadPixels(0, 0, hiZWidth, hiZHeight, GL_RED, GL_FLOAT, nullptr);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            hiZFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            memcpy(hiZClipFromWorld, clipFromWorld, sizeof(hiZClipFromWorld));
+
+            glEnable(GL_DEPTH_TEST);
+        }
+
+        // Clears the compute point rasterizer's depths and colors, and binds them.
+        void BeginPointRaster()
+        {
+            const size_t numPixels = (size_t)framebufferSize.x * (size_t)framebufferSize.y;
+            if (pointDepthBuffer == 0)
+            {
+                glGenBuffers(1, &pointDepthBuffer);
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, pointDepthBuffer);
+                glBufferData(GL_SHADER_STORAGE_BUFFER, numPixels * sizeof(uint32_t), nullptr, GL_DYNAMIC_COPY);
+                glGenBuffers(1, &pointColorBuffer);
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, pointColorBuffer);
+                glBufferData(GL_SHADER_STORAGE_BUFFER, numPixels * 4 * sizeof(uint32_t), nullptr, GL_DYNAMIC_COPY);
+            }
+
+            const uint32_t farthest = UINT32_MAX;
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, pointDepthBuffer);
+            glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &farthest);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, pointColorBuffer);
+            glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PointRasterDepthsBinding, pointDepthBuffer);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PointRasterColorsBinding, pointColorBuffer);
+        }
+
+        void ComputeCameraMatrices(float cameraFromWorld[16], float clipFromCamera[16]) const
+        {
+            FillTransformMatrix(cameraPosition, cameraUp, cameraTarget, cameraFromWorld);
+
+            float tanHalfFov = tanf(0.5f * 3.141592f / 180.f * horizontalFovDegrees);
+            float heightByWidth = framebufferSize.y / framebufferSize.x;
+            if (projection == CameraProjection::Orthographic)
+            {
+                // Frames what the perspective camera would see at the target's distance.
+                float right = tanHalfFov * Length(cameraPosition - cameraTarget);
+                FillOrthographicMatrix(nearPlane, farPlane, right, right * heightByWidth, clipFromCamera);
+            }
+            else
+            {
+                float right = tanHalfFov * nearPlane;
+                FillProjectionMatrix(nearPlane, farPlane, right, right * heightByWidth, clipFromCamera);
+            }
+        }
+
+        // Pixels per world unit across a sphere as it would be drawn now, taken at its nearest point to the camera.
+        float GetPixelsPerUnit(const Vec3& center, float radius) const
+        {
+            float tanHalfFov = tanf(0.5f * 3.141592f / 180.f * horizontalFovDegrees);
+            float halfWidthPixels = 0.5f * framebufferSize.x;
+            if (projection == CameraProjection::Orthographic)
+            {
+                return halfWidthPixels / (tanHalfFov * Length(cameraPosition - cameraTarget));
+            }
+            float distance = std::max(Length(center - cameraPosition) - radius, nearPlane);
+            return halfWidthPixels / (tanHalfFov * distance);
+        }
+
+        bool CameraChangedSince(const ProgressiveState& p) const
+        {
+            return memcmp(&p.cameraPosition, &cameraPosition, sizeof(Vec3)) != 0
+                || memcmp(&p.cameraTarget, &cameraTarget, sizeof(Vec3)) != 0
+                || memcmp(&p.cameraUp, &cameraUp, sizeof(Vec3)) != 0
+                || p.nearPlane != nearPlane
+                || p.farPlane != farPlane
+                || p.horizontalFovDegrees != horizontalFovDegrees
+                || p.projection != projection;
+        }
+    };
+}
+
+
+struct View3d::Impl
+{
+    ImVec4 backgroundColor{ 0,0,0,0 };
+
+    // Recorded each frame, into storage kept across frames. See SetRecordingMemoryLimits().
+    FrameArena<DrawVert> vertexBuffer;
+    FrameArena<unsigned int> indexBuffer;
+    FrameArena<DrawCmd> drawCommands;
+    // Vertices drawn with a VertexLayout, as given. Each draw starts at a multiple of its vertex size.
+    FrameArena<uint8_t> typedVertexData;
+    // Built on first use of each layout. Kept per view, as GL objects can't be assumed to be shared between contexts.
+    std::unordered_map<const VertexFormat*, LayoutState> layouts;
+
+    GLuint vertexArray;
+    GLuint typedVertexArray;
+    GLuint elementsArray;
+    GLuint vertexArrayObject;
+
+    std::vector<RetainedBuffer> retainedBuffers; // Indexed by handle - 1.
+    // Scratch for FlushRetainedBuffers().
+    std::vector<uint32_t> flushOrder;
+    std::vector<uint8_t> flushBlock;
+
+    std::vector<Viewport> viewports; // Indexed by ViewportId. The first is the view's own and always exists.
+    // Scene signature of the geometry in vertexArray, see UploadRecordedGeometry().
+    uint64_t uploadedSignature{ 0 };
+
+    DensityScale densityScale{ DensityScale::Log };
+    std::vector<float> densityIntensities;
+    GLuint emptyVertexArrayObject;
+
+    LabelBatch labels;
+    float labelDeclutterCellSize{ 0.f };
+
+    bool occlusionCulling{ false };
+
+    PointRendering pointRendering{ PointRendering::Raster };
+    float pointSize{ 5.f }; // In pixels, for PointRendering::Raster.
+    std::vector<const DrawCmd*> computePointCommands; // Scratch for RasterizePoints(), within a viewport.
+
+    float tessellationTolerance{ 0.5f }; // In pixels.
+    std::vector<int> curveSegments; // Scratch for DrawCurve().
+
+    // Applied as uniforms, so changing them doesn't touch the vertex data.
+    Colormap colormap{ Colormap::Viridis };
+    float colormapMin{ 0.f };
+    float colormapMax{ 1.f };
+    GLuint customColormapTexture{ 0 };
+    int customColormapSize{ 0 };
+    uint32_t customColormapVersion{ 0 };
+
+    // Of the viewport being rendered, for programs other than the shared one.
+    float cameraFromWorld[16];
+    float clipFromCamera[16];
+
+    float cameraRotateSpeed = 2.f;
+    float cameraZoomSpeed = 5.f;
+
+    ~Impl()
+    {
+        for (auto& entry : layouts)
+        {
+            glDeleteProgram(entry.second.program);
+            glDeleteVertexArrays(1, &entry.second.vertexArrayObject);
+        }
+    }
+
+    bool Initialize(const ImVec2& fbSize)
+    {
+        InitializeShaders();//TODO: Make this only happen on creation of the first 3d view.
+        InitializeDensityShader();
+        InitializeHiZShader();
+        InitializeColormaps();
+
+        viewports.emplace_back();
+        if (!viewports[0].Initialize(fbSize))
+        {
+            return false;
+        }
+
+        glGenBuffers(1, &vertexArray);
+        glGenBuffers(1, &elementsArray);
+        glGenBuffers(1, &typedVertexArray);
+        glGenVertexArrays(1, &vertexArrayObject);
+        glGenVertexArrays(1, &emptyVertexArrayObject);
+
+        return true;
+    }
+
+    Viewport* GetViewport(uint32_t id)
+    {
+        if (id >= viewports.size() || !viewports[id].inUse)
+        {
+            return nullptr;
+        }
+        return &viewports[id];
+    }
+
+    // Curved primitives are split for whichever viewport shows them largest, so they look smooth in all of them.
+    float GetPixelsPerUnit(const Vec3& center, float radius) const
+    {
+        float pixelsPerUnit = 0.f;
+        for (const Viewport& viewport : viewports)
+        {
+            if (viewport.inUse)
+            {
+                pixelsPerUnit = std::max(pixelsPerUnit, viewport.GetPixelsPerUnit(center, radius));
+            }
+        }
+        return pixelsPerUnit;
+    }
+
+    void PushLineStrip(size_t firstVertex, size_t numVertices)
+    {
+        DrawCmd cmd;
+        cmd.type = DrawType::LineList;
+        cmd.isDeferredDraw = false;
+        cmd.count = (unsigned int)numVertices;
+        cmd.offset = (unsigned int)firstVertex;
+        drawCommands.PushBack(cmd);
+    }
+
+    // Records an arc from center + u, turning towards center + v. u and v are perpendicular and as long as the radius.
+    void RecordArc(const Vec3& center, const Vec3& u, const Vec3& v, float angle, const Vec3& color)
+    {
+        const float radius = Length(u);
+        const int fullCircle = GetCircleSegments(radius * GetPixelsPerUnit(center, radius), tessellationTolerance);
+        const int numSegments = std::max((int)ceilf(fullCircle * fabsf(angle) / (2.f * IM_PI)), 1);
+        const size_t numPoints = numSegments + 1;
+        const size_t start = vertexBuffer.Grow(numPoints);
+        const float step = angle / numSegments;
+        vertexBuffer.ForEachSpan(start, numPoints, [&](DrawVert* verts, size_t first, size_t count) {
+            for (size_t i = 0; i < count; ++i)
+            {
+                const float theta = step * (float)(first - start + i);
+                verts[i].pos = center + cosf(theta) * u + sinf(theta) * v;
+                verts[i].col = color;
+            }
+        });
+        PushLineStrip(start, numPoints);
+    }
+
+    int GetBezierSpanSegments(const Vec3& p0, const Vec3& p1, const Vec3& p2, const Vec3& p3) const
+    {
+        // The curve stays within the hull of its control points, so within this sphere too.
+        const Vec3 center = 0.25f * (p0 + p1 + p2 + p3);
+        const float radius = std::max(std::max(Length(p0 - center), Length(p1 - center)), std::max(Length(p2 - center), Length(p3 - center)));
+        return GetBezierSegments(p0, p1, p2, p3, GetPixelsPerUnit(center, radius), tessellationTolerance);
+    }
+
+    // Writes the points ending each of a cubic Bezier curve's segments from vertex first on. The point it starts at, p0, is left to the caller.
+    void WriteBezierPoints(const Vec3& p0, const Vec3& p1, const Vec3& p2, const Vec3& p3, int numSegments, size_t first, const Vec3& color)
+    {
+        for (int i = 1; i <= numSegments; ++i)
+        {
+            const float t = (float)i / numSegments;
+            const float s = 1.f - t;
+            DrawVert& vert = vertexBuffer[first + i - 1];
+            vert.pos = (s * s * s) * p0 + (3.f * s * s * t) * p1 + (3.f * s * t * t) * p2 + (t * t * t) * p3;
+            vert.col = color;
+        }
+    }
+
+    // A latitude-longitude sphere, with as many segments around as a circle of its radius would get.
+    void RecordSphere(const Vec3& center, float radius, const Vec3& color)
+    {
+        const int numSegments = GetCircleSegments(radius * GetPixelsPerUnit(center, radius), tessellationTolerance);
+        const int numRings = std::max(numSegments / 2, 2);
+        const size_t ringSize = numSegments + 1; // The vertices on the seam are repeated.
+        const size_t firstVertex = vertexBuffer.Grow((numRings + 1) * ringSize);
+        for (int ring = 0; ring <= numRings; ++ring)
+        {
+            const float phi = IM_PI * ring / numRings;
+            const float ringRadius = radius * sinf(phi);
+            const float z = radius * cosf(phi);
+            for (int segment = 0; segment <= numSegments; ++segment)
+            {
+                const float theta = 2.f * IM_PI * segment / numSegments;
+                DrawVert& vert = vertexBuffer[firstVertex + ring * ringSize + segment];
+                vert.pos = center + Vec3{ ringRadius * cosf(theta), ringRadius * sinf(theta), z };
+                vert.col = color;
+            }
+        }
+
+        const size_t numIndices = (size_t)numRings * numSegments * 6;
+        const size_t firstIndex = indexBuffer.Grow(numIndices);
+        size_t index = firstIndex;
+        for (int ring = 0; ring < numRings; ++ring)
+        {
+            for (int segment = 0; segment < numSegments; ++segment)
+            {
+                const unsigned int a = (unsigned int)(firstVertex + ring * ringSize + segment);
+                const unsigned int b = a + (unsigned int)ringSize;
+                // Wound so the outside faces the camera, given how the camera matrices map it to the screen.
+                const unsigned int quad[6] = { a, a + 1, b, a + 1, b + 1, b };
+                for (unsigned int vertex : quad)
+                {
+                    indexBuffer[index++] = vertex;
+                }
+            }
+        }
+
+        DrawCmd cmd;
+        cmd.type = DrawType::Triangles;
+        cmd.isDeferredDraw = false;
+        cmd.count = (unsigned int)numIndices;
+        cmd.offset = (unsigned int)firstIndex;
+        drawCommands.PushBack(cmd);
+    }
+
+    // Attribute pointers are captured from the bound buffer, so they have to be respecified whenever it changes.
+    // A stride greater than one reads every n-th vertex, starting at firstVertex.
+    void BindVertexBuffer(GLuint vertices, GLuint elements, size_t firstVertex = 0, unsigned int stride = 1)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, vertices);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elements);
+        const size_t base = firstVertex * sizeof(DrawVert);
+        glEnableVertexAttribArray(attribLocationVtxPos);
+        glEnableVertexAttribArray(attribLocationVtxCol);
+        glVertexAttribPointer(attribLocationVtxPos, 3, GL_FLOAT, GL_FALSE, stride * sizeof(DrawVert), (GLvoid*)(base + IM_OFFSETOF(DrawVert, pos)));
+        glVertexAttribPointer(attribLocationVtxCol, 3, GL_FLOAT, GL_FALSE, stride * sizeof(DrawVert), (GLvoid*)(base + IM_OFFSETOF(DrawVert, col)));
+        glEnableVertexAttribArray(attribLocationVtxScalar);
+        glVertexAttribPointer(attribLocationVtxScalar, 1, GL_FLOAT, GL_FALSE, stride * sizeof(DrawVert), (GLvoid*)(base + IM_OFFSETOF(DrawVert, col)));
+    }
+
+    void BindRetainedBuffer(const RetainedBuffer& buffer, size_t firstVertex = 0, unsigned int stride = 1)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer.positions);
+        glEnableVertexAttribArray(attribLocationVtxPos);
+        glVertexAttribPointer(attribLocationVtxPos, 3, GL_FLOAT, GL_FALSE, stride * sizeof(Vec3), (GLvoid*)(firstVertex * sizeof(Vec3)));
+        if (buffer.colors != 0)
+        {
+            glEnableVertexAttribArray(attribLocationVtxCol);
+            glBindBuffer(GL_ARRAY_BUFFER, buffer.colors);
+            glVertexAttribPointer(attribLocationVtxCol, 3, GL_FLOAT, GL_FALSE, stride * sizeof(Vec3), (GLvoid*)(firstVertex * sizeof(Vec3)));
+        }
+        else
+        {
+            glDisableVertexAttribArray(attribLocationVtxCol);
+            glVertexAttrib3f(attribLocationVtxCol, DefaultColor.x, DefaultColor.y, DefaultColor.z);
+        }
+        if (buffer.scalars != 0)
+        {
+            glEnableVertexAttribArray(attribLocationVtxScalar);
+            glBindBuffer(GL_ARRAY_BUFFER, buffer.scalars);
+            glVertexAttribPointer(attribLocationVtxScalar, 1, GL_FLOAT, GL_FALSE, stride * sizeof(float), (GLvoid*)(firstVertex * sizeof(float)));
+        }
+        else
+        {
+            glDisableVertexAttribArray(attribLocationVtxScalar);
+            glVertexAttrib1f(attribLocationVtxScalar, 0.f);
+        }
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer.elements);
+    }
+
+    RetainedBuffer* GetRetainedBuffer(uint32_t handle)
+    {
+        if (handle == 0 || handle > retainedBuffers.size() || !retainedBuffers[handle - 1].inUse)
+        {
+            return nullptr;
+        }
+        return &retainedBuffers[handle - 1];
+    }
+
+    // Binds whichever buffers the command draws from. Returns false if its retained buffer no longer exists.
+    bool BindCommandBuffers(const DrawCmd& cmd, size_t firstVertex = 0, unsigned int stride = 1)
+    {
+        //PERF: Avoid binding when unnecessary
+        if (cmd.isDeferredDraw)
+        {
+            RetainedBuffer* buffer = GetRetainedBuffer(cmd.buffer);
+            if (buffer == nullptr)
+            {
+                return false;
+            }
+            BindRetainedBuffer(*buffer, firstVertex, stride);
+            glUniform1i(uniformLocationUseColormap, buffer->scalars != 0);
+        }
+        else
+        {
+            BindVertexBuffer(vertexArray, elementsArray, firstVertex, stride);
+            glUniform1i(uniformLocationUseColormap, cmd.isColormapped);
+        }
+        return true;
+    }
+
+    const LayoutState& GetLayoutState(const VertexFormat& format)
+    {
+        auto it = layouts.find(&format);
+        if (it == layouts.end())
+        {
+            LayoutState layout{};
+            InitializeLayoutProgram(format, layout);
+            InitializeLayoutVertexArray(format, typedVertexArray, layout);
+            it = layouts.emplace(&format, layout).first;
+        }
+        return it->second;
+    }
+
+    // Typed vertices are drawn by their layout's own program, which gets the camera of the viewport being rendered.
+    void DrawTypedCommand(const DrawCmd& cmd, size_t first, size_t count)
+    {
+        const LayoutState& layout = GetLayoutState(*cmd.format);
+        glUseProgram(layout.program);
+        glUniformMatrix4fv(layout.uniformLocationCamFromWorld, 1, GL_FALSE, cameraFromWorld);
+        glUniformMatrix4fv(layout.uniformLocationClipFromCamera, 1, GL_FALSE, clipFromCamera);
+
+        glBindVertexArray(layout.vertexArrayObject);
+        bool hasIndices;
+        glDrawArrays(GetDrawMode(cmd.type, hasIndices), (GLint)(cmd.offset + first), (GLsizei)count);
+        glBindVertexArray(vertexArrayObject);
+
+        glUseProgram(shaderHandle);
+    }
+
+    // Draws count vertices (or indices) of the command, starting at first.
+    void DrawCommand(const DrawCmd& cmd, size_t first, size_t count)
+    {
+        if (cmd.format != nullptr)
+        {
+            DrawTypedCommand(cmd, first, count);
+            return;
+        }
+        if (!BindCommandBuffers(cmd))
+        {
+            return;
+        }
+
+        bool hasIndices;
+        GLenum drawMode = GetDrawMode(cmd.type, hasIndices);
+        if (hasIndices)
+        {
+            glDrawElements(drawMode, (GLsizei)count, GL_UNSIGNED_INT, (GLvoid*)((cmd.offset + first) * sizeof(unsigned int)));
+        }
+        else
+        {
+            glDrawArrays(drawMode, (GLint)(cmd.offset + first), (GLsizei)count);
+        }
+    }
+
+    // Shades the viewport's binned point densities over its whole framebuffer, underneath the geometry.
+    void DrawDensityLayer(Viewport& viewport)
+    {
+        if (!viewport.hasDensity)
+        {
+            return;
+        }
+
+        const PointDensityGrid& densityGrid = viewport.densityGrid;
+        densityIntensities.resize((size_t)densityGrid.GetWidth() * densityGrid.GetHeight());
+        densityGrid.Shade(densityScale, densityIntensities.data());
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, viewport.densityTexture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, densityGrid.GetWidth(), densityGrid.GetHeight(), GL_RED, GL_FLOAT, densityIntensities.data());
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, colormapTextures[(int)Colormap::Viridis]);
+        glActiveTexture(GL_TEXTURE0);
+
+        glUseProgram(densityShaderHandle);
+        glUniform1i(uniformLocationDensity, 0);
+        glUniform1i(uniformLocationDensityColormap, 1);
+        glUniform1f(uniformLocationDensityColormapSize, (float)BuiltinColormapSize);
+
+        glDisable(GL_DEPTH_TEST);
+        glBindVertexArray(emptyVertexArrayObject);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        glBindVertexArray(vertexArrayObject);
+        glEnable(GL_DEPTH_TEST);
+        glUseProgram(shaderHandle);
+    }
+
+    // Binds the range of buffer holding count elements of components floats, stride floats apart from float first on.
+    // Bindings have to start at an aligned offset, so returns where the first element is within the range.
+    static GLuint BindPointRange(GLuint binding, GLuint buffer, size_t first, size_t count, GLuint stride, GLuint components)
+    {
+        const size_t start = first * sizeof(float);
+        const size_t alignedStart = start - start % (size_t)pointRasterOffsetAlignment;
+        const size_t size = start - alignedStart + ((count - 1) * stride + components) * sizeof(float);
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, buffer, (GLintptr)alignedStart, (GLsizeiptr)size);
+        return (GLuint)((start - alignedStart) / sizeof(float));
+    }
+
+    // Runs a pass of the compute point rasterizer over a command's points, in as many dispatches as the limits call for.
+    void DispatchPoints(const PointRasterProgram& program, const DrawCmd& cmd, bool colorPass)
+    {
+        // Immediate points are read from the DrawVerts, whose color holds the scalar when colormapped.
+        constexpr GLuint floatsPerVertex = sizeof(DrawVert) / sizeof(float);
+        GLuint positions = vertexArray;
+        GLuint positionStride = floatsPerVertex;
+        GLuint attributes = vertexArray;
+        GLuint attributeStride = floatsPerVertex;
+        size_t attributeOffset = IM_OFFSETOF(DrawVert, col) / sizeof(float);
+        PointRasterColorSource colorSource = cmd.isColormapped ? PointRasterColorSource::Colormap : PointRasterColorSource::Colors;
+        size_t first = cmd.offset;
+        if (cmd.isDeferredDraw)
+        {
+            const RetainedBuffer* buffer = GetRetainedBuffer(cmd.buffer);
+            if (buffer == nullptr)
+            {
+                return;
+            }
+            positions = buffer->positions;
+            positionStride = 3;
+            attributeOffset = 0;
+            first = 0;
+            if (buffer->scalars != 0)
+            {
+                attributes = buffer->scalars;
+                attributeStride = 1;
+                colorSource = PointRasterColorSource::Colormap;
+            }
+            else if (buffer->colors != 0)
+            {
+                attributes = buffer->colors;
+                attributeStride = 3;
+                colorSource = PointRasterColorSource::Colors;
+            }
+            else
+            {
+                attributes = 0;
+                colorSource = PointRasterColorSource::Constant;
+            }
+        }
+        const GLuint attributeComponents = colorSource == PointRasterColorSource::Colormap ? 1 : 3;
+
+        if (colorPass)
+        {
+            glUniform1i(uniformLocationPointColorSource, (GLint)colorSource);
+            glUniform3f(uniformLocationPointColor, DefaultColor.x, DefaultColor.y, DefaultColor.z);
+            glUniform1ui(uniformLocationPointAttributeStride, attributeStride);
+        }
+        glUniform1ui(program.uniformLocationPositionStride, positionStride);
+
+        // Each dispatch stays within the group count and binding size every implementation supports.
+        const size_t bytesPerPoint = std::max(positionStride, attributeStride) * sizeof(float);
+        const size_t maxBindingPoints = (size_t)(pointRasterMaxBlockSize - pointRasterOffsetAlignment) / bytesPerPoint;
+        const size_t maxPoints = std::min((size_t)PointRasterGroupSize * PointRasterMaxGroups, maxBindingPoints - maxBindingPoints % PointRasterGroupSize);
+        for (size_t done = 0; done < cmd.count; done += maxPoints)
+        {
+            const size_t count = std::min(cmd.count - done, maxPoints);
+            const size_t index = first + done;
+            glUniform1ui(program.uniformLocationCount, (GLuint)count);
+            glUniform1ui(program.uniformLocationPositionBase, BindPointRange(PointRasterPositionsBinding, positions, index * positionStride, count, positionStride, 3));
+            if (colorPass && attributes != 0)
+            {
+                glUniform1ui(uniformLocationPointAttributeBase, BindPointRange(PointRasterAttributesBinding, attributes, index * attributeStride + attributeOffset, count, attributeStride, attributeComponents));
+            }
+            else if (colorPass)
+            {
+                // Not read, but something has to be bound.
+                BindPointRange(PointRasterAttributesBinding, positions, index * positionStride, count, positionStride, 3);
+            }
+            glDispatchCompute((GLuint)((count + PointRasterGroupSize - 1) / PointRasterGroupSize), 1, 1);
+        }
+    }
+
+    // Draws the points set aside in computePointCommands over what's already in the viewport's framebuffer.
+    void RasterizePoints(Viewport& viewport, const float clipFromWorld[16])
+    {
+        if (computePointCommands.empty())
+        {
+            return;
+        }
+        viewport.BeginPointRaster();
+
+        auto runPass = [&](const PointRasterProgram& program, bool colorPass) {
+            glUseProgram(program.handle);
+            glUniformMatrix4fv(program.uniformLocationClipFromWorld, 1, GL_FALSE, clipFromWorld);
+            glUniform2i(program.uniformLocationFramebufferSize, (GLint)viewport.framebufferSize.x, (GLint)viewport.framebufferSize.y);
+            if (colorPass)
+            {
+                glUniform1i(uniformLocationPointColormap, ColormapTextureUnit);
+                BindColormap(uniformLocationPointColormapSize, uniformLocationPointColormapRange);
+            }
+            for (const DrawCmd* cmd : computePointCommands)
+            {
+                DispatchPoints(program, *cmd, colorPass);
+            }
+            // The color pass reads the depths, and the resolve both.
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        };
+        runPass(pointDepthProgram, false);
+        runPass(pointColorProgram, true);
+
+        glUseProgram(pointResolveShaderHandle);
+        glUniform1i(uniformLocationPointResolveWidth, (GLint)viewport.framebufferSize.x);
+        glBindVertexArray(emptyVertexArrayObject);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        glBindVertexArray(vertexArrayObject);
+        glUseProgram(shaderHandle);
+        computePointCommands.clear();
+    }
+
+    // Uploads the retained buffers' appends and updates since the last frame.
+    void FlushRetainedBuffers()
+    {
+        for (RetainedBuffer& buffer : retainedBuffers)
+        {
+            if (!buffer.inUse)
+            {
+                continue;
+            }
+            if (!buffer.positionWrites.writes.empty() || !buffer.colorWrites.writes.empty()
+                || !buffer.scalarWrites.writes.empty() || !buffer.elementWrites.writes.empty())
+            {
+                buffer.version++;
+            }
+            buffer.positionWrites.Flush(buffer.positions, flushOrder, flushBlock);
+            buffer.colorWrites.Flush(buffer.colors, flushOrder, flushBlock);
+            buffer.scalarWrites.Flush(buffer.scalars, flushOrder, flushBlock);
+            buffer.elementWrites.Flush(buffer.elements, flushOrder, flushBlock);
+        }
+    }
+
+    // Allocates the bound buffer and fills it from the arena a chunk at a time.
+    template<typename T>
+    static void UploadArena(GLenum target, const FrameArena<T>& arena)
+    {
+        glBufferData(target, arena.Size() * sizeof(T), nullptr, GL_STREAM_DRAW);
+        arena.ForEachSpan(0, arena.Size(), [target](const T* data, size_t first, size_t count) {
+            glBufferSubData(target, first * sizeof(T), count * sizeof(T), data);
+        });
+    }
+
+    void UploadRecordedGeometry()
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, vertexArray);
+        UploadArena(GL_ARRAY_BUFFER, vertexBuffer);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementsArray);
+        UploadArena(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+
+        if (!typedVertexData.Empty())
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, typedVertexArray);
+            UploadArena(GL_ARRAY_BUFFER, typedVertexData);
+        }
+    }
+
+    // Hashes the command list and everything recorded, so any edit restarts the accumulation. Retained buffers
+    // are only hashed by version, which every change to them bumps.
+    uint64_t ComputeSceneSignature() const
+    {
+        uint64_t hash = HashBytes(&backgroundColor, sizeof(backgroundColor));
+        hash = HashBytes(&pointSize, sizeof(pointSize), hash);
+        for (const DrawCmd& cmd : drawCommands)
+        {
+            hash = HashBytes(&cmd.type, sizeof(cmd.type), hash);
+            hash = HashBytes(&cmd.offset, sizeof(cmd.offset), hash);
+            hash = HashBytes(&cmd.count, sizeof(cmd.count), hash);
+            hash = HashBytes(&cmd.isColormapped, sizeof(cmd.isColormapped), hash);
+            hash = HashBytes(&cmd.format, sizeof(cmd.format), hash);
+            if (cmd.isDeferredDraw)
+            {
+                hash = HashBytes(&cmd.buffer, sizeof(cmd.buffer), hash);
+                if (cmd.buffer > 0 && cmd.buffer <= retainedBuffers.size())
+                {
+                    hash = HashBytes(&retainedBuffers[cmd.buffer - 1].version, sizeof(uint32_t), hash);
+                }
+            }
+        }
+
+        const size_t numVertices = vertexBuffer.Size();
+        hash = HashBytes(&numVertices, sizeof(numVertices), hash);
+        vertexBuffer.ForEachSpan(0, numVertices, [&hash](const DrawVert* vertices, size_t, size_t count) {
+            hash = HashWords(vertices, count * sizeof(DrawVert), hash);
+        });
+
+        const size_t numIndices = indexBuffer.Size();
+        hash = HashBytes(&numIndices, sizeof(numIndices), hash);
+        indexBuffer.ForEachSpan(0, numIndices, [&hash](const unsigned int* indices, size_t, size_t count) {
+            hash = HashWords(indices, count * sizeof(unsigned int), hash);
+        });
+
+        const size_t numTypedBytes = typedVertexData.Size();
+        hash = HashBytes(&numTypedBytes, sizeof(numTypedBytes), hash);
+        typedVertexData.ForEachSpan(0, numTypedBytes, [&hash](const uint8_t* bytes, size_t, size_t count) {
+            hash = HashWords(bytes, count, hash);
+        });
+        return hash;
+    }
+
+    void BindColormap()
+    {
+        BindColormap(uniformLocationColormapSize, uniformLocationColormapRange);
+    }
+
+    // Binds the colormap's texture and sets its size and range uniforms of the current program.
+    void BindColormap(GLint sizeLocation, GLint rangeLocation)
+    {
+        GLuint texture = colormapTextures[(int)Colormap::Viridis];
+        int size = BuiltinColormapSize;
+        if (colormap == Colormap::Custom)
+        {
+            if (customColormapTexture != 0)
+            {
+                texture = customColormapTexture;
+                size = customColormapSize;
+            }
+        }
+        else
+        {
+            texture = colormapTextures[(int)colormap];
+        }
+
+        glActiveTexture(GL_TEXTURE0 + ColormapTextureUnit);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glActiveTexture(GL_TEXTURE0);
+        glUniform1f(sizeLocation, (float)size);
+        // A zero width range maps everything to the low end rather than dividing by zero.
+        const float range = colormapMax - colormapMin;
+        glUniform2f(rangeLocation, colormapMin, range != 0.f ? 1.f / range : 0.f);
+    }
+
+    // Adds the colormap settings to a scene signature. They're only uniforms, but still change the image.
+    uint64_t HashColormap(uint64_t hash) const
+    {
+        hash = HashBytes(&colormap, sizeof(colormap), hash);
+        hash = HashBytes(&colormapMin, sizeof(colormapMin), hash);
+        hash = HashBytes(&colormapMax, sizeof(colormapMax), hash);
+        return HashBytes(&customColormapVersion, sizeof(customColormapVersion), hash);
+    }
+
+    // Adds the viewport's point densities to a scene signature.
+    uint64_t HashDensity(const Viewport& viewport, uint64_t hash) const
+    {
+        const PointDensityGrid& densityGrid = viewport.densityGrid;
+        const size_t pointsBinned = densityGrid.GetPointsBinned();
+        hash = HashBytes(&pointsBinned, sizeof(pointsBinned), hash);
+        if (pointsBinned > 0)
+        {
+            const uint32_t* counts = densityGrid.GetCounts();
+            const size_t numPixels = (size_t)densityGrid.GetWidth() * densityGrid.GetHeight();
+            hash = HashWords(counts, numPixels * sizeof(uint32_t), hash);
+        }
+        return hash;
+    }
+
+    void RestartProgressive(Viewport& viewport, uint64_t signature)
+    {
+        ProgressiveState& p = viewport.progressive;
+        p.restartRequested = false;
+        p.sceneSignature = signature;
+        p.cameraPosition = viewport.cameraPosition;
+        p.cameraTarget = viewport.cameraTarget;
+        p.cameraUp = viewport.cameraUp;
+        p.nearPlane = viewport.nearPlane;
+        p.farPlane = viewport.farPlane;
+        p.horizontalFovDegrees = viewport.horizontalFovDegrees;
+        p.projection = viewport.projection;
+
+        p.pass = ProgressivePass::Coarse;
+        p.commandIndex = 0;
+        p.vertexIndex = 0;
+        p.verticesDrawn = 0;
+        p.verticesTotal = 0;
+        for (const DrawCmd& cmd : drawCommands)
+        {
+            if (IsBuiltinPoints(cmd))
+            {
+                p.verticesTotal += (cmd.count + ProgressiveCoarseStride - 1) / ProgressiveCoarseStride + cmd.count;
+            }
+            else
+            {
+                p.verticesTotal += cmd.count;
+            }
+        }
+
+        glClearColor(backgroundColor.x, backgroundColor.y, backgroundColor.z, backgroundColor.w);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        DrawDensityLayer(viewport);
+    }
+
+    // Picks up finished timer queries without stalling, and folds them into the throughput estimate.
+    void ReadProgressiveTimers(ProgressiveState& p)
+    {
+        for (int i = 0; i < 2; ++i)
+        {
+            if (!p.queryPending[i])
+            {
+                continue;
+            }
+            GLint available = 0;
+            glGetQueryObjectiv(p.timerQueries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+            {
+                continue;
+            }
+            GLuint64 elapsedNs = 0;
+            glGetQueryObjectui64v(p.timerQueries[i], GL_QUERY_RESULT, &elapsedNs);
+            p.queryPending[i] = false;
+
+            float elapsedMs = elapsedNs * 1e-6f;
+            if (elapsedMs > 0.05f && p.queryVertices[i] > 0)
+            {
+                float measured = p.queryVertices[i] / elapsedMs;
+                p.verticesPerMs = 0.5f * p.verticesPerMs + 0.5f * measured;
+            }
+        }
+    }
+
+    // Only retained buffers are tested, since they're the only draws with bounds kept up to date.
+    bool IsOccluded(const Viewport& viewport, const DrawCmd& cmd)
+    {
+        if (!cmd.isDeferredDraw)
+        {
+            return false;
+        }
+        const RetainedBuffer* buffer = GetRetainedBuffer(cmd.buffer);
+        return buffer != nullptr && viewport.hiZ.IsOccluded(buffer->boundsMin, buffer->boundsMax);
+    }
+
+    // Points drawn with the built in shader, which progressive rendering spreads over the coarse and refine passes, and
+    // the compute rasterizer can draw. Typed vertices are drawn in full in the coarse pass.
+    static bool IsBuiltinPoints(const DrawCmd& cmd)
+    {
+        return cmd.type == DrawType::Points && cmd.format == nullptr;
+    }
+
+    // sceneSignature covers the recorded geometry, which has to be uploaded already.
+    void RenderProgressive(Viewport& viewport, uint64_t sceneSignature)
+    {
+        ProgressiveState& p = viewport.progressive;
+
+        uint64_t signature = HashColormap(HashDensity(viewport, sceneSignature));
+        if (p.restartRequested || signature != p.sceneSignature || viewport.CameraChangedSince(p))
+        {
+            RestartProgressive(viewport, signature);
+        }
+
+        ReadProgressiveTimers(p);
+        if (p.pass == ProgressivePass::Done)
+        {
+            return;
+        }
+
+        const size_t budget = std::max(ProgressiveMinVerticesPerFrame, (size_t)(p.budgetMs * p.verticesPerMs));
+
+        // If last frame's query on this slot hasn't come back yet, this frame just goes untimed.
+        const int query = p.currentQuery;
+        const bool timed = !p.queryPending[query];
+        if (timed)
+        {
+            glBeginQuery(GL_TIME_ELAPSED, p.timerQueries[query]);
+        }
+
+        size_t drawn = 0;
+        while (p.pass != ProgressivePass::Done && drawn < budget)
+        {
+            if (p.commandIndex >= drawCommands.Size())
+            {
+                p.pass = (p.pass == ProgressivePass::Coarse) ? ProgressivePass::Refine : ProgressivePass::Done;
+                p.commandIndex = 0;
+                p.vertexIndex = 0;
+                continue;
+            }
+
+            const DrawCmd& cmd = drawCommands[p.commandIndex];
+            if (p.pass == ProgressivePass::Coarse)
+            {
+                // Everything but points is cheap, so it is drawn in full up front.
+                if (IsBuiltinPoints(cmd))
+                {
+                    GLsizei count = (cmd.count + ProgressiveCoarseStride - 1) / ProgressiveCoarseStride;
+                    if (BindCommandBuffers(cmd, cmd.offset, ProgressiveCoarseStride))
+                    {
+                        glDrawArrays(GL_POINTS, 0, count);
+                    }
+                    drawn += count;
+                }
+                else
+                {
+                    DrawCommand(cmd, 0, cmd.count);
+                    drawn += cmd.count;
+                }
+                p.commandIndex++;
+            }
+            else
+            {
+                if (!IsBuiltinPoints(cmd))
+                {
+                    p.commandIndex++;
+                    continue;
+                }
+
+                size_t count = std::min(cmd.count - p.vertexIndex, budget - drawn);
+                DrawCommand(cmd, p.vertexIndex, count);
+                drawn += count;
+                p.vertexIndex += count;
+                if (p.vertexIndex >= cmd.count)
+                {
+                    p.commandIndex++;
+                    p.vertexIndex = 0;
+                }
+            }
+        }
+
+        if (timed)
+        {
+            glEndQuery(GL_TIME_ELAPSED);
+            p.queryVertices[query] = drawn;
+            p.queryPending[query] = true;
+            p.currentQuery = 1 - query;
+        }
+        p.verticesDrawn += drawn;
+    }
+};
 
 
 View3d::View3d(const ImVec2& framebufferSize) : impl(std::make_unique<View3d::Impl>())
@@ -371,28 +2176,102 @@ void View3d::SetBackgroundColor(float r, float g, float b, float a)
 
 void View3d::DrawPoints(const Vec3 * points, int numPoints)
 {
-    size_t startingIndex = impl->vertexBuffer.size();
-    impl->vertexBuffer.resize(startingIndex + numPoints);
+    size_t startingIndex = impl->vertexBuffer.Grow(numPoints);
+
+    DrawCmd cmd;
+    cmd.type = DrawType::Points;
+    cmd.isDeferredDraw = false;
+    cmd.count = numPoints;
+    cmd.offset = startingIndex;
+
+    impl->vertexBuffer.ForEachSpan(startingIndex, numPoints, [&](DrawVert* verts, size_t first, size_t count) {
+        const Vec3* source = points + (first - startingIndex);
+        for (size_t i = 0; i < count; ++i)
+        {
+            verts[i].pos = source[i];
+            verts[i].col = DefaultColor;
+        }
+    });
+
+    impl->drawCommands.PushBack(cmd);
+}
+
+void View3d::DrawPoints(const Vec3* points, const float* values, int numPoints)
+{
+    size_t startingIndex = impl->vertexBuffer.Grow(numPoints);
+
+    DrawCmd cmd;
+    cmd.type = DrawType::Points;
+    cmd.isDeferredDraw = false;
+    cmd.isColormapped = true;
+    cmd.count = numPoints;
+    cmd.offset = startingIndex;
+
+    impl->vertexBuffer.ForEachSpan(startingIndex, numPoints, [&](DrawVert* verts, size_t first, size_t count) {
+        const size_t offset = first - startingIndex;
+        for (size_t i = 0; i < count; ++i)
+        {
+            verts[i].pos = points[offset + i];
+            verts[i].col = Vec3{ values[offset + i], 0.f, 0.f };
+        }
+    });
+
+    impl->drawCommands.PushBack(cmd);
+}
+
+void View3d::DrawVertices(const VertexFormat& format, const void* vertices, size_t numVertices, PrimitiveType type)
+{
+    if (numVertices == 0)
+    {
+        return;
+    }
+    auto& data = impl->typedVertexData;
+    const size_t first = (data.Size() + format.stride - 1) / format.stride;
+    const size_t start = first * format.stride;
+    const size_t end = data.Size();
+    data.Grow(start + numVertices * format.stride - end);
+    // Cleared so the scene signature, which hashes every byte, doesn't see what was left there last frame.
+    data.ForEachSpan(end, start - end, [](uint8_t* out, size_t, size_t count) { memset(out, 0, count); });
+    data.ForEachSpan(start, numVertices * format.stride, [&](uint8_t* out, size_t index, size_t count) {
+        memcpy(out, (const uint8_t*)vertices + (index - start), count);
+    });
 
     DrawCmd cmd;
-    cmd.type = DrawType::Points;
+    cmd.type = (DrawType)type;
     cmd.isDeferredDraw = false;
-    cmd.count = numPoints;
-    cmd.offset = startingIndex;
+    cmd.format = &format;
+    cmd.count = (unsigned int)numVertices;
+    cmd.offset = (unsigned int)first;
+    impl->drawCommands.PushBack(cmd);
+}
+
+void View3d::SetColormap(Colormap colormap, float minValue, float maxValue)
+{
+    impl->colormap = colormap;
+    impl->colormapMin = minValue;
+    impl->colormapMax = maxValue;
+}
 
-    for (int i = 0; i < numPoints; ++i)
+void View3d::SetCustomColormap(const ImU32* colors, int numColors)
+{
+    if (impl->customColormapTexture != 0)
     {
-        impl->vertexBuffer[startingIndex + i].pos = points[i];
-        impl->vertexBuffer[startingIndex + i].col = DefaultColor;
+        glDeleteTextures(1, &impl->customColormapTexture);
+        impl->customColormapTexture = 0;
     }
-
-    impl->drawCommands.emplace_back(std::move(cmd));
+    impl->customColormapSize = numColors;
+    impl->customColormapVersion++;
+    if (numColors <= 0)
+    {
+        return;
+    }
+    // ImU32 is laid out as RGBA bytes in memory, the alpha goes unused.
+    impl->customColormapTexture = CreateColormapTexture(colors, numColors, GL_RGBA);
 }
 
 void View3d::DrawLine(const Vec3 start, const Vec3 end)
 {
-    size_t startingIndex = impl->vertexBuffer.size();
-    impl->vertexBuffer.resize(startingIndex + 2);
+    size_t startingIndex = impl->vertexBuffer.Grow(2);
     impl->vertexBuffer[startingIndex].pos = start;
     impl->vertexBuffer[startingIndex].col = DefaultColor;
     impl->vertexBuffer[startingIndex + 1].pos = end;
@@ -403,188 +2282,640 @@ void View3d::DrawLine(const Vec3 start, const Vec3 end)
     cmd.isDeferredDraw = false;
     cmd.count = 2;
     cmd.offset = startingIndex;
-    impl->drawCommands.emplace_back(std::move(cmd));
+    impl->drawCommands.PushBack(cmd);
 }
 
 void View3d::DrawViewBall()
 {
-    Vec3 center = Vec3{ 0,0,0 } -impl->cameraTarget;
+    const Viewport& viewport = impl->viewports[0];
+    Vec3 center = Vec3{ 0,0,0 } - viewport.cameraTarget;
     // Compute radius based on camera parameters - want a fixed size on screen.
-    // TODO: This needs to consider fov, etc.
+    float tanHalfFov = tanf(0.5f * 3.141592f / 180.f * viewport.horizontalFovDegrees);
+    float radius = ViewBallSize * tanHalfFov * Length(viewport.cameraPosition - viewport.cameraTarget);
+
+    // A circle around each axis, centered at the center.
+    impl->RecordArc(center, Vec3{ 0, 0, radius }, Vec3{ 0, radius, 0 }, 2.f * IM_PI, Vec3{ 1, 0, 0 });
+    impl->RecordArc(center, Vec3{ radius, 0, 0 }, Vec3{ 0, 0, radius }, 2.f * IM_PI, Vec3{ 0, 1, 0 });
+    impl->RecordArc(center, Vec3{ radius, 0, 0 }, Vec3{ 0, radius, 0 }, 2.f * IM_PI, Vec3{ 0, 0, 1 });
+}
+
+void View3d::DrawCircle(const Vec3& center, const Vec3& normal, float radius, const Vec3& color)
+{
+    Vec3 u, v;
+    GetPerpendicularAxes(normal, u, v);
+    impl->RecordArc(center, radius * u, radius * v, 2.f * IM_PI, color);
+}
+
+void View3d::DrawArc(const Vec3& center, const Vec3& normal, const Vec3& startOffset, float angle, const Vec3& color)
+{
+    const Vec3 n = Normalized(normal);
+    const Vec3 u = startOffset - Dot(startOffset, n) * n;
+    impl->RecordArc(center, u, Cross(n, u), angle, color);
+}
 
-    float radius = 0.1f * 10;
+void View3d::DrawBezier(const Vec3& p0, const Vec3& p1, const Vec3& p2, const Vec3& p3, const Vec3& color)
+{
+    const int numSegments = impl->GetBezierSpanSegments(p0, p1, p2, p3);
+    const size_t start = impl->vertexBuffer.Grow(numSegments + 1);
+    impl->vertexBuffer[start].pos = p0;
+    impl->vertexBuffer[start].col = color;
+    impl->WriteBezierPoints(p0, p1, p2, p3, numSegments, start + 1, color);
+    impl->PushLineStrip(start, numSegments + 1);
+}
 
-    // Want to draw a circle of lines around each axis, centered at the center.
-    int numSegmentsPerCircle = 32;
-    float angleStep = 2.0 * IM_PI / numSegmentsPerCircle;
-    int numPointsPerCircle = numSegmentsPerCircle + 1;
+void View3d::DrawCurve(const Vec3* points, size_t numPoints, const Vec3& color)
+{
+    if (numPoints < 2)
+    {
+        return;
+    }
 
-    auto& verts = impl->vertexBuffer;
-    size_t startingIndex = verts.size();
-    verts.resize(startingIndex + 3 * (numPointsPerCircle));
+    // Each span between two points is the Bezier curve with the Catmull-Rom tangents, the end points standing in for their missing neighbours.
+    auto getControlPoints = [&](size_t span, Vec3 p[4]) {
+        const Vec3& before = points[span > 0 ? span - 1 : 0];
+        const Vec3& after = points[std::min(span + 2, numPoints - 1)];
+        p[0] = points[span];
+        p[3] = points[span + 1];
+        p[1] = p[0] + (1.f / 6.f) * (p[3] - before);
+        p[2] = p[3] - (1.f / 6.f) * (after - p[0]);
+    };
 
-    for (int pointIndex = 0; pointIndex < numPointsPerCircle; ++pointIndex)
+    // All the segment counts are worked out first, so the whole strip is allocated at once.
+    auto& segments = impl->curveSegments;
+    segments.resize(numPoints - 1);
+    size_t numVertices = 1;
+    for (size_t span = 0; span + 1 < numPoints; ++span)
     {
-        float theta = angleStep * pointIndex;
-        auto& xPoint = verts[startingIndex + pointIndex];
-        xPoint.pos = center + Vec3{ 0,radius * sinf(theta),radius * cosf(theta) };
-        xPoint.col = Vec3{ 1,0,0 };
+        Vec3 p[4];
+        getControlPoints(span, p);
+        segments[span] = impl->GetBezierSpanSegments(p[0], p[1], p[2], p[3]);
+        numVertices += segments[span];
+    }
 
-        auto& yPoint = verts[startingIndex + pointIndex + numPointsPerCircle];
-        yPoint.pos = center + Vec3{ radius * cosf(theta), 0, radius * sinf(theta) };
-        yPoint.col = Vec3{ 0, 1,0 };
+    const size_t start = impl->vertexBuffer.Grow(numVertices);
+    impl->vertexBuffer[start].pos = points[0];
+    impl->vertexBuffer[start].col = color;
+    size_t next = start + 1;
+    for (size_t span = 0; span + 1 < numPoints; ++span)
+    {
+        Vec3 p[4];
+        getControlPoints(span, p);
+        impl->WriteBezierPoints(p[0], p[1], p[2], p[3], segments[span], next, color);
+        next += segments[span];
+    }
+    impl->PushLineStrip(start, numVertices);
+}
 
-        auto& zPoint = verts[startingIndex + pointIndex + 2 * numPointsPerCircle];
-        zPoint.pos = center + Vec3{ radius * cosf(theta), radius * sinf(theta), 0 };
-        zPoint.col = Vec3{ 0, 0, 1 };
+void View3d::DrawSphere(const Vec3& center, float radius, const Vec3& color)
+{
+    impl->RecordSphere(center, radius, color);
+}
 
+bool View3d::SetPointRendering(PointRendering rendering)
+{
+    if (rendering == PointRendering::Compute && !InitializePointRasterShaders())
+    {
+        return false;
     }
+    impl->pointRendering = rendering;
+    return true;
+}
+
+void View3d::SetPointSize(float pixels)
+{
+    impl->pointSize = std::max(pixels, 1.f);
+}
 
-    // This code is silly - should loop, or just use a line with indices...
+void View3d::SetTessellationTolerance(float pixels)
+{
+    impl->tessellationTolerance = std::max(pixels, MinTessellationTolerance);
+}
+
+View3d::BufferHandle View3d::CreateBuffer()
+{
+    auto& buffers = impl->retainedBuffers;
+    size_t index = 0;
+    while (index < buffers.size() && buffers[index].inUse)
     {
-        DrawCmd cmd;
-        cmd.type = DrawType::LineList;
-        cmd.isDeferredDraw = false;
-        cmd.count = numPointsPerCircle;
-        cmd.offset = startingIndex;
-        impl->drawCommands.emplace_back(std::move(cmd));
+        ++index;
     }
+    if (index == buffers.size())
     {
-        DrawCmd cmd;
-        cmd.type = DrawType::LineList;
-        cmd.isDeferredDraw = false;
-        cmd.count = numPointsPerCircle;
-        cmd.offset = startingIndex + numPointsPerCircle;
-        impl->drawCommands.emplace_back(std::move(cmd));
+        buffers.emplace_back();
     }
+    buffers[index] = RetainedBuffer{};
+    buffers[index].inUse = true;
+    return (BufferHandle)(index + 1);
+}
+
+void View3d::DestroyBuffer(BufferHandle handle)
+{
+    RetainedBuffer* buffer = impl->GetRetainedBuffer(handle);
+    if (buffer == nullptr)
     {
-        DrawCmd cmd;
-        cmd.type = DrawType::LineList;
-        cmd.isDeferredDraw = false;
-        cmd.count = numPointsPerCircle;
-        cmd.offset = startingIndex + 2 * numPointsPerCircle;
-        impl->drawCommands.emplace_back(std::move(cmd));
+        return;
     }
+    GLuint glBuffers[4] = { buffer->positions, buffer->colors, buffer->scalars, buffer->elements };
+    glDeleteBuffers(4, glBuffers);
+    *buffer = RetainedBuffer{};
 }
 
-void View3d::Render()
+void View3d::AppendVertices(BufferHandle handle, const Vec3* positions, const Vec3* colors, size_t numVertices)
+{
+    RetainedBuffer* buffer = impl->GetRetainedBuffer(handle);
+    if (buffer == nullptr || numVertices == 0)
+    {
+        return;
+    }
+
+    GLuint prevBuffer;
+    glGetIntegerv(GL_COPY_WRITE_BUFFER_BINDING, (GLint*)&prevBuffer);
+
+    const size_t required = buffer->vertexCount + numVertices;
+    if (required > buffer->vertexCapacity)
+    {
+        size_t capacity = GrownCapacity(buffer->vertexCapacity, required);
+        GrowBuffer(buffer->positions, buffer->vertexCount * sizeof(Vec3), capacity * sizeof(Vec3));
+        if (buffer->colors != 0)
+        {
+            GrowBuffer(buffer->colors, buffer->vertexCount * sizeof(Vec3), capacity * sizeof(Vec3));
+        }
+        if (buffer->scalars != 0)
+        {
+            GrowBuffer(buffer->scalars, buffer->scalarCount * sizeof(float), capacity * sizeof(float));
+        }
+        buffer->vertexCapacity = capacity;
+    }
+
+    if (colors != nullptr)
+    {
+        AddColorStream(*buffer);
+    }
+
+    const size_t offset = buffer->vertexCount * sizeof(Vec3);
+    const size_t size = numVertices * sizeof(Vec3);
+    buffer->positionWrites.Add(offset, positions, size);
+    ExpandBounds(*buffer, positions, numVertices);
+    if (buffer->colors != 0)
+    {
+        if (colors != nullptr)
+        {
+            buffer->colorWrites.Add(offset, colors, size);
+        }
+        else
+        {
+            std::vector<Vec3> fill(numVertices, DefaultColor);
+            buffer->colorWrites.Add(offset, fill.data(), size);
+        }
+    }
+    buffer->vertexCount = required;
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, prevBuffer);
+}
+
+void View3d::UpdateVertices(BufferHandle handle, size_t firstVertex, const Vec3* positions, const Vec3* colors, size_t numVertices)
+{
+    RetainedBuffer* buffer = impl->GetRetainedBuffer(handle);
+    if (buffer == nullptr || firstVertex >= buffer->vertexCount)
+    {
+        return;
+    }
+    numVertices = std::min(numVertices, buffer->vertexCount - firstVertex);
+
+    const size_t offset = firstVertex * sizeof(Vec3);
+    const size_t size = numVertices * sizeof(Vec3);
+    if (positions != nullptr)
+    {
+        buffer->positionWrites.Add(offset, positions, size);
+        ExpandBounds(*buffer, positions, numVertices);
+    }
+    if (colors != nullptr)
+    {
+        GLuint prevBuffer;
+        glGetIntegerv(GL_COPY_WRITE_BUFFER_BINDING, (GLint*)&prevBuffer);
+        AddColorStream(*buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, prevBuffer);
+
+        buffer->colorWrites.Add(offset, colors, size);
+    }
+}
+
+void View3d::AppendScalars(BufferHandle handle, const float* values, size_t numValues)
+{
+    RetainedBuffer* buffer = impl->GetRetainedBuffer(handle);
+    if (buffer == nullptr)
+    {
+        return;
+    }
+    numValues = std::min(numValues, buffer->vertexCount - buffer->scalarCount);
+    if (numValues == 0)
+    {
+        return;
+    }
+
+    GLuint prevBuffer;
+    glGetIntegerv(GL_COPY_WRITE_BUFFER_BINDING, (GLint*)&prevBuffer);
+
+    if (buffer->scalars == 0)
+    {
+        GrowBuffer(buffer->scalars, 0, buffer->vertexCapacity * sizeof(float));
+    }
+    buffer->scalarWrites.Add(buffer->scalarCount * sizeof(float), values, numValues * sizeof(float));
+    buffer->scalarCount += numValues;
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, prevBuffer);
+}
+
+void View3d::UpdateScalars(BufferHandle handle, size_t firstValue, const float* values, size_t numValues)
+{
+    RetainedBuffer* buffer = impl->GetRetainedBuffer(handle);
+    if (buffer == nullptr || firstValue >= buffer->scalarCount)
+    {
+        return;
+    }
+    numValues = std::min(numValues, buffer->scalarCount - firstValue);
+    buffer->scalarWrites.Add(firstValue * sizeof(float), values, numValues * sizeof(float));
+}
+
+void View3d::AppendTriangles(BufferHandle handle, const unsigned int* indices, size_t numIndices)
+{
+    RetainedBuffer* buffer = impl->GetRetainedBuffer(handle);
+    if (buffer == nullptr || numIndices == 0)
+    {
+        return;
+    }
+
+    GLuint prevBuffer;
+    glGetIntegerv(GL_COPY_WRITE_BUFFER_BINDING, (GLint*)&prevBuffer);
+
+    const size_t required = buffer->indexCount + numIndices;
+    if (required > buffer->indexCapacity)
+    {
+        size_t capacity = GrownCapacity(buffer->indexCapacity, required);
+        GrowBuffer(buffer->elements, buffer->indexCount * sizeof(unsigned int), capacity * sizeof(unsigned int));
+        buffer->indexCapacity = capacity;
+    }
+
+    buffer->elementWrites.Add(buffer->indexCount * sizeof(unsigned int), indices, numIndices * sizeof(unsigned int));
+    buffer->indexCount = required;
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, prevBuffer);
+}
+
+void View3d::DrawBuffer(BufferHandle handle)
 {
+    RetainedBuffer* buffer = impl->GetRetainedBuffer(handle);
+    if (buffer == nullptr)
+    {
+        return;
+    }
+
+    DrawCmd cmd;
+    cmd.isDeferredDraw = true;
+    cmd.buffer = handle;
+    cmd.offset = 0;
+    if (buffer->indexCount > 0)
+    {
+        // Whole triangles only, in case the indices are still streaming in.
+        cmd.type = DrawType::Triangles;
+        cmd.count = (unsigned int)(buffer->indexCount - buffer->indexCount % 3);
+    }
+    else
+    {
+        cmd.type = DrawType::Points;
+        // Colormapped points wait for their scalars.
+        cmd.count = (unsigned int)(buffer->scalars != 0 ? buffer->scalarCount : buffer->vertexCount);
+    }
+    impl->drawCommands.PushBack(cmd);
+}
+
+size_t View3d::GetBufferVertexCount(BufferHandle handle) const
+{
+    RetainedBuffer* buffer = impl->GetRetainedBuffer(handle);
+    return buffer == nullptr ? 0 : buffer->vertexCount;
+}
+
+void View3d::DrawPointDensity(const Vec3* points, size_t numPoints, DensityScale scale)
+{
+    for (Viewport& viewport : impl->viewports)
+    {
+        if (!viewport.inUse)
+        {
+            continue;
+        }
+        float cameraFromWorld[16];
+        float clipFromCamera[16];
+        float clipFromWorld[16];
+        viewport.ComputeCameraMatrices(cameraFromWorld, clipFromCamera);
+        MultiplyMatrices(clipFromCamera, cameraFromWorld, clipFromWorld);
+
+        viewport.densityGrid.Accumulate(points, numPoints, clipFromWorld);
+        viewport.hasDensity = true;
+    }
+    impl->densityScale = scale;
+}
 
-    glBindFramebuffer(GL_FRAMEBUFFER, impl->framebuffer);
+void View3d::DrawLabel(const Vec3& position, const char* text, ImU32 color)
+{
+    impl->labels.Add(&position, &text, &color, 1);
+}
+
+void View3d::DrawLabels(const Vec3* positions, const char* const* texts, size_t numLabels, const ImU32* colors)
+{
+    impl->labels.Add(positions, texts, colors, numLabels);
+}
 
-    glClearColor(impl->backgroundColor.x, impl->backgroundColor.y, impl->backgroundColor.z, impl->backgroundColor.w);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+void View3d::SetLabelDeclutter(float cellSize)
+{
+    impl->labelDeclutterCellSize = cellSize;
+}
 
+void View3d::Render()
+{
     //Setup Opengl state;
     //TODO: Backup previous state.
-    GLuint vao;
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+    glBindVertexArray(impl->vertexArrayObject);
     glEnable(GL_CULL_FACE);
     glEnable(GL_DEPTH_TEST);
 
     glUseProgram(shaderHandle);
     glEnableVertexAttribArray(attribLocationVtxPos);
     glEnableVertexAttribArray(attribLocationVtxCol);
+    impl->BindColormap();
 
-    glVertexAttribPointer(attribLocationVtxPos, 3, GL_FLOAT, GL_FALSE, sizeof(DrawVert), (GLvoid*)IM_OFFSETOF(DrawVert, pos));
-    glVertexAttribPointer(attribLocationVtxCol, 3, GL_FLOAT, GL_FALSE, sizeof(DrawVert), (GLvoid*)IM_OFFSETOF(DrawVert, col));
-
-    glPointSize(5);
-    glViewport(0, 0, impl->framebufferSize.x, impl->framebufferSize.y);
-
-    // Camera setup
-
-    float cameraFromWorld[16];
-
-    FillTransformMatrix(impl->cameraPosition, impl->cameraUp, impl->cameraTarget, cameraFromWorld);
-    glUniformMatrix4fv(uniformLocationCamFromWorld, 1, GL_FALSE, cameraFromWorld);
+    glPointSize(impl->pointSize);
 
-    float clipFromCamera[16];
+    // The recorded geometry is uploaded once and drawn into every viewport. Progressive viewports keep
+    // drawing from it over the following frames, so while they all are, it's only replaced when the scene changes.
+    bool anyProgressive = false;
+    bool needsUpload = false;
+    for (const Viewport& viewport : impl->viewports)
+    {
+        if (viewport.inUse)
+        {
+            anyProgressive |= viewport.progressive.enabled;
+            needsUpload |= !viewport.progressive.enabled || viewport.progressive.restartRequested;
+        }
+    }
+    impl->FlushRetainedBuffers();
+    const uint64_t sceneSignature = anyProgressive ? impl->ComputeSceneSignature() : 0;
+    if (needsUpload || sceneSignature != impl->uploadedSignature)
+    {
+        impl->UploadRecordedGeometry();
+        impl->uploadedSignature = sceneSignature;
+    }
 
-    float right = tanf(0.5f * 3.141592f / 180.f * impl->horizontalFovDegrees) * impl->nearPlane;
-    float heightByWidth = impl->framebufferSize.y / impl->framebufferSize.x;
+    impl->labels.Submit();
 
+    for (Viewport& viewport : impl->viewports)
+    {
+        if (!viewport.inUse)
+        {
+            continue;
+        }
 
-    FillProjectionMatrix(impl->nearPlane, impl->farPlane, right, right * heightByWidth, clipFromCamera);
-    glUniformMatrix4fv(uniformLocationClipFromCamera, 1, GL_FALSE, clipFromCamera);
+        glBindFramebuffer(GL_FRAMEBUFFER, viewport.framebuffer);
+        glViewport(0, 0, viewport.framebufferSize.x, viewport.framebufferSize.y);
 
-    //Copy over the buffer data.
-    glBindBuffer(GL_ARRAY_BUFFER, impl->vertexArray);
-    glBufferData(GL_ARRAY_BUFFER, impl->vertexBuffer.size() * sizeof(DrawVert), impl->vertexBuffer.data(), GL_STREAM_DRAW);
+        // Camera setup
+        float* cameraFromWorld = impl->cameraFromWorld;
+        float* clipFromCamera = impl->clipFromCamera;
+        viewport.ComputeCameraMatrices(cameraFromWorld, clipFromCamera);
+        glUniformMatrix4fv(uniformLocationCamFromWorld, 1, GL_FALSE, cameraFromWorld);
+        glUniformMatrix4fv(uniformLocationClipFromCamera, 1, GL_FALSE, clipFromCamera);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, impl->elementsArray);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, impl->indexBuffer.size() * sizeof(unsigned int), impl->indexBuffer.data(), GL_STREAM_DRAW);
+        float clipFromWorld[16];
+        MultiplyMatrices(clipFromCamera, cameraFromWorld, clipFromWorld);
+        impl->labels.Project(clipFromWorld, viewport.labels);
 
-    for (auto& cmd : impl->drawCommands)
-    {
-        //PERF: Avoid binding when unnecessary
-        if (cmd.isDeferredDraw)
+        if (viewport.progressive.enabled)
         {
-            glBindBuffer(GL_ARRAY_BUFFER, cmd.vertexArray);
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cmd.elementsArray);
+            impl->RenderProgressive(viewport, sceneSignature);
         }
         else
         {
-            glBindBuffer(GL_ARRAY_BUFFER, impl->vertexArray);
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, impl->elementsArray);
+            glClearColor(impl->backgroundColor.x, impl->backgroundColor.y, impl->backgroundColor.z, impl->backgroundColor.w);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            impl->DrawDensityLayer(viewport);
+
+            // The pyramid lags a frame or more behind, and boxes are tested from the camera it was rendered with.
+            // While the camera moves, a buffer coming out from behind an occluder is culled until a pyramid rendered
+            // from the new viewpoint arrives. Culled buffers leave no depth behind, so that pyramid doesn't hide them.
+            viewport.occludedDraws = 0;
+            bool cull = false;
+            if (impl->occlusionCulling)
+            {
+                viewport.PollHiZ();
+                cull = !viewport.hiZ.IsEmpty();
+            }
+
+            // Points for the compute rasterizer are drawn after the rest, which they're depth tested against.
+            const bool computePoints = impl->pointRendering == PointRendering::Compute;
+            for (auto& cmd : impl->drawCommands)
+            {
+                if (cull && impl->IsOccluded(viewport, cmd))
+                {
+                    viewport.occludedDraws++;
+                    continue;
+                }
+                if (computePoints && Impl::IsBuiltinPoints(cmd))
+                {
+                    impl->computePointCommands.push_back(&cmd);
+                    continue;
+                }
+                impl->DrawCommand(cmd, 0, cmd.count);
+            }
+            impl->RasterizePoints(viewport, clipFromWorld);
+
+            if (impl->occlusionCulling)
+            {
+                glBindVertexArray(impl->emptyVertexArrayObject);
+                viewport.StartHiZReadback(clipFromWorld);
+                glBindVertexArray(impl->vertexArrayObject);
+                glUseProgram(shaderHandle);
+                glBindFramebuffer(GL_FRAMEBUFFER, viewport.framebuffer);
+                glViewport(0, 0, viewport.framebufferSize.x, viewport.framebufferSize.y);
+            }
         }
 
-        GLenum drawMode;
-        bool hasIndices = true;
-        switch (cmd.type)
+        if (viewport.hasDensity)
         {
-        case DrawType::Points:
-            drawMode = GL_POINTS;
-            hasIndices = false;
-            break;
-        case DrawType::Lines:
-            drawMode = GL_LINES;
-            hasIndices = false;
-            break;
-        case DrawType::LineList:
-            drawMode = GL_LINE_STRIP;
-            hasIndices = false;
-            break;
-        case DrawType::Triangles:
-            drawMode = GL_TRIANGLES;
-            break;
-        default:
-            drawMode = GL_POINTS;
-            break;
+            viewport.densityGrid.Clear();
+            viewport.hasDensity = false;
         }
+    }
 
+    impl->drawCommands.Clear();
+    impl->vertexBuffer.Clear();
+    impl->indexBuffer.Clear();
+    impl->typedVertexData.Clear();
 
-        if (hasIndices)
+    glBindVertexArray(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void View3d::SetRecordingMemoryLimits(size_t maxRetainedBytes, uint32_t trimAfterFrames)
+{
+    impl->vertexBuffer.SetTrimPolicy(maxRetainedBytes, trimAfterFrames);
+    impl->indexBuffer.SetTrimPolicy(maxRetainedBytes, trimAfterFrames);
+    impl->drawCommands.SetTrimPolicy(maxRetainedBytes, trimAfterFrames);
+    impl->typedVertexData.SetTrimPolicy(maxRetainedBytes, trimAfterFrames);
+}
+
+RecordingMemoryStats View3d::GetRecordingMemoryStats() const
+{
+    RecordingMemoryStats stats{};
+    auto add = [&stats](const auto& arena) {
+        stats.lastFrameBytes += arena.GetLastFrameBytes();
+        stats.peakBytes += arena.GetPeakBytes();
+        stats.reservedBytes += arena.GetReservedBytes();
+    };
+    add(impl->vertexBuffer);
+    add(impl->indexBuffer);
+    add(impl->drawCommands);
+    add(impl->typedVertexData);
+    return stats;
+}
+
+void View3d::SetOcclusionCulling(bool enabled)
+{
+    impl->occlusionCulling = enabled;
+    if (!enabled)
+    {
+        for (Viewport& viewport : impl->viewports)
         {
-            glDrawElements(drawMode, cmd.count, GL_UNSIGNED_INT, (GLvoid*)cmd.offset);
+            viewport.ReleaseHiZ();
+            viewport.occludedDraws = 0;
         }
-        else
+    }
+}
+
+size_t View3d::GetOccludedDrawCount(ViewportId id) const
+{
+    const Viewport* viewport = impl->GetViewport(id);
+    return viewport != nullptr ? viewport->occludedDraws : 0;
+}
+
+void View3d::SetProgressiveRendering(bool enabled, float budgetMs)
+{
+    for (Viewport& viewport : impl->viewports)
+    {
+        ProgressiveState& p = viewport.progressive;
+        if (enabled != p.enabled)
+        {
+            p.restartRequested = true;
+        }
+        p.enabled = enabled;
+        p.budgetMs = budgetMs;
+    }
+}
+
+void View3d::RestartProgressiveRendering()
+{
+    for (Viewport& viewport : impl->viewports)
+    {
+        viewport.progressive.restartRequested = true;
+    }
+}
+
+float View3d::GetProgress() const
+{
+    float progress = 1.f;
+    for (const Viewport& viewport : impl->viewports)
+    {
+        const ProgressiveState& p = viewport.progressive;
+        if (!viewport.inUse || !p.enabled || p.pass == ProgressivePass::Done || p.verticesTotal == 0)
         {
-            glDrawArrays(drawMode, cmd.offset, cmd.count);
+            continue;
         }
+        progress = std::min(progress, (float)p.verticesDrawn / (float)p.verticesTotal);
+    }
+    return progress;
+}
+
+void View3d::GetCameraMatrices(float cameraFromWorld[16], float clipFromCamera[16], ViewportId viewport) const
+{
+    const Viewport* v = impl->GetViewport(viewport);
+    (v != nullptr ? v : &impl->viewports[0])->ComputeCameraMatrices(cameraFromWorld, clipFromCamera);
+}
+
+ImVec2 View3d::GetFramebufferSize(ViewportId viewport) const
+{
+    const Viewport* v = impl->GetViewport(viewport);
+    return v != nullptr ? v->framebufferSize : ImVec2(0, 0);
+}
+
+View3d::ViewportId View3d::AddViewport(const ImVec2& framebufferSize)
+{
+    auto& viewports = impl->viewports;
+    size_t index = 1;
+    while (index < viewports.size() && viewports[index].inUse)
+    {
+        ++index;
+    }
+    if (index == viewports.size())
+    {
+        viewports.emplace_back();
     }
 
-    impl->drawCommands.clear();
-    impl->vertexBuffer.clear();
-    impl->indexBuffer.clear();
+    Viewport& viewport = viewports[index];
+    if (!viewport.Initialize(framebufferSize))
+    {
+        viewport.Release();
+        return 0;
+    }
+    viewport.progressive.enabled = viewports[0].progressive.enabled;
+    viewport.progressive.budgetMs = viewports[0].progressive.budgetMs;
+    return (ViewportId)index;
+}
 
+void View3d::RemoveViewport(ViewportId id)
+{
+    Viewport* viewport = impl->GetViewport(id);
+    if (viewport == nullptr || id == 0)
+    {
+        return;
+    }
+    viewport->Release();
+}
 
+void View3d::SetCamera(ViewportId id, const Vec3& position, const Vec3& target, const Vec3& up)
+{
+    Viewport* viewport = impl->GetViewport(id);
+    if (viewport == nullptr)
+    {
+        return;
+    }
+    viewport->cameraPosition = position;
+    viewport->cameraTarget = target;
+    viewport->cameraUp = up;
+}
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+void View3d::SetProjection(ViewportId id, CameraProjection projection)
+{
+    Viewport* viewport = impl->GetViewport(id);
+    if (viewport == nullptr)
+    {
+        return;
+    }
+    viewport->projection = projection;
 }
 
-void View3d::Image(const ImVec2 & size)
+void View3d::Image(const ImVec2 & size, ViewportId viewportId)
 {
     ImGuiWindow* window = ImGui::GetCurrentWindow();
     if (window->SkipItems)
         return;
 
+    Viewport* viewport = impl->GetViewport(viewportId);
+    if (viewport == nullptr)
+        return;
+
     ImGuiContext& g = *GImGui;
     const ImGuiStyle& style = g.Style;
 
     // Default to using texture ID as ID. User can still push string/integer prefixes.
-    ImGui::PushID((void*)(intptr_t)impl->colorTexture);
+    ImGui::PushID((void*)(intptr_t)viewport->colorTexture);
     const ImGuiID id = window->GetID("#image");
     ImGui::PopID();
 
@@ -601,7 +2932,8 @@ void View3d::Image(const ImVec2 & size)
     // Render
     const ImVec2 uv_min = ImVec2(0, 0);
     const ImVec2 uv_max = ImVec2(1, 1);
-    window->DrawList->AddImage((ImTextureID)impl->colorTexture, image_bb.Min, image_bb.Max, uv_min, uv_max, IM_COL32_WHITE);
+    window->DrawList->AddImage((ImTextureID)viewport->colorTexture, image_bb.Min, image_bb.Max, uv_min, uv_max, IM_COL32_WHITE);
+    impl->labels.Emit(viewport->labels, window->DrawList, image_bb.Min, image_bb.Max, impl->labelDeclutterCellSize);
 
     // Handle camera controls.
     auto& io = ImGui::GetIO();
@@ -617,9 +2949,9 @@ void View3d::Image(const ImVec2 & size)
     if (leftClicked || rightClicked)
     {
         lastClickedPos = ImGui::GetMousePos();
-        lastClickedUp = impl->cameraUp;
-        lastClickedCamPos = impl->cameraPosition;
-        lastClickedTarget = impl->cameraTarget;
+        lastClickedUp = viewport->cameraUp;
+        lastClickedCamPos = viewport->cameraPosition;
+        lastClickedTarget = viewport->cameraTarget;
     }
 
     // Get Mouse delta in normalized range ([-1,1])
@@ -644,8 +2976,8 @@ void View3d::Image(const ImVec2 & size)
             Vec3 axis = Normalized(Cross(movementDir, eye));
 
             Quaternion q = Quaternion::FromAxisAngle(axis, angle);
-            impl->cameraUp = Rotate(lastClickedUp, q);
-            impl->cameraPosition = Rotate(eye, q) + impl->cameraTarget;
+            viewport->cameraUp = Rotate(lastClickedUp, q);
+            viewport->cameraPosition = Rotate(eye, q) + viewport->cameraTarget;
         }
     }
 
@@ -654,10 +2986,10 @@ void View3d::Image(const ImVec2 & size)
     {
         float zoomDelta = io.MouseWheel;
 
-        Vec3 eye = impl->cameraPosition - impl->cameraTarget;
+        Vec3 eye = viewport->cameraPosition - viewport->cameraTarget;
         // Scale it down by some percentage each zoomDelta of 1.
         eye = (1.0f - (impl->cameraZoomSpeed * zoomDelta * 0.01f)) * eye;
-        impl->cameraPosition = eye + impl->cameraTarget;
+        viewport->cameraPosition = eye + viewport->cameraTarget;
     }
 
     //Pan camera.
@@ -666,17 +2998,17 @@ void View3d::Image(const ImVec2 & size)
         // Pan by moving the target and camera position, keeping the eye vector constant. 
         // We pan perpendicularly to the eye direction.
         Vec3 eye = lastClickedCamPos - lastClickedTarget;
-        Vec3 upDir = Normalized(impl->cameraUp);
+        Vec3 upDir = Normalized(viewport->cameraUp);
         Vec3 rightDir = Normalized(Cross(upDir, eye));
 
-        impl->cameraPosition = lastClickedCamPos + upDir * movementDir.y;
-        impl->cameraPosition = impl->cameraPosition + rightDir * movementDir.x;
-        impl->cameraTarget = impl->cameraPosition - eye;
+        viewport->cameraPosition = lastClickedCamPos + upDir * movementDir.y;
+        viewport->cameraPosition = viewport->cameraPosition + rightDir * movementDir.x;
+        viewport->cameraTarget = viewport->cameraPosition - eye;
     }
 
-    ImGui::SliderFloat("Camera near", &impl->nearPlane, 0, 1);
-    ImGui::SliderFloat("Camera far", &impl->farPlane, 0, 1000);
-    ImGui::SliderFloat("Camera FOV", &impl->horizontalFovDegrees, 0, 90);
+    ImGui::SliderFloat("Camera near", &viewport->nearPlane, 0, 1);
+    ImGui::SliderFloat("Camera far", &viewport->farPlane, 0, 1000);
+    ImGui::SliderFloat("Camera FOV", &viewport->horizontalFovDegrees, 0, 90);
     ImGui::SliderFloat("Camera Speed (Rot)", &impl->cameraRotateSpeed, 0, 5);
     ImGui::SliderFloat("Camera Speed (Zoom)", &impl->cameraZoomSpeed, 0, 5);
 }
\ No newline at end of file
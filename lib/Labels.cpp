@@ -0,0 +1,302 @@
+#include "Labels.h"
+#include "Parallel.h"
+
+#include "imgui.h"
+#define IMGUI_DEFINE_MATH_OPERATORS
+#include "imgui_internal.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IM3D_HAS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    constexpr size_t MinLabelsPerWorker = 64 * 1024;
+    constexpr uint32_t CulledLabel = 0xFFFFFFFFu;
+    // Glyph quads reserved in the draw list at once. Keeps each reservation well within 16 bit indices.
+    constexpr int MaxQuadsPerReserve = 8192;
+
+    using ProjectedLabel = LabelBatch::ProjectedLabel;
+
+    void ProjectLabelScalar(const Vec3& p, const float m[16], uint32_t label, ProjectedLabel& out)
+    {
+        float cx = m[0] * p.x + m[4] * p.y + m[8] * p.z + m[12];
+        float cy = m[1] * p.x + m[5] * p.y + m[9] * p.z + m[13];
+        float cz = m[2] * p.x + m[6] * p.y + m[10] * p.z + m[14];
+        float cw = m[3] * p.x + m[7] * p.y + m[11] * p.z + m[15];
+
+        // Written so that NaNs fail the test.
+        if (!(cw > 0.f && cx >= -cw && cx <= cw && cy >= -cw && cy <= cw && cz >= -cw && cz <= cw))
+        {
+            out.label = CulledLabel;
+            return;
+        }
+
+        float invW = 1.f / cw;
+        // The image shows the framebuffer's first row at the top, so v follows clip y as is.
+        out.u = 0.5f + 0.5f * cx * invW;
+        out.v = 0.5f + 0.5f * cy * invW;
+        out.label = label;
+    }
+
+    void ProjectLabels(const Vec3* points, size_t begin, size_t end, const float m[16], ProjectedLabel* out)
+    {
+        size_t i = begin;
+
+#if IM3D_HAS_SSE2
+        const __m128 m0 = _mm_set1_ps(m[0]), m1 = _mm_set1_ps(m[1]), m2 = _mm_set1_ps(m[2]), m3 = _mm_set1_ps(m[3]);
+        const __m128 m4 = _mm_set1_ps(m[4]), m5 = _mm_set1_ps(m[5]), m6 = _mm_set1_ps(m[6]), m7 = _mm_set1_ps(m[7]);
+        const __m128 m8 = _mm_set1_ps(m[8]), m9 = _mm_set1_ps(m[9]), m10 = _mm_set1_ps(m[10]), m11 = _mm_set1_ps(m[11]);
+        const __m128 m12 = _mm_set1_ps(m[12]), m13 = _mm_set1_ps(m[13]), m14 = _mm_set1_ps(m[14]), m15 = _mm_set1_ps(m[15]);
+        const __m128 half = _mm_set1_ps(0.5f);
+
+        alignas(16) float u[4];
+        alignas(16) float v[4];
+        for (; i + 4 <= end; i += 4)
+        {
+            // Four packed Vec3s, transposed to x, y and z lanes.
+            const float* f = &points[i].x;
+            __m128 a = _mm_loadu_ps(f);
+            __m128 b = _mm_loadu_ps(f + 4);
+            __m128 c = _mm_loadu_ps(f + 8);
+            __m128 x = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+            __m128 y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+            __m128 z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+
+            __m128 cx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, x), _mm_mul_ps(m4, y)), _mm_add_ps(_mm_mul_ps(m8, z), m12));
+            __m128 cy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m1, x), _mm_mul_ps(m5, y)), _mm_add_ps(_mm_mul_ps(m9, z), m13));
+            __m128 cz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m2, x), _mm_mul_ps(m6, y)), _mm_add_ps(_mm_mul_ps(m10, z), m14));
+            __m128 cw = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m3, x), _mm_mul_ps(m7, y)), _mm_add_ps(_mm_mul_ps(m11, z), m15));
+
+            __m128 negW = _mm_sub_ps(_mm_setzero_ps(), cw);
+            __m128 inside = _mm_cmpgt_ps(cw, _mm_setzero_ps());
+            inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmpge_ps(cx, negW), _mm_cmple_ps(cx, cw)));
+            inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmpge_ps(cy, negW), _mm_cmple_ps(cy, cw)));
+            inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmpge_ps(cz, negW), _mm_cmple_ps(cz, cw)));
+            int mask = _mm_movemask_ps(inside);
+
+            __m128 halfInvW = _mm_div_ps(half, cw);
+            _mm_store_ps(u, _mm_add_ps(half, _mm_mul_ps(cx, halfInvW)));
+            _mm_store_ps(v, _mm_add_ps(half, _mm_mul_ps(cy, halfInvW)));
+            for (int lane = 0; lane < 4; ++lane)
+            {
+                ProjectedLabel& p = out[i + lane];
+                p.u = u[lane];
+                p.v = v[lane];
+                p.label = (mask & (1 << lane)) ? (uint32_t)(i + lane) : CulledLabel;
+            }
+        }
+#endif
+
+        for (; i < end; ++i)
+        {
+            ProjectLabelScalar(points[i], m, (uint32_t)i, out[i]);
+        }
+    }
+
+    // Calls fn(glyph, x, y) for every visible glyph in text, with the pen position relative to the text's top left.
+    template<typename Fn>
+    void ForEachGlyph(const ImFont* font, float scale, float lineHeight, const char* text, const char* textEnd, Fn&& fn)
+    {
+        float x = 0.f;
+        float y = 0.f;
+        while (text < textEnd)
+        {
+            unsigned int c = (unsigned char)*text;
+            if (c < 0x80)
+            {
+                text++;
+            }
+            else
+            {
+                text += ImTextCharFromUtf8(&c, text, textEnd);
+            }
+
+            if (c == '\n')
+            {
+                x = 0.f;
+                y += lineHeight;
+                continue;
+            }
+            if (c == '\r')
+            {
+                continue;
+            }
+
+            const ImFontGlyph* glyph = font->FindGlyph(c <= 0xFFFF ? (ImWchar)c : (ImWchar)'?');
+            if (glyph == nullptr)
+            {
+                continue;
+            }
+            if (glyph->Visible)
+            {
+                fn(*glyph, x, y);
+            }
+            x += glyph->AdvanceX * scale;
+        }
+    }
+}
+
+void LabelBatch::Labels::Clear()
+{
+    positions.clear();
+    colors.clear();
+    textOffsets.clear();
+    text.clear();
+}
+
+void LabelBatch::Add(const Vec3* positions, const char* const* texts, const ImU32* colors, size_t numLabels)
+{
+    recorded.positions.insert(recorded.positions.end(), positions, positions + numLabels);
+    if (colors != nullptr)
+    {
+        recorded.colors.insert(recorded.colors.end(), colors, colors + numLabels);
+    }
+    else
+    {
+        recorded.colors.resize(recorded.colors.size() + numLabels, IM_COL32_WHITE);
+    }
+
+    for (size_t i = 0; i < numLabels; ++i)
+    {
+        const char* text = texts[i] != nullptr ? texts[i] : "";
+        recorded.textOffsets.push_back((uint32_t)recorded.text.size());
+        recorded.text.insert(recorded.text.end(), text, text + strlen(text) + 1);
+    }
+}
+
+void LabelBatch::Submit()
+{
+    std::swap(recorded, submitted);
+    recorded.Clear();
+}
+
+void LabelBatch::Project(const float clipFromWorld[16], std::vector<ProjectedLabel>& projected)
+{
+    projected.clear();
+
+    const size_t numLabels = submitted.positions.size();
+    if (numLabels == 0)
+    {
+        return;
+    }
+
+    scratch.resize(numLabels);
+    ProjectedLabel* out = scratch.data();
+    ParallelFor(numLabels, ChooseWorkerCount(numLabels, MinLabelsPerWorker), [&](size_t begin, size_t end, size_t)
+    {
+        ProjectLabels(submitted.positions.data(), begin, end, clipFromWorld, out);
+    });
+
+    // Compacted in order, so earlier labels win when decluttering.
+    for (const ProjectedLabel& p : scratch)
+    {
+        if (p.label != CulledLabel)
+        {
+            projected.push_back(p);
+        }
+    }
+}
+
+void LabelBatch::Emit(const std::vector<ProjectedLabel>& projected, ImDrawList* drawList, const ImVec2& min, const ImVec2& max, float declutterCellSize) const
+{
+    if (projected.empty())
+    {
+        return;
+    }
+
+    ImFont* font = ImGui::GetFont();
+    const float fontSize = ImGui::GetFontSize();
+    const float scale = fontSize / font->FontSize;
+
+    drawList->PushClipRect(min, max, true);
+    drawList->PushTextureID(font->ContainerAtlas->TexID);
+    const ImVec2 clipMin = drawList->GetClipRectMin();
+    const ImVec2 clipMax = drawList->GetClipRectMax();
+    const ImVec2 size = max - min;
+
+    const bool declutter = declutterCellSize > 0.f;
+    const int gridWidth = declutter ? (int)((clipMax.x - clipMin.x) / declutterCellSize) + 1 : 0;
+    const int gridHeight = declutter ? (int)((clipMax.y - clipMin.y) / declutterCellSize) + 1 : 0;
+    std::vector<uint8_t> occupied((size_t)gridWidth * gridHeight, 0);
+
+    // Place everything first, so the glyph quads can be reserved up front.
+    struct PlacedLabel
+    {
+        ImVec2 origin;
+        uint32_t label;
+    };
+    std::vector<PlacedLabel> placed;
+    placed.reserve(projected.size());
+    size_t numQuads = 0;
+
+    for (const ProjectedLabel& p : projected)
+    {
+        const ImVec2 anchor(min.x + p.u * size.x, min.y + p.v * size.y);
+        if (anchor.x < clipMin.x || anchor.x >= clipMax.x || anchor.y < clipMin.y || anchor.y >= clipMax.y)
+        {
+            continue;
+        }
+
+        if (declutter)
+        {
+            int cellX = std::min((int)((anchor.x - clipMin.x) / declutterCellSize), gridWidth - 1);
+            int cellY = std::min((int)((anchor.y - clipMin.y) / declutterCellSize), gridHeight - 1);
+            uint8_t& cell = occupied[(size_t)cellY * gridWidth + cellX];
+            if (cell)
+            {
+                continue;
+            }
+            cell = 1;
+        }
+
+        const char* text = &submitted.text[submitted.textOffsets[p.label]];
+        float width = 0.f;
+        float height = fontSize;
+        size_t numGlyphs = 0;
+        ForEachGlyph(font, scale, fontSize, text, text + strlen(text), [&](const ImFontGlyph& glyph, float x, float y)
+        {
+            width = std::max(width, x + glyph.X1 * scale);
+            height = std::max(height, y + fontSize);
+            numGlyphs++;
+        });
+
+        // Centered above the anchor, snapped to whole pixels to keep the text crisp.
+        const ImVec2 origin(floorf(anchor.x - 0.5f * width + 0.5f), floorf(anchor.y - height + 0.5f));
+        if (origin.x + width < clipMin.x || origin.x >= clipMax.x || origin.y + height < clipMin.y)
+        {
+            continue;
+        }
+        placed.push_back(PlacedLabel{ origin, p.label });
+        numQuads += numGlyphs;
+    }
+
+    size_t quadsLeft = numQuads;
+    int reservedLeft = 0;
+    for (const PlacedLabel& label : placed)
+    {
+        const char* text = &submitted.text[submitted.textOffsets[label.label]];
+        const ImU32 color = submitted.colors[label.label];
+        ForEachGlyph(font, scale, fontSize, text, text + strlen(text), [&](const ImFontGlyph& glyph, float x, float y)
+        {
+            if (reservedLeft == 0)
+            {
+                reservedLeft = (int)std::min<size_t>(quadsLeft, MaxQuadsPerReserve);
+                quadsLeft -= reservedLeft;
+                drawList->PrimReserve(reservedLeft * 6, reservedLeft * 4);
+            }
+            const ImVec2 a(label.origin.x + x + glyph.X0 * scale, label.origin.y + y + glyph.Y0 * scale);
+            const ImVec2 b(label.origin.x + x + glyph.X1 * scale, label.origin.y + y + glyph.Y1 * scale);
+            drawList->PrimRectUV(a, b, ImVec2(glyph.U0, glyph.V0), ImVec2(glyph.U1, glyph.V1), color);
+            reservedLeft--;
+        });
+    }
+
+    drawList->PopTextureID();
+    drawList->PopClipRect();
+}
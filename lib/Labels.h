@@ -0,0 +1,53 @@
+#pragma once
+#include "Im3D.h"
+#include <cstdint>
+#include <vector>
+
+struct ImDrawList;
+
+/*
+    Text labels anchored at 3D positions, drawn over a View3d's images.
+    Labels recorded during a frame are projected all at once for each camera, dropping those outside
+    the view volume. When an image is drawn, the survivors are placed in the image rect, culled against the
+    clip rect, optionally thinned out on a screen-space grid, and written into the draw list as one batch
+    of glyph quads, instead of one AddText() call each.
+*/
+class LabelBatch
+{
+public:
+    struct ProjectedLabel
+    {
+        float u, v; // Position in the image, [0,1] from the top left.
+        uint32_t label; // Index among the labels added for the frame.
+    };
+
+    // Copies the text. colors may be null, for white.
+    void Add(const Vec3* positions, const char* const* texts, const ImU32* colors, size_t numLabels);
+
+    // Makes the labels added since the last call the ones Project() and Emit() work on, until the next call.
+    void Submit();
+
+    // Projects the submitted labels, keeping the visible ones. clipFromWorld is column-major.
+    void Project(const float clipFromWorld[16], std::vector<ProjectedLabel>& projected);
+
+    /*
+        Draws projected labels centered above their anchors, mapping the view to the rect [min, max].
+        With declutterCellSize > 0, only the first label recorded in each cell of that many pixels is drawn.
+    */
+    void Emit(const std::vector<ProjectedLabel>& projected, ImDrawList* drawList, const ImVec2& min, const ImVec2& max, float declutterCellSize) const;
+
+private:
+    struct Labels
+    {
+        std::vector<Vec3> positions;
+        std::vector<ImU32> colors;
+        std::vector<uint32_t> textOffsets; // Into text, each null terminated.
+        std::vector<char> text;
+
+        void Clear();
+    };
+
+    Labels recorded;
+    Labels submitted;
+    std::vector<ProjectedLabel> scratch; // One per label, culled ones marked with CulledLabel.
+};
@@ -0,0 +1,205 @@
+#include "Lz4.h"
+
+#include <cstring>
+#include <vector>
+
+namespace
+{
+    constexpr size_t MinMatch = 4;
+    // The format requires the last 5 bytes to be literals, and the last match to start 12 bytes before the end.
+    constexpr size_t LastLiterals = 5;
+    constexpr size_t MatchFindLimit = 12;
+    constexpr size_t MaxOffset = 65535;
+    constexpr int HashLog = 16;
+
+    uint32_t Read32(const uint8_t* p)
+    {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    uint32_t Hash(uint32_t sequence)
+    {
+        return (sequence * 2654435761u) >> (32 - HashLog);
+    }
+
+    uint8_t* WriteLength(uint8_t* op, size_t length)
+    {
+        while (length >= 255)
+        {
+            *op++ = 255;
+            length -= 255;
+        }
+        *op++ = (uint8_t)length;
+        return op;
+    }
+
+    uint8_t* WriteSequence(uint8_t* op, const uint8_t* literals, size_t literalLength, size_t offset, size_t matchLength)
+    {
+        uint8_t* token = op++;
+        *token = (uint8_t)((literalLength >= 15 ? 15 : literalLength) << 4);
+        if (literalLength >= 15)
+        {
+            op = WriteLength(op, literalLength - 15);
+        }
+        // Empty inputs have no buffer to copy from.
+        if (literalLength > 0)
+        {
+            memcpy(op, literals, literalLength);
+        }
+        op += literalLength;
+
+        // The last sequence is literals only.
+        if (matchLength == 0)
+        {
+            return op;
+        }
+
+        *op++ = (uint8_t)(offset & 0xff);
+        *op++ = (uint8_t)(offset >> 8);
+        size_t encodedMatch = matchLength - MinMatch;
+        *token |= (uint8_t)(encodedMatch >= 15 ? 15 : encodedMatch);
+        if (encodedMatch >= 15)
+        {
+            op = WriteLength(op, encodedMatch - 15);
+        }
+        return op;
+    }
+
+    bool ReadLength(const uint8_t*& ip, const uint8_t* end, size_t& length)
+    {
+        uint8_t b;
+        do
+        {
+            if (ip >= end)
+            {
+                return false;
+            }
+            b = *ip++;
+            length += b;
+        } while (b == 255);
+        return true;
+    }
+}
+
+size_t Lz4Compress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstCapacity)
+{
+    if (dstCapacity < Lz4CompressBound(srcSize))
+    {
+        return 0;
+    }
+
+    uint8_t* op = dst;
+    size_t anchor = 0;
+
+    if (srcSize > MatchFindLimit)
+    {
+        std::vector<uint32_t> table((size_t)1 << HashLog, 0);
+        const size_t matchLimit = srcSize - LastLiterals;
+        size_t ip = 1;
+
+        while (ip + MatchFindLimit <= srcSize)
+        {
+            const uint32_t sequence = Read32(src + ip);
+            const uint32_t h = Hash(sequence);
+            size_t candidate = table[h];
+            table[h] = (uint32_t)ip;
+
+            if (candidate >= ip || ip - candidate > MaxOffset || Read32(src + candidate) != sequence)
+            {
+                ++ip;
+                continue;
+            }
+
+            // Extend the match backwards into the pending literals, then forwards.
+            while (ip > anchor && candidate > 0 && src[ip - 1] == src[candidate - 1])
+            {
+                --ip;
+                --candidate;
+            }
+            size_t length = MinMatch;
+            while (ip + length < matchLimit && src[candidate + length] == src[ip + length])
+            {
+                ++length;
+            }
+
+            op = WriteSequence(op, src + anchor, ip - anchor, ip - candidate, length);
+            ip += length;
+            anchor = ip;
+            if (ip + MatchFindLimit <= srcSize)
+            {
+                table[Hash(Read32(src + ip - 2))] = (uint32_t)(ip - 2);
+            }
+        }
+    }
+
+    op = WriteSequence(op, src + anchor, srcSize - anchor, 0, 0);
+    return op - dst;
+}
+
+bool Lz4Decompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize)
+{
+    const uint8_t* ip = src;
+    const uint8_t* const ipEnd = src + srcSize;
+    uint8_t* op = dst;
+    uint8_t* const opEnd = dst + dstSize;
+
+    while (ip < ipEnd)
+    {
+        const uint8_t token = *ip++;
+
+        size_t literalLength = token >> 4;
+        if (literalLength == 15 && !ReadLength(ip, ipEnd, literalLength))
+        {
+            return false;
+        }
+        if (literalLength > (size_t)(ipEnd - ip) || literalLength > (size_t)(opEnd - op))
+        {
+            return false;
+        }
+        if (literalLength > 0)
+        {
+            memcpy(op, ip, literalLength);
+        }
+        ip += literalLength;
+        op += literalLength;
+
+        if (ip == ipEnd)
+        {
+            break;
+        }
+
+        if (ipEnd - ip < 2)
+        {
+            return false;
+        }
+        const size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst))
+        {
+            return false;
+        }
+
+        size_t matchLength = token & 15;
+        if (matchLength == 15 && !ReadLength(ip, ipEnd, matchLength))
+        {
+            return false;
+        }
+        matchLength += MinMatch;
+        if (matchLength > (size_t)(opEnd - op))
+        {
+            return false;
+        }
+
+        // Matches may overlap their own output, so this copies forward one byte at a time.
+        const uint8_t* match = op - offset;
+        for (size_t i = 0; i < matchLength; ++i)
+        {
+            op[i] = match[i];
+        }
+        op += matchLength;
+    }
+
+    return op == opEnd;
+}
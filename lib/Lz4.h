@@ -0,0 +1,20 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/*
+    Compressor and decompressor for the LZ4 block format, so data written here can be read back by the reference LZ4
+    library and vice versa. The compressor is a plain greedy one: fast, but without the high compression modes.
+*/
+
+// Largest size the compressed form of srcSize bytes can take.
+inline size_t Lz4CompressBound(size_t srcSize)
+{
+    return srcSize + srcSize / 255 + 16;
+}
+
+// Returns the compressed size, or 0 if dstCapacity is below Lz4CompressBound(srcSize).
+size_t Lz4Compress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstCapacity);
+
+// Decompresses exactly dstSize bytes. Returns false on malformed input rather than reading or writing out of bounds.
+bool Lz4Decompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize);
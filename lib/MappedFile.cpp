@@ -0,0 +1,126 @@
+#include "MappedFile.h"
+
+#include <cstdio>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const char* path)
+{
+    Close();
+
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+    {
+        fprintf(stderr, "Failed to get the size of %s, or it is empty\n", path);
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr)
+    {
+        fprintf(stderr, "Failed to map %s\n", path);
+        CloseHandle(file);
+        return false;
+    }
+
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (view == nullptr)
+    {
+        fprintf(stderr, "Failed to map %s\n", path);
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    fileHandle = file;
+    mappingHandle = mapping;
+    data = (const char*)view;
+    size = (size_t)fileSize.QuadPart;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (data != nullptr)
+    {
+        UnmapViewOfFile(data);
+        CloseHandle((HANDLE)mappingHandle);
+        CloseHandle((HANDLE)fileHandle);
+    }
+    data = nullptr;
+    size = 0;
+    fileHandle = nullptr;
+    mappingHandle = nullptr;
+}
+
+#else
+
+bool MappedFile::Open(const char* path)
+{
+    Close();
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        fprintf(stderr, "Failed to get the size of %s, or it is empty\n", path);
+        close(fd);
+        return false;
+    }
+
+    void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file alive on its own.
+    close(fd);
+    if (view == MAP_FAILED)
+    {
+        fprintf(stderr, "Failed to map %s\n", path);
+        return false;
+    }
+    madvise(view, (size_t)info.st_size, MADV_SEQUENTIAL);
+
+    data = (const char*)view;
+    size = (size_t)info.st_size;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (data != nullptr)
+    {
+        munmap((void*)data, size);
+    }
+    data = nullptr;
+    size = 0;
+}
+
+#endif
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+
+/*
+    Read-only memory mapping of a whole file. The OS pages the file in on demand,
+    so even multi-gigabyte files open instantly and are never copied into our own buffers.
+*/
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool Open(const char* path);
+    void Close();
+
+    const char* GetData() const { return data; }
+    size_t GetSize() const { return size; }
+
+private:
+    const char* data{ nullptr };
+    size_t size{ 0 };
+#ifdef _WIN32
+    void* fileHandle{ nullptr };
+    void* mappingHandle{ nullptr };
+#endif
+};
@@ -0,0 +1,57 @@
+#pragma once
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+/*
+    Minimal fork-join helpers for the CPU-side kernels.
+    Work is split into one contiguous range per worker, and each worker gets its index so it can
+    write to its own scratch data without any synchronization.
+*/
+
+inline size_t GetMaxWorkerCount()
+{
+    unsigned int n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : n;
+}
+
+// Number of workers worth using for count items, if each worker should get at least minPerWorker of them.
+inline size_t ChooseWorkerCount(size_t count, size_t minPerWorker)
+{
+    size_t byCount = minPerWorker == 0 ? count : count / minPerWorker;
+    return std::max<size_t>(1, std::min(byCount, GetMaxWorkerCount()));
+}
+
+// Runs fn(begin, end, workerIndex) over numWorkers ranges covering [0, count).
+// The calling thread takes the first range, and this returns once every range is done.
+template<typename Fn>
+void ParallelFor(size_t count, size_t numWorkers, Fn&& fn)
+{
+    numWorkers = std::max<size_t>(1, std::min(numWorkers, count));
+    if (numWorkers == 1)
+    {
+        fn(size_t(0), count, size_t(0));
+        return;
+    }
+
+    const size_t perWorker = count / numWorkers;
+    const size_t remainder = count % numWorkers;
+    auto rangeBegin = [&](size_t worker) { return worker * perWorker + std::min(worker, remainder); };
+
+    std::vector<std::thread> threads;
+    threads.reserve(numWorkers - 1);
+    for (size_t worker = 1; worker < numWorkers; ++worker)
+    {
+        threads.emplace_back([&fn, worker, begin = rangeBegin(worker), end = rangeBegin(worker + 1)]()
+        {
+            fn(begin, end, worker);
+        });
+    }
+
+    fn(size_t(0), rangeBegin(1), size_t(0));
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+}
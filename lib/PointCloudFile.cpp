@@ -0,0 +1,880 @@
+#include "PointCloudFile.h"
+#include "GeometryLoader.h"
+#include "Lz4.h"
+#include "MappedFile.h"
+#include "Parallel.h"
+#include "Util.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+
+static_assert(sizeof(PointCloudFileHeader) == 56, "PointCloudFileHeader is an on-disk record");
+
+namespace
+{
+    constexpr char Magic[4] = { 'I', 'M', 'P', 'C' };
+    // Nodes are encoded in parallel in batches of this many, then written out in order.
+    constexpr size_t EncodeBatchSize = 256;
+
+    // Node of the octree under construction. Its points are order[begin, begin + numOwnPoints),
+    // followed by the points of its subtree.
+    struct BuildNode
+    {
+        size_t begin;
+        size_t numSubtreePoints;
+        size_t numOwnPoints;
+        Vec3 cellCenter;
+        float cellHalfSize;
+        int depth;
+        uint32_t firstChild;
+        uint8_t numChildren;
+    };
+
+    // Spreads the bits of a 16 bit value to every third bit, for 48 bit Morton codes.
+    uint64_t SpreadBits(uint64_t v)
+    {
+        v &= 0xffff;
+        v = (v | (v << 16)) & 0x0000ff0000ff00ffull;
+        v = (v | (v << 8)) & 0x00f00f00f00f00f0full;
+        v = (v | (v << 4)) & 0x00c30c30c30c30c3ull;
+        v = (v | (v << 2)) & 0x0249249249249249ull;
+        return v;
+    }
+
+    uint16_t Quantize(float v, float min, float scale)
+    {
+        float q = (v - min) * scale + 0.5f;
+        return (uint16_t)std::min(std::max(q, 0.f), 65535.f);
+    }
+
+    uint8_t QuantizeColor(float c)
+    {
+        return (uint8_t)std::min(std::max(c * 255.f + 0.5f, 0.f), 255.f);
+    }
+
+    void Compress(std::vector<uint8_t>& chunk, bool& compressed)
+    {
+        std::vector<uint8_t> packed(Lz4CompressBound(chunk.size()));
+        size_t size = Lz4Compress(chunk.data(), chunk.size(), packed.data(), packed.size());
+        compressed = size > 0 && size < chunk.size();
+        if (compressed)
+        {
+            packed.resize(size);
+            chunk.swap(packed);
+        }
+    }
+
+    /*
+        Positions are quantized to 16 bits against the node's bounds and sorted along a Morton curve.
+        Each axis is then stored as deltas, split into a plane of low bytes and a plane of high bytes,
+        which leaves long runs of near-zero high bytes for the compressor.
+    */
+    void EncodeNode(const Vec3* positions, const Vec3* colors, const uint32_t* indices, size_t count, bool compress,
+        PointCloudNode& record, std::vector<uint8_t>& positionsChunk, std::vector<uint8_t>& colorsChunk)
+    {
+        Vec3 min = positions[indices[0]];
+        Vec3 max = min;
+        for (size_t i = 1; i < count; ++i)
+        {
+            const Vec3& p = positions[indices[i]];
+            min = Vec3{ std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z) };
+            max = Vec3{ std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z) };
+        }
+        record.boundsMin[0] = min.x; record.boundsMin[1] = min.y; record.boundsMin[2] = min.z;
+        record.boundsMax[0] = max.x; record.boundsMax[1] = max.y; record.boundsMax[2] = max.z;
+
+        const float scale[3] = {
+            max.x > min.x ? 65535.f / (max.x - min.x) : 0.f,
+            max.y > min.y ? 65535.f / (max.y - min.y) : 0.f,
+            max.z > min.z ? 65535.f / (max.z - min.z) : 0.f };
+
+        struct QuantizedPoint
+        {
+            uint64_t key;
+            uint16_t q[3];
+            uint32_t index;
+        };
+        std::vector<QuantizedPoint> points(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            const Vec3& p = positions[indices[i]];
+            QuantizedPoint& qp = points[i];
+            qp.q[0] = Quantize(p.x, min.x, scale[0]);
+            qp.q[1] = Quantize(p.y, min.y, scale[1]);
+            qp.q[2] = Quantize(p.z, min.z, scale[2]);
+            qp.key = SpreadBits(qp.q[0]) | (SpreadBits(qp.q[1]) << 1) | (SpreadBits(qp.q[2]) << 2);
+            qp.index = indices[i];
+        }
+        std::sort(points.begin(), points.end(), [](const QuantizedPoint& a, const QuantizedPoint& b) { return a.key < b.key; });
+
+        positionsChunk.resize(count * 6);
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            uint8_t* low = positionsChunk.data() + axis * 2 * count;
+            uint8_t* high = low + count;
+            uint16_t previous = 0;
+            for (size_t i = 0; i < count; ++i)
+            {
+                uint16_t delta = (uint16_t)(points[i].q[axis] - previous);
+                previous = points[i].q[axis];
+                low[i] = (uint8_t)(delta & 0xff);
+                high[i] = (uint8_t)(delta >> 8);
+            }
+        }
+
+        colorsChunk.clear();
+        if (colors != nullptr)
+        {
+            colorsChunk.resize(count * 3);
+            for (size_t i = 0; i < count; ++i)
+            {
+                const Vec3& c = colors[points[i].index];
+                colorsChunk[i] = QuantizeColor(c.x);
+                colorsChunk[count + i] = QuantizeColor(c.y);
+                colorsChunk[2 * count + i] = QuantizeColor(c.z);
+            }
+        }
+
+        record.compression = 0;
+        if (compress)
+        {
+            bool compressed;
+            Compress(positionsChunk, compressed);
+            record.compression |= compressed ? PointCloudCompression_Positions : 0;
+            if (!colorsChunk.empty())
+            {
+                Compress(colorsChunk, compressed);
+                record.compression |= compressed ? PointCloudCompression_Colors : 0;
+            }
+        }
+        record.numPoints = (uint32_t)count;
+        record.positionsSize = (uint32_t)positionsChunk.size();
+        record.colorsSize = (uint32_t)colorsChunk.size();
+    }
+
+    // Returns a pointer to the raw column bytes, decompressing into scratch if needed.
+    const uint8_t* GetColumnBytes(const char* fileData, size_t fileSize, uint64_t offset, uint32_t storedSize, bool compressed,
+        size_t rawSize, std::vector<uint8_t>& scratch)
+    {
+        if (offset > fileSize || storedSize > fileSize - offset)
+        {
+            return nullptr;
+        }
+        const uint8_t* stored = (const uint8_t*)fileData + offset;
+        if (!compressed)
+        {
+            return storedSize == rawSize ? stored : nullptr;
+        }
+        scratch.resize(rawSize);
+        return Lz4Decompress(stored, storedSize, scratch.data(), rawSize) ? scratch.data() : nullptr;
+    }
+
+    BuildNode RootCell(const Vec3& min, const Vec3& max)
+    {
+        BuildNode root{};
+        root.cellCenter = Vec3{ 0.5f * (min.x + max.x), 0.5f * (min.y + max.y), 0.5f * (min.z + max.z) };
+        root.cellHalfSize = 0.5f * std::max(max.x - min.x, std::max(max.y - min.y, max.z - min.z));
+        return root;
+    }
+
+    int GetOctant(const BuildNode& node, const Vec3& p)
+    {
+        return (p.x >= node.cellCenter.x ? 1 : 0) | (p.y >= node.cellCenter.y ? 2 : 0) | (p.z >= node.cellCenter.z ? 4 : 0);
+    }
+
+    BuildNode ChildCell(const BuildNode& node, int octant)
+    {
+        BuildNode child{};
+        child.cellHalfSize = 0.5f * node.cellHalfSize;
+        child.cellCenter = Vec3{
+            node.cellCenter.x + ((octant & 1) ? child.cellHalfSize : -child.cellHalfSize),
+            node.cellCenter.y + ((octant & 2) ? child.cellHalfSize : -child.cellHalfSize),
+            node.cellCenter.z + ((octant & 4) ? child.cellHalfSize : -child.cellHalfSize) };
+        child.depth = node.depth + 1;
+        return child;
+    }
+
+    // Octree construction within cell, breadth first so that the children of every node end up next to each other.
+    std::vector<BuildNode> BuildOctree(const Vec3* positions, std::vector<uint32_t>& order, const BuildNode& cell,
+        const PointCloudWriteOptions& options)
+    {
+        std::vector<uint32_t> scratch(order.size());
+        std::vector<uint8_t> octants;
+
+        BuildNode root = cell;
+        root.begin = 0;
+        root.numSubtreePoints = order.size();
+        std::vector<BuildNode> nodes{ root };
+
+        for (size_t n = 0; n < nodes.size(); ++n)
+        {
+            BuildNode node = nodes[n];
+            if (node.numSubtreePoints <= options.maxPointsPerNode || node.depth >= options.maxDepth)
+            {
+                nodes[n].numOwnPoints = node.numSubtreePoints;
+                continue;
+            }
+
+            // The points were shuffled up front and partitioning is stable, so taking the first ones is a random sample.
+            node.numOwnPoints = options.maxPointsPerNode;
+            const size_t restBegin = node.begin + node.numOwnPoints;
+            const size_t restCount = node.numSubtreePoints - node.numOwnPoints;
+
+            // Counting sort of the rest of the points by octant.
+            size_t octantCounts[8] = {};
+            octants.resize(restCount);
+            for (size_t i = 0; i < restCount; ++i)
+            {
+                uint8_t octant = (uint8_t)GetOctant(node, positions[order[restBegin + i]]);
+                octants[i] = octant;
+                octantCounts[octant]++;
+            }
+            size_t octantStarts[8];
+            size_t running = 0;
+            for (int o = 0; o < 8; ++o)
+            {
+                octantStarts[o] = running;
+                running += octantCounts[o];
+            }
+            size_t cursor[8];
+            memcpy(cursor, octantStarts, sizeof(cursor));
+            for (size_t i = 0; i < restCount; ++i)
+            {
+                scratch[cursor[octants[i]]++] = order[restBegin + i];
+            }
+            memcpy(order.data() + restBegin, scratch.data(), restCount * sizeof(uint32_t));
+
+            node.firstChild = (uint32_t)nodes.size();
+            node.numChildren = 0;
+            for (int o = 0; o < 8; ++o)
+            {
+                if (octantCounts[o] == 0)
+                {
+                    continue;
+                }
+                BuildNode child = ChildCell(node, o);
+                child.begin = restBegin + octantStarts[o];
+                child.numSubtreePoints = octantCounts[o];
+                nodes.push_back(child);
+                node.numChildren++;
+            }
+            nodes[n] = node;
+        }
+        return nodes;
+    }
+
+    void SetCell(PointCloudNode& record, const BuildNode& node)
+    {
+        record.cellCenter[0] = node.cellCenter.x;
+        record.cellCenter[1] = node.cellCenter.y;
+        record.cellCenter[2] = node.cellCenter.z;
+        // Distance from the center to a corner of the cell.
+        record.cellRadius = node.cellHalfSize * sqrtf(3.f);
+        record.depth = (uint8_t)node.depth;
+    }
+
+    bool CanWrite(const PointCloudWriteOptions& options)
+    {
+        if (!IsLittleEndianHost())
+        {
+            fprintf(stderr, "Point cloud files can only be written on little endian hosts\n");
+            return false;
+        }
+        if (options.maxPointsPerNode == 0)
+        {
+            fprintf(stderr, "maxPointsPerNode must be at least 1\n");
+            return false;
+        }
+        return true;
+    }
+
+    // Writes node data as it's encoded, then the node table and the header once every node is written.
+    struct NodeWriter
+    {
+        FILE* file{ nullptr };
+        uint64_t offset{ sizeof(PointCloudFileHeader) };
+        std::vector<PointCloudNode> records;
+        std::vector<std::vector<uint8_t>> positionChunks;
+        std::vector<std::vector<uint8_t>> colorChunks;
+        bool ok{ true };
+
+        ~NodeWriter()
+        {
+            if (file != nullptr)
+            {
+                fclose(file);
+            }
+        }
+
+        bool Open(const char* path)
+        {
+            file = fopen(path, "wb");
+            if (file == nullptr)
+            {
+                fprintf(stderr, "Failed to open %s for writing\n", path);
+                return false;
+            }
+            // Written again once the offsets are known.
+            const PointCloudFileHeader header{};
+            ok = fwrite(&header, sizeof(header), 1, file) == 1;
+            positionChunks.resize(EncodeBatchSize);
+            colorChunks.resize(EncodeBatchSize);
+            return true;
+        }
+
+        void WriteChunks(PointCloudNode& record, const std::vector<uint8_t>& positionsChunk, const std::vector<uint8_t>& colorsChunk)
+        {
+            record.positionsOffset = offset;
+            ok = ok && fwrite(positionsChunk.data(), 1, positionsChunk.size(), file) == positionsChunk.size();
+            offset += positionsChunk.size();
+            record.colorsOffset = offset;
+            ok = ok && fwrite(colorsChunk.data(), 1, colorsChunk.size(), file) == colorsChunk.size();
+            offset += colorsChunk.size();
+        }
+
+        // A single node holding all the given points. Its children are left for the caller to fill in.
+        void WriteNode(const Vec3* positions, const Vec3* colors, size_t numPoints, const BuildNode& cell, uint32_t index,
+            const PointCloudWriteOptions& options)
+        {
+            std::vector<uint32_t> indices(numPoints);
+            std::iota(indices.begin(), indices.end(), 0u);
+            PointCloudNode& record = records[index];
+            EncodeNode(positions, colors, indices.data(), numPoints, options.compress, record, positionChunks[0], colorChunks[0]);
+            SetCell(record, cell);
+            WriteChunks(record, positionChunks[0], colorChunks[0]);
+        }
+
+        /*
+            Builds and writes the octree of points within cell, at most UINT32_MAX of them. Its root goes to
+            records[rootIndex] and the rest of its nodes are appended, keeping the children of each node contiguous.
+        */
+        void WriteSubtree(const Vec3* positions, const Vec3* colors, size_t numPoints, const BuildNode& cell, uint32_t rootIndex,
+            const PointCloudWriteOptions& options)
+        {
+            std::vector<uint32_t> order(numPoints);
+            std::iota(order.begin(), order.end(), 0u);
+            std::shuffle(order.begin(), order.end(), std::mt19937(12345));
+
+            std::vector<BuildNode> nodes = BuildOctree(positions, order, cell, options);
+
+            // Node i of the subtree, other than its root, goes to records[base + i].
+            const size_t base = records.size() - 1;
+            records.resize(base + nodes.size());
+            auto recordIndex = [&](size_t i) { return i == 0 ? rootIndex : (uint32_t)(base + i); };
+
+            for (size_t batchBegin = 0; ok && batchBegin < nodes.size(); batchBegin += EncodeBatchSize)
+            {
+                const size_t batchSize = std::min(EncodeBatchSize, nodes.size() - batchBegin);
+                ParallelFor(batchSize, ChooseWorkerCount(batchSize, 1), [&](size_t begin, size_t end, size_t)
+                {
+                    for (size_t i = begin; i < end; ++i)
+                    {
+                        const BuildNode& node = nodes[batchBegin + i];
+                        PointCloudNode& record = records[recordIndex(batchBegin + i)];
+                        EncodeNode(positions, colors, order.data() + node.begin, node.numOwnPoints, options.compress,
+                            record, positionChunks[i], colorChunks[i]);
+                        SetCell(record, node);
+                        record.firstChild = node.numChildren != 0 ? recordIndex(node.firstChild) : 0;
+                        record.numChildren = node.numChildren;
+                    }
+                });
+
+                for (size_t i = 0; ok && i < batchSize; ++i)
+                {
+                    WriteChunks(records[recordIndex(batchBegin + i)], positionChunks[i], colorChunks[i]);
+                }
+            }
+        }
+
+        // Fills in the rest of the header.
+        bool Finish(const char* path, PointCloudFileHeader& header)
+        {
+            memcpy(header.magic, Magic, sizeof(Magic));
+            header.version = PointCloudFileVersion;
+            header.numNodes = (uint32_t)records.size();
+
+            // Keep the node table aligned, so the reader can use it straight from the mapping.
+            const uint8_t padding[8] = {};
+            const size_t paddingSize = (8 - offset % 8) % 8;
+            ok = ok && fwrite(padding, 1, paddingSize, file) == paddingSize;
+            header.nodeTableOffset = offset + paddingSize;
+            ok = ok && fwrite(records.data(), sizeof(PointCloudNode), records.size(), file) == records.size();
+
+            ok = ok && fseek(file, 0, SEEK_SET) == 0;
+            ok = ok && fwrite(&header, sizeof(header), 1, file) == 1;
+            ok = (fclose(file) == 0) && ok;
+            file = nullptr;
+            if (!ok)
+            {
+                fprintf(stderr, "Failed to write %s\n", path);
+            }
+            return ok;
+        }
+    };
+
+    // Points waiting in a temporary file to be sorted into the octree. White if the source has no colors.
+    struct SpooledPoint
+    {
+        Vec3 position;
+        Vec3 color;
+    };
+    constexpr size_t SpoolBlockSize = 65536;
+
+    /*
+        Writes the subtree of a cell whose points are in a temporary file, and deletes the file. A cell with more points
+        than fit in memory keeps a random sample and spills the rest into a temporary file per octant, which are then
+        written the same way one after the other. Smaller cells are built in memory.
+    */
+    bool WriteSpooledCell(NodeWriter& writer, const std::string& path, size_t numPoints, bool hasColors, const BuildNode& cell,
+        uint32_t index, const PointCloudWriteOptions& options, std::mt19937_64& random)
+    {
+        FILE* file = fopen(path.c_str(), "rb");
+        if (file == nullptr)
+        {
+            fprintf(stderr, "Failed to open %s\n", path.c_str());
+            remove(path.c_str());
+            return false;
+        }
+        std::vector<SpooledPoint> block(std::min(numPoints, SpoolBlockSize));
+        size_t numRead = 0;
+        // Returns the number of points read into block, 0 once they're all read or on errors.
+        auto readBlock = [&]()
+        {
+            const size_t count = std::min(numPoints - numRead, block.size());
+            if (count == 0 || fread(block.data(), sizeof(SpooledPoint), count, file) != count)
+            {
+                return (size_t)0;
+            }
+            numRead += count;
+            return count;
+        };
+
+        const size_t maxPointsInMemory = std::max<size_t>(options.maxPointsInMemory, options.maxPointsPerNode);
+        if (numPoints <= maxPointsInMemory || cell.depth >= options.maxDepth)
+        {
+            if (numPoints > UINT32_MAX)
+            {
+                fprintf(stderr, "Can't write %zu points to a single octree cell\n", numPoints);
+                fclose(file);
+                remove(path.c_str());
+                return false;
+            }
+            std::vector<Vec3> positions(numPoints);
+            std::vector<Vec3> colors(hasColors ? numPoints : 0);
+            size_t first = numRead;
+            for (size_t count = readBlock(); count != 0; first = numRead, count = readBlock())
+            {
+                for (size_t i = 0; i < count; ++i)
+                {
+                    positions[first + i] = block[i].position;
+                    if (hasColors)
+                    {
+                        colors[first + i] = block[i].color;
+                    }
+                }
+            }
+            fclose(file);
+            remove(path.c_str());
+            if (numRead != numPoints)
+            {
+                fprintf(stderr, "Failed to read %s\n", path.c_str());
+                return false;
+            }
+            writer.WriteSubtree(positions.data(), hasColors ? colors.data() : nullptr, numPoints, cell, index, options);
+            return writer.ok;
+        }
+
+        // Reservoir sampling picks the node's own points in one pass, and everything it passes over goes to the octants.
+        std::vector<SpooledPoint> sample;
+        sample.reserve(options.maxPointsPerNode);
+        std::string childPaths[8];
+        FILE* childFiles[8] = {};
+        size_t childCounts[8] = {};
+        bool ok = true;
+        auto spill = [&](const SpooledPoint& point)
+        {
+            const int octant = GetOctant(cell, point.position);
+            if (childFiles[octant] == nullptr)
+            {
+                childPaths[octant] = path + (char)('0' + octant);
+                childFiles[octant] = fopen(childPaths[octant].c_str(), "wb");
+            }
+            ok = ok && childFiles[octant] != nullptr && fwrite(&point, sizeof(point), 1, childFiles[octant]) == 1;
+            childCounts[octant]++;
+        };
+
+        for (size_t first = numRead, count = readBlock(); ok && count != 0; first = numRead, count = readBlock())
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (sample.size() < options.maxPointsPerNode)
+                {
+                    sample.push_back(block[i]);
+                    continue;
+                }
+                const size_t slot = std::uniform_int_distribution<size_t>(0, first + i)(random);
+                if (slot < sample.size())
+                {
+                    spill(sample[slot]);
+                    sample[slot] = block[i];
+                }
+                else
+                {
+                    spill(block[i]);
+                }
+            }
+        }
+        ok = ok && numRead == numPoints;
+        fclose(file);
+        remove(path.c_str());
+        for (int o = 0; o < 8; ++o)
+        {
+            if (childFiles[o] != nullptr)
+            {
+                ok = (fclose(childFiles[o]) == 0) && ok;
+            }
+        }
+        if (!ok)
+        {
+            fprintf(stderr, "Failed to split %s into octants\n", path.c_str());
+            for (int o = 0; o < 8; ++o)
+            {
+                if (!childPaths[o].empty())
+                {
+                    remove(childPaths[o].c_str());
+                }
+            }
+            return false;
+        }
+
+        std::vector<Vec3> positions(sample.size());
+        std::vector<Vec3> colors(hasColors ? sample.size() : 0);
+        for (size_t i = 0; i < sample.size(); ++i)
+        {
+            positions[i] = sample[i].position;
+            if (hasColors)
+            {
+                colors[i] = sample[i].color;
+            }
+        }
+        writer.WriteNode(positions.data(), hasColors ? colors.data() : nullptr, sample.size(), cell, index, options);
+
+        const uint32_t firstChild = (uint32_t)writer.records.size();
+        uint8_t numChildren = 0;
+        for (int o = 0; o < 8; ++o)
+        {
+            numChildren += childCounts[o] != 0 ? 1 : 0;
+        }
+        writer.records[index].firstChild = firstChild;
+        writer.records[index].numChildren = numChildren;
+        writer.records.resize(firstChild + numChildren);
+
+        ok = writer.ok;
+        uint32_t child = firstChild;
+        for (int o = 0; o < 8; ++o)
+        {
+            if (childCounts[o] == 0)
+            {
+                continue;
+            }
+            if (ok)
+            {
+                ok = WriteSpooledCell(writer, childPaths[o], childCounts[o], hasColors, ChildCell(cell, o), child, options, random);
+            }
+            else
+            {
+                remove(childPaths[o].c_str());
+            }
+            child++;
+        }
+        return ok;
+    }
+
+    // Everything the loader produces goes straight to a temporary file, which is all the first pass keeps.
+    struct Spool
+    {
+        FILE* file{ nullptr };
+        size_t numPoints{ 0 };
+        bool hasColors{ false };
+        bool ok{ true };
+        Vec3 min;
+        Vec3 max;
+        std::vector<SpooledPoint> block;
+    };
+}
+
+bool WritePointCloudFile(const char* path, const Vec3* positions, const Vec3* colors, size_t numPoints, const PointCloudWriteOptions& options)
+{
+    if (!CanWrite(options))
+    {
+        return false;
+    }
+    if (numPoints == 0 || numPoints > UINT32_MAX)
+    {
+        fprintf(stderr, "Can't write a point cloud file of %zu points\n", numPoints);
+        return false;
+    }
+
+    Vec3 min = positions[0];
+    Vec3 max = min;
+    for (size_t i = 1; i < numPoints; ++i)
+    {
+        const Vec3& p = positions[i];
+        min = Vec3{ std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z) };
+        max = Vec3{ std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z) };
+    }
+
+    NodeWriter writer;
+    if (!writer.Open(path))
+    {
+        return false;
+    }
+    writer.records.resize(1);
+    writer.WriteSubtree(positions, colors, numPoints, RootCell(min, max), 0, options);
+
+    PointCloudFileHeader header{};
+    header.numPoints = numPoints;
+    header.flags = colors != nullptr ? (uint32_t)PointCloudFlags_HasColors : 0u;
+    header.boundsMin[0] = min.x; header.boundsMin[1] = min.y; header.boundsMin[2] = min.z;
+    header.boundsMax[0] = max.x; header.boundsMax[1] = max.y; header.boundsMax[2] = max.z;
+    return writer.Finish(path, header);
+}
+
+bool ConvertToPointCloudFile(const char* sourcePath, const char* destPath, const PointCloudWriteOptions& options)
+{
+    if (!CanWrite(options))
+    {
+        return false;
+    }
+    GeometryLoader loader;
+    if (!loader.Open(sourcePath))
+    {
+        return false;
+    }
+
+    const std::string spoolPath = std::string(destPath) + ".spool";
+    Spool spool;
+    spool.file = fopen(spoolPath.c_str(), "wb");
+    if (spool.file == nullptr)
+    {
+        fprintf(stderr, "Failed to open %s for writing\n", spoolPath.c_str());
+        return false;
+    }
+
+    while (spool.ok && !loader.GetProgress().done)
+    {
+        size_t before = spool.numPoints;
+        loader.Update([](const Vec3* positions, const Vec3* colors, size_t numVertices, const unsigned int*, size_t, void* userData)
+        {
+            Spool* spool = (Spool*)userData;
+            if (spool->numPoints == 0 && numVertices > 0)
+            {
+                spool->min = positions[0];
+                spool->max = positions[0];
+            }
+            spool->block.resize(numVertices);
+            for (size_t i = 0; i < numVertices; ++i)
+            {
+                const Vec3& p = positions[i];
+                spool->min = Vec3{ std::min(spool->min.x, p.x), std::min(spool->min.y, p.y), std::min(spool->min.z, p.z) };
+                spool->max = Vec3{ std::max(spool->max.x, p.x), std::max(spool->max.y, p.y), std::max(spool->max.z, p.z) };
+                spool->block[i] = SpooledPoint{ p, colors != nullptr ? colors[i] : Vec3{ 1.f, 1.f, 1.f } };
+            }
+            spool->hasColors = spool->hasColors || colors != nullptr;
+            spool->ok = spool->ok && fwrite(spool->block.data(), sizeof(SpooledPoint), numVertices, spool->file) == numVertices;
+            spool->numPoints += numVertices;
+        }, &spool);
+
+        if (spool.numPoints == before)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    spool.ok = (fclose(spool.file) == 0) && spool.ok;
+    spool.block = std::vector<SpooledPoint>();
+
+    if (!spool.ok || loader.GetProgress().failed || spool.numPoints == 0)
+    {
+        if (!spool.ok)
+        {
+            fprintf(stderr, "Failed to write %s\n", spoolPath.c_str());
+        }
+        else if (spool.numPoints == 0 && !loader.GetProgress().failed)
+        {
+            fprintf(stderr, "%s has no points\n", sourcePath);
+        }
+        remove(spoolPath.c_str());
+        return false;
+    }
+
+    NodeWriter writer;
+    if (!writer.Open(destPath))
+    {
+        remove(spoolPath.c_str());
+        return false;
+    }
+    writer.records.resize(1);
+    std::mt19937_64 random(12345);
+    if (!WriteSpooledCell(writer, spoolPath, spool.numPoints, spool.hasColors, RootCell(spool.min, spool.max), 0, options, random))
+    {
+        return false;
+    }
+
+    PointCloudFileHeader header{};
+    header.numPoints = spool.numPoints;
+    header.flags = spool.hasColors ? (uint32_t)PointCloudFlags_HasColors : 0u;
+    header.boundsMin[0] = spool.min.x; header.boundsMin[1] = spool.min.y; header.boundsMin[2] = spool.min.z;
+    header.boundsMax[0] = spool.max.x; header.boundsMax[1] = spool.max.y; header.boundsMax[2] = spool.max.z;
+    return writer.Finish(destPath, header);
+}
+
+struct PointCloudFile::Impl
+{
+    MappedFile file;
+    const PointCloudFileHeader* header{ nullptr };
+    const PointCloudNode* nodes{ nullptr };
+};
+
+PointCloudFile::PointCloudFile() : impl(std::make_unique<PointCloudFile::Impl>())
+{
+}
+
+PointCloudFile::~PointCloudFile() = default;
+
+bool PointCloudFile::Open(const char* path)
+{
+    Close();
+    if (!IsLittleEndianHost())
+    {
+        fprintf(stderr, "Point cloud files can only be read on little endian hosts\n");
+        return false;
+    }
+    if (!impl->file.Open(path))
+    {
+        return false;
+    }
+
+    const char* data = impl->file.GetData();
+    const size_t size = impl->file.GetSize();
+    const PointCloudFileHeader* header = (const PointCloudFileHeader*)data;
+    if (size < sizeof(PointCloudFileHeader) || memcmp(header->magic, Magic, sizeof(Magic)) != 0)
+    {
+        fprintf(stderr, "%s is not a point cloud file\n", path);
+        Close();
+        return false;
+    }
+    if (header->version != PointCloudFileVersion)
+    {
+        fprintf(stderr, "%s has unsupported version %u\n", path, header->version);
+        Close();
+        return false;
+    }
+    if (header->nodeTableOffset % 8 != 0 || header->nodeTableOffset > size
+        || (size - header->nodeTableOffset) / sizeof(PointCloudNode) < header->numNodes)
+    {
+        fprintf(stderr, "%s has a corrupt node table\n", path);
+        Close();
+        return false;
+    }
+    // Children come after their parents and within the table, so traversals from the root always end.
+    const PointCloudNode* nodes = (const PointCloudNode*)(data + header->nodeTableOffset);
+    for (uint32_t i = 0; i < header->numNodes; ++i)
+    {
+        const PointCloudNode& node = nodes[i];
+        if (node.numChildren != 0
+            && (node.firstChild <= i || (uint64_t)node.firstChild + node.numChildren > header->numNodes))
+        {
+            fprintf(stderr, "%s has a corrupt node table, node %u has children out of range\n", path, i);
+            Close();
+            return false;
+        }
+    }
+
+    impl->header = header;
+    impl->nodes = nodes;
+    return true;
+}
+
+void PointCloudFile::Close()
+{
+    impl->file.Close();
+    impl->header = nullptr;
+    impl->nodes = nullptr;
+}
+
+const PointCloudFileHeader* PointCloudFile::GetHeader() const
+{
+    return impl->header;
+}
+
+const PointCloudNode* PointCloudFile::GetNodes() const
+{
+    return impl->nodes;
+}
+
+uint32_t PointCloudFile::GetNodeCount() const
+{
+    return impl->header != nullptr ? impl->header->numNodes : 0;
+}
+
+bool PointCloudFile::LoadNode(uint32_t index, std::vector<Vec3>& positions, std::vector<Vec3>& colors) const
+{
+    if (index >= GetNodeCount())
+    {
+        return false;
+    }
+    const PointCloudNode& node = impl->nodes[index];
+    const size_t count = node.numPoints;
+    const char* data = impl->file.GetData();
+    const size_t size = impl->file.GetSize();
+
+    std::vector<uint8_t> scratch;
+    const uint8_t* columns = GetColumnBytes(data, size, node.positionsOffset, node.positionsSize,
+        (node.compression & PointCloudCompression_Positions) != 0, count * 6, scratch);
+    if (columns == nullptr)
+    {
+        fprintf(stderr, "Point cloud node %u is corrupt\n", index);
+        return false;
+    }
+
+    positions.resize(count);
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const uint8_t* low = columns + axis * 2 * count;
+        const uint8_t* high = low + count;
+        const float min = node.boundsMin[axis];
+        const float step = (node.boundsMax[axis] - min) / 65535.f;
+        float* out = &positions[0].x + axis;
+        uint16_t value = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            value = (uint16_t)(value + (low[i] | (high[i] << 8)));
+            out[i * 3] = min + value * step;
+        }
+    }
+
+    colors.clear();
+    if ((impl->header->flags & PointCloudFlags_HasColors) != 0)
+    {
+        columns = GetColumnBytes(data, size, node.colorsOffset, node.colorsSize,
+            (node.compression & PointCloudCompression_Colors) != 0, count * 3, scratch);
+        if (columns == nullptr)
+        {
+            fprintf(stderr, "Point cloud node %u is corrupt\n", index);
+            return false;
+        }
+        colors.resize(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            colors[i] = Vec3{ columns[i] / 255.f, columns[count + i] / 255.f, columns[2 * count + i] / 255.f };
+        }
+    }
+    return true;
+}
@@ -0,0 +1,375 @@
+#include "PointCloudRenderer.h"
+#include "Util.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    constexpr int NumLoaderThreads = 2;
+    // Caps the upload cost of a single frame.
+    constexpr size_t MaxUploadBytesPerFrame = 32 << 20;
+    // Nodes are only evicted once this many times the point budget is loaded.
+    constexpr size_t LoadedPointsPerBudget = 2;
+
+    enum class NodeState : uint8_t
+    {
+        Unloaded,
+        Requested,
+        Loaded,
+        Failed      // Couldn't be decoded, and isn't asked for again.
+    };
+
+    struct NodeSlot
+    {
+        NodeState state{ NodeState::Unloaded };
+        View3d::BufferHandle buffer{ 0 };
+        uint32_t numPoints{ 0 };    // As uploaded, which is what eviction takes back off loadedPoints.
+        uint64_t lastDrawnFrame{ 0 };
+    };
+
+    struct LoadedNode
+    {
+        uint32_t node;
+        bool failed;
+        std::vector<Vec3> positions;
+        std::vector<Vec3> colors;
+    };
+
+    struct Plane
+    {
+        float x, y, z, w;
+    };
+
+    // Frustum planes of a column-major clip-from-world matrix, normalized so distances come out in world units.
+    void ExtractFrustumPlanes(const float m[16], Plane planes[6])
+    {
+        const Plane rowX{ m[0], m[4], m[8], m[12] };
+        const Plane rowY{ m[1], m[5], m[9], m[13] };
+        const Plane rowZ{ m[2], m[6], m[10], m[14] };
+        const Plane rowW{ m[3], m[7], m[11], m[15] };
+        const Plane* rows[3] = { &rowX, &rowY, &rowZ };
+        for (int i = 0; i < 3; ++i)
+        {
+            const Plane& r = *rows[i];
+            planes[2 * i] = Plane{ rowW.x + r.x, rowW.y + r.y, rowW.z + r.z, rowW.w + r.w };
+            planes[2 * i + 1] = Plane{ rowW.x - r.x, rowW.y - r.y, rowW.z - r.z, rowW.w - r.w };
+        }
+        for (int i = 0; i < 6; ++i)
+        {
+            Plane& p = planes[i];
+            float length = sqrtf(p.x * p.x + p.y * p.y + p.z * p.z);
+            if (length > 0.f)
+            {
+                p = Plane{ p.x / length, p.y / length, p.z / length, p.w / length };
+            }
+        }
+    }
+}
+
+struct PointCloudRenderer::Impl
+{
+    PointCloudFile file;
+    std::vector<NodeSlot> slots;
+    View3d* view{ nullptr };
+    uint64_t frame{ 0 };
+
+    size_t pointBudget{ 10 * 1000 * 1000 };
+    float minNodePixelSize{ 200.f };
+    size_t drawnPoints{ 0 };
+    size_t loadedPoints{ 0 };
+
+    std::vector<std::thread> loaders;
+    std::mutex mutex;
+    std::condition_variable requestsChanged;
+    std::vector<uint32_t> requests; // Most important last.
+    std::vector<LoadedNode> finished;
+    bool stopping{ false };
+
+    ~Impl()
+    {
+        Shutdown();
+    }
+
+    void Shutdown()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        requestsChanged.notify_all();
+        for (auto& loader : loaders)
+        {
+            loader.join();
+        }
+        loaders.clear();
+
+        if (view != nullptr)
+        {
+            for (NodeSlot& slot : slots)
+            {
+                view->DestroyBuffer(slot.buffer);
+            }
+        }
+        slots.clear();
+        requests.clear();
+        finished.clear();
+        stopping = false;
+        loadedPoints = 0;
+    }
+
+    void LoaderLoop()
+    {
+        for (;;)
+        {
+            uint32_t node;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                requestsChanged.wait(lock, [&]() { return stopping || !requests.empty(); });
+                if (stopping)
+                {
+                    return;
+                }
+                node = requests.back();
+                requests.pop_back();
+            }
+
+            LoadedNode loaded;
+            loaded.node = node;
+            loaded.failed = !file.LoadNode(node, loaded.positions, loaded.colors);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.push_back(std::move(loaded));
+        }
+    }
+
+    void UploadFinishedNodes()
+    {
+        std::vector<LoadedNode> ready;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ready.swap(finished);
+        }
+
+        size_t uploaded = 0;
+        for (size_t i = 0; i < ready.size(); ++i)
+        {
+            LoadedNode& loaded = ready[i];
+            const size_t bytes = (loaded.positions.size() + loaded.colors.size()) * sizeof(Vec3);
+            if (uploaded > 0 && uploaded + bytes > MaxUploadBytesPerFrame)
+            {
+                // Put the rest back for the next frame.
+                std::lock_guard<std::mutex> lock(mutex);
+                finished.insert(finished.end(), std::make_move_iterator(ready.begin() + i), std::make_move_iterator(ready.end()));
+                break;
+            }
+            uploaded += bytes;
+
+            NodeSlot& slot = slots[loaded.node];
+            if (loaded.failed)
+            {
+                slot.state = NodeState::Failed;
+                continue;
+            }
+            slot.buffer = view->CreateBuffer();
+            view->AppendVertices(slot.buffer, loaded.positions.data(), loaded.colors.empty() ? nullptr : loaded.colors.data(), loaded.positions.size());
+            slot.state = NodeState::Loaded;
+            slot.numPoints = (uint32_t)loaded.positions.size();
+            loadedPoints += slot.numPoints;
+        }
+    }
+
+    void EvictUnusedNodes()
+    {
+        const size_t limit = pointBudget * LoadedPointsPerBudget;
+        if (loadedPoints <= limit)
+        {
+            return;
+        }
+
+        std::vector<uint32_t> candidates;
+        for (uint32_t i = 0; i < (uint32_t)slots.size(); ++i)
+        {
+            if (slots[i].state == NodeState::Loaded && slots[i].lastDrawnFrame != frame)
+            {
+                candidates.push_back(i);
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(), [&](uint32_t a, uint32_t b) { return slots[a].lastDrawnFrame < slots[b].lastDrawnFrame; });
+
+        for (size_t i = 0; i < candidates.size() && loadedPoints > limit; ++i)
+        {
+            NodeSlot& slot = slots[candidates[i]];
+            view->DestroyBuffer(slot.buffer);
+            loadedPoints -= slot.numPoints;
+            slot = NodeSlot{};
+        }
+    }
+};
+
+PointCloudRenderer::PointCloudRenderer() : impl(std::make_unique<PointCloudRenderer::Impl>())
+{
+}
+
+PointCloudRenderer::~PointCloudRenderer() = default;
+
+bool PointCloudRenderer::Open(const char* path)
+{
+    impl->Shutdown();
+    if (!impl->file.Open(path))
+    {
+        return false;
+    }
+    impl->slots.resize(impl->file.GetNodeCount());
+    for (int i = 0; i < NumLoaderThreads; ++i)
+    {
+        impl->loaders.emplace_back([impl = impl.get()]() { impl->LoaderLoop(); });
+    }
+    return true;
+}
+
+void PointCloudRenderer::Draw(View3d& view)
+{
+    if (impl->file.GetNodeCount() == 0)
+    {
+        return;
+    }
+    impl->view = &view;
+    impl->frame++;
+    impl->UploadFinishedNodes();
+
+    float cameraFromWorld[16];
+    float clipFromCamera[16];
+    float clipFromWorld[16];
+    view.GetCameraMatrices(cameraFromWorld, clipFromCamera);
+    MultiplyMatrices(clipFromCamera, cameraFromWorld, clipFromWorld);
+    Plane planes[6];
+    ExtractFrustumPlanes(clipFromWorld, planes);
+    // Pixels per world unit at unit depth.
+    const float focalPixels = clipFromCamera[5] * 0.5f * view.GetFramebufferSize().y;
+
+    const PointCloudNode* nodes = impl->file.GetNodes();
+    auto projectedSize = [&](const PointCloudNode& node)
+    {
+        const float* c = node.cellCenter;
+        float w = clipFromWorld[3] * c[0] + clipFromWorld[7] * c[1] + clipFromWorld[11] * c[2] + clipFromWorld[15];
+        // Close enough to touch the camera: as big as it gets.
+        if (w <= node.cellRadius)
+        {
+            return 1e30f;
+        }
+        return 2.f * node.cellRadius * focalPixels / w;
+    };
+    auto isVisible = [&](const PointCloudNode& node)
+    {
+        for (const Plane& p : planes)
+        {
+            if (p.x * node.cellCenter[0] + p.y * node.cellCenter[1] + p.z * node.cellCenter[2] + p.w < -node.cellRadius)
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    // Biggest on screen first. Parents always come before their children, since a child's cell is half the size.
+    using Candidate = std::pair<float, uint32_t>;
+    std::priority_queue<Candidate> queue;
+    if (isVisible(nodes[0]))
+    {
+        queue.push(Candidate(projectedSize(nodes[0]), 0));
+    }
+
+    std::vector<uint32_t> wanted;
+    size_t budgetUsed = 0;
+    impl->drawnPoints = 0;
+    while (!queue.empty())
+    {
+        const Candidate candidate = queue.top();
+        queue.pop();
+        const PointCloudNode& node = nodes[candidate.second];
+        if (budgetUsed + node.numPoints > impl->pointBudget)
+        {
+            break;
+        }
+        budgetUsed += node.numPoints;
+
+        NodeSlot& slot = impl->slots[candidate.second];
+        if (slot.state == NodeState::Loaded)
+        {
+            view.DrawBuffer(slot.buffer);
+            slot.lastDrawnFrame = impl->frame;
+            impl->drawnPoints += slot.numPoints;
+        }
+        else
+        {
+            wanted.push_back(candidate.second);
+        }
+
+        if (candidate.first < impl->minNodePixelSize)
+        {
+            continue;
+        }
+        for (uint32_t child = node.firstChild; child < node.firstChild + node.numChildren; ++child)
+        {
+            if (isVisible(nodes[child]))
+            {
+                queue.push(Candidate(projectedSize(nodes[child]), child));
+            }
+        }
+    }
+
+    // Replace last frame's requests, keeping only what this frame still wants.
+    {
+        std::lock_guard<std::mutex> lock(impl->mutex);
+        for (uint32_t node : impl->requests)
+        {
+            impl->slots[node].state = NodeState::Unloaded;
+        }
+        impl->requests.clear();
+        for (auto it = wanted.rbegin(); it != wanted.rend(); ++it)
+        {
+            NodeSlot& slot = impl->slots[*it];
+            // Nodes being decoded right now are neither in the queue nor loaded yet.
+            if (slot.state == NodeState::Unloaded)
+            {
+                slot.state = NodeState::Requested;
+                impl->requests.push_back(*it);
+            }
+        }
+    }
+    impl->requestsChanged.notify_all();
+
+    impl->EvictUnusedNodes();
+}
+
+void PointCloudRenderer::SetPointBudget(size_t numPoints)
+{
+    impl->pointBudget = numPoints;
+}
+
+void PointCloudRenderer::SetMinNodePixelSize(float pixels)
+{
+    impl->minNodePixelSize = pixels;
+}
+
+size_t PointCloudRenderer::GetDrawnPointCount() const
+{
+    return impl->drawnPoints;
+}
+
+size_t PointCloudRenderer::GetLoadedPointCount() const
+{
+    return impl->loadedPoints;
+}
+
+const PointCloudFile& PointCloudRenderer::GetFile() const
+{
+    return impl->file;
+}
@@ -0,0 +1,241 @@
+#include "PointDensity.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IM3D_HAS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    // Below this, spinning up threads costs more than it saves.
+    constexpr size_t MinPointsPerWorker = 256 * 1024;
+    constexpr size_t MinPixelsPerWorker = 64 * 1024;
+    constexpr int EqualizationBins = 1024;
+
+    void BinPointScalar(const Vec3& p, const float m[16], float halfWidth, float halfHeight, int width, int height, uint32_t* grid)
+    {
+        float cx = m[0] * p.x + m[4] * p.y + m[8] * p.z + m[12];
+        float cy = m[1] * p.x + m[5] * p.y + m[9] * p.z + m[13];
+        float cz = m[2] * p.x + m[6] * p.y + m[10] * p.z + m[14];
+        float cw = m[3] * p.x + m[7] * p.y + m[11] * p.z + m[15];
+
+        // Written so that NaNs fail the test.
+        if (!(cw > 0.f && cx >= -cw && cx <= cw && cy >= -cw && cy <= cw && cz >= -cw && cz <= cw))
+        {
+            return;
+        }
+
+        float invW = 1.f / cw;
+        int px = std::min((int)(cx * invW * halfWidth + halfWidth), width - 1);
+        int py = std::min((int)(cy * invW * halfHeight + halfHeight), height - 1);
+        grid[(size_t)py * width + px]++;
+    }
+
+    void BinPoints(const Vec3* points, size_t numPoints, const float m[16], int width, int height, uint32_t* grid)
+    {
+        const float halfWidth = 0.5f * width;
+        const float halfHeight = 0.5f * height;
+        size_t i = 0;
+
+#if IM3D_HAS_SSE2
+        const __m128 m0 = _mm_set1_ps(m[0]), m1 = _mm_set1_ps(m[1]), m2 = _mm_set1_ps(m[2]), m3 = _mm_set1_ps(m[3]);
+        const __m128 m4 = _mm_set1_ps(m[4]), m5 = _mm_set1_ps(m[5]), m6 = _mm_set1_ps(m[6]), m7 = _mm_set1_ps(m[7]);
+        const __m128 m8 = _mm_set1_ps(m[8]), m9 = _mm_set1_ps(m[9]), m10 = _mm_set1_ps(m[10]), m11 = _mm_set1_ps(m[11]);
+        const __m128 m12 = _mm_set1_ps(m[12]), m13 = _mm_set1_ps(m[13]), m14 = _mm_set1_ps(m[14]), m15 = _mm_set1_ps(m[15]);
+        const __m128 hw = _mm_set1_ps(halfWidth);
+        const __m128 hh = _mm_set1_ps(halfHeight);
+        const __m128i maxX = _mm_set1_epi32(width - 1);
+        const __m128i maxY = _mm_set1_epi32(height - 1);
+        const __m128i rowStride = _mm_set1_epi32(width);
+
+        alignas(16) int32_t pixelIndex[4];
+        for (; i + 4 <= numPoints; i += 4)
+        {
+            // Four packed Vec3s, transposed to x, y and z lanes.
+            const float* f = &points[i].x;
+            __m128 a = _mm_loadu_ps(f);
+            __m128 b = _mm_loadu_ps(f + 4);
+            __m128 c = _mm_loadu_ps(f + 8);
+            __m128 x = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+            __m128 y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+            __m128 z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+
+            __m128 cx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, x), _mm_mul_ps(m4, y)), _mm_add_ps(_mm_mul_ps(m8, z), m12));
+            __m128 cy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m1, x), _mm_mul_ps(m5, y)), _mm_add_ps(_mm_mul_ps(m9, z), m13));
+            __m128 cz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m2, x), _mm_mul_ps(m6, y)), _mm_add_ps(_mm_mul_ps(m10, z), m14));
+            __m128 cw = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m3, x), _mm_mul_ps(m7, y)), _mm_add_ps(_mm_mul_ps(m11, z), m15));
+
+            __m128 negW = _mm_sub_ps(_mm_setzero_ps(), cw);
+            __m128 inside = _mm_cmpgt_ps(cw, _mm_setzero_ps());
+            inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmpge_ps(cx, negW), _mm_cmple_ps(cx, cw)));
+            inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmpge_ps(cy, negW), _mm_cmple_ps(cy, cw)));
+            inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmpge_ps(cz, negW), _mm_cmple_ps(cz, cw)));
+            int mask = _mm_movemask_ps(inside);
+            if (mask == 0)
+            {
+                continue;
+            }
+
+            __m128 invW = _mm_div_ps(_mm_set1_ps(1.f), cw);
+            __m128i px = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(cx, invW), hw), hw));
+            __m128i py = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(cy, invW), hh), hh));
+            // x == w lands one past the last pixel. SSE2 has no integer min, so select with a compare.
+            __m128i overX = _mm_cmpgt_epi32(px, maxX);
+            px = _mm_or_si128(_mm_and_si128(overX, maxX), _mm_andnot_si128(overX, px));
+            __m128i overY = _mm_cmpgt_epi32(py, maxY);
+            py = _mm_or_si128(_mm_and_si128(overY, maxY), _mm_andnot_si128(overY, py));
+
+            // row * width, from the even and odd lanes' 64 bit products.
+            __m128i rowEven = _mm_mul_epu32(py, rowStride);
+            __m128i rowOdd = _mm_mul_epu32(_mm_srli_si128(py, 4), rowStride);
+            __m128i row = _mm_unpacklo_epi32(_mm_shuffle_epi32(rowEven, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(rowOdd, _MM_SHUFFLE(0, 0, 2, 0)));
+            _mm_store_si128((__m128i*)pixelIndex, _mm_add_epi32(row, px));
+
+            // No scatter in SSE, the increments stay scalar.
+            for (int lane = 0; lane < 4; ++lane)
+            {
+                if (mask & (1 << lane))
+                {
+                    grid[(uint32_t)pixelIndex[lane]]++;
+                }
+            }
+        }
+#endif
+
+        for (; i < numPoints; ++i)
+        {
+            BinPointScalar(points[i], m, halfWidth, halfHeight, width, height, grid);
+        }
+    }
+}
+
+void PointDensityGrid::Resize(int w, int h)
+{
+    if (w == width && h == height)
+    {
+        return;
+    }
+    width = w;
+    height = h;
+    counts.assign((size_t)width * height, 0);
+    workerCounts.clear();
+    pointsBinned = 0;
+}
+
+void PointDensityGrid::Clear()
+{
+    std::fill(counts.begin(), counts.end(), 0);
+    pointsBinned = 0;
+}
+
+void PointDensityGrid::Accumulate(const Vec3* points, size_t numPoints, const float clipFromWorld[16])
+{
+    if (counts.empty() || numPoints == 0)
+    {
+        return;
+    }
+    pointsBinned += numPoints;
+
+    const size_t numWorkers = ChooseWorkerCount(numPoints, MinPointsPerWorker);
+    if (numWorkers == 1)
+    {
+        BinPoints(points, numPoints, clipFromWorld, width, height, counts.data());
+        return;
+    }
+
+    // Worker 0 bins straight into the result, the others into their own grids.
+    if (workerCounts.size() < numWorkers - 1)
+    {
+        workerCounts.resize(numWorkers - 1);
+    }
+    for (size_t i = 0; i < numWorkers - 1; ++i)
+    {
+        workerCounts[i].resize(counts.size(), 0);
+    }
+
+    ParallelFor(numPoints, numWorkers, [&](size_t begin, size_t end, size_t worker)
+    {
+        uint32_t* grid = worker == 0 ? counts.data() : workerCounts[worker - 1].data();
+        BinPoints(points + begin, end - begin, clipFromWorld, width, height, grid);
+    });
+
+    // Sum the grids into the result, zeroing them for the next call as we go.
+    const size_t numGrids = numWorkers - 1;
+    ParallelFor(counts.size(), ChooseWorkerCount(counts.size(), MinPixelsPerWorker), [&](size_t begin, size_t end, size_t)
+    {
+        for (size_t g = 0; g < numGrids; ++g)
+        {
+            uint32_t* grid = workerCounts[g].data();
+            for (size_t i = begin; i < end; ++i)
+            {
+                counts[i] += grid[i];
+            }
+            memset(grid + begin, 0, (end - begin) * sizeof(uint32_t));
+        }
+    });
+}
+
+void PointDensityGrid::Shade(DensityScale scale, float* out) const
+{
+    const size_t numPixels = counts.size();
+    const uint32_t maxCount = numPixels == 0 ? 0 : *std::max_element(counts.begin(), counts.end());
+    if (maxCount == 0)
+    {
+        memset(out, 0, numPixels * sizeof(float));
+        return;
+    }
+
+    const float invLogMax = 1.f / logf(1.f + (float)maxCount);
+    const size_t numWorkers = ChooseWorkerCount(numPixels, MinPixelsPerWorker);
+
+    if (scale == DensityScale::Log)
+    {
+        ParallelFor(numPixels, numWorkers, [&](size_t begin, size_t end, size_t)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                out[i] = logf(1.f + (float)counts[i]) * invLogMax;
+            }
+        });
+        return;
+    }
+
+    // Equalization over a histogram of log densities, so a handful of hot pixels can't squash the rest.
+    auto binOf = [&](uint32_t count)
+    {
+        int bin = (int)(logf(1.f + (float)count) * invLogMax * (EqualizationBins - 1));
+        return std::min(std::max(bin, 0), EqualizationBins - 1);
+    };
+
+    std::vector<size_t> histogram(EqualizationBins, 0);
+    size_t numNonEmpty = 0;
+    for (size_t i = 0; i < numPixels; ++i)
+    {
+        if (counts[i] != 0)
+        {
+            histogram[binOf(counts[i])]++;
+            numNonEmpty++;
+        }
+    }
+
+    std::vector<float> cdf(EqualizationBins);
+    size_t running = 0;
+    for (int bin = 0; bin < EqualizationBins; ++bin)
+    {
+        running += histogram[bin];
+        cdf[bin] = (float)running / (float)numNonEmpty;
+    }
+
+    ParallelFor(numPixels, numWorkers, [&](size_t begin, size_t end, size_t)
+    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            out[i] = counts[i] == 0 ? 0.f : cdf[binOf(counts[i])];
+        }
+    });
+}
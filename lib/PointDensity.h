@@ -0,0 +1,36 @@
+#pragma once
+#include "Im3D.h"
+#include <cstdint>
+#include <vector>
+
+/*
+    Screen-space density aggregation for very large point sets.
+    Points are projected with a clip-from-world matrix and counted per pixel. Large inputs are split
+    across threads, each binning into its own grid, and the grids are summed at the end.
+    Rows are stored bottom to top, matching OpenGL's framebuffer layout.
+*/
+class PointDensityGrid
+{
+public:
+    void Resize(int width, int height);
+    void Clear();
+
+    // Adds the projections of the points to the grid. clipFromWorld is column-major, as passed to OpenGL.
+    void Accumulate(const Vec3* points, size_t numPoints, const float clipFromWorld[16]);
+
+    // Maps counts to intensities in [0,1] for colormapping. Empty pixels map to 0, every other pixel to more than 0.
+    void Shade(DensityScale scale, float* out) const;
+
+    int GetWidth() const { return width; }
+    int GetHeight() const { return height; }
+    const uint32_t* GetCounts() const { return counts.data(); }
+    size_t GetPointsBinned() const { return pointsBinned; }
+
+private:
+    int width{ 0 };
+    int height{ 0 };
+    size_t pointsBinned{ 0 };
+    std::vector<uint32_t> counts;
+    // Per-worker grids, kept around between frames. Always zeroed when not in use.
+    std::vector<std::vector<uint32_t>> workerCounts;
+};
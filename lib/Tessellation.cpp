@@ -0,0 +1,36 @@
+#include "Tessellation.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    float SecondDifferenceLength(const Vec3& a, const Vec3& b, const Vec3& c)
+    {
+        const float x = a.x - 2.f * b.x + c.x;
+        const float y = a.y - 2.f * b.y + c.y;
+        const float z = a.z - 2.f * b.z + c.z;
+        return sqrtf(x * x + y * y + z * z);
+    }
+}
+
+int GetCircleSegments(float radiusPixels, float tolerancePixels)
+{
+    if (!(radiusPixels > tolerancePixels))
+    {
+        return MinCircleSegments;
+    }
+    // A chord spanning angle a is r(1 - cos(a/2)) from the circle at its middle.
+    const float maxAngle = 2.f * acosf(1.f - tolerancePixels / radiusPixels);
+    const float segments = ceilf(2.f * 3.14159265f / maxAngle);
+    return (int)std::min(std::max(segments, (float)MinCircleSegments), (float)MaxCircleSegments);
+}
+
+int GetBezierSegments(const Vec3& p0, const Vec3& p1, const Vec3& p2, const Vec3& p3, float pixelsPerUnit, float tolerancePixels)
+{
+    // Wang's formula: n segments keep a cubic within 3/4 * M / n^2 of its chords,
+    // M being the largest second difference of the control points.
+    const float m = std::max(SecondDifferenceLength(p0, p1, p2), SecondDifferenceLength(p1, p2, p3)) * pixelsPerUnit;
+    const float segments = ceilf(sqrtf(0.75f * m / tolerancePixels));
+    return (int)std::min(std::max(segments, 1.f), (float)MaxBezierSegments);
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include "Im3D.h"
+
+/*
+    Segment counts for curved primitives, chosen so the polyline drawn strays at most tolerancePixels from the
+    true curve on screen. Sizes are given in pixels, already projected with the camera, so distant primitives get
+    few segments and close ones get many.
+*/
+
+constexpr int MinCircleSegments = 8;
+constexpr int MaxCircleSegments = 1024;
+constexpr int MaxBezierSegments = 256;
+
+// For a full circle of the given radius. An arc needs the fraction of this its angle covers.
+int GetCircleSegments(float radiusPixels, float tolerancePixels);
+
+// For a cubic Bezier curve. pixelsPerUnit converts the control points' world units to pixels.
+int GetBezierSegments(const Vec3& p0, const Vec3& p1, const Vec3& p2, const Vec3& p3, float pixelsPerUnit, float tolerancePixels);
@@ -0,0 +1,27 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+
+/*
+    Small helpers shared by the library's translation units.
+*/
+
+// out = a * b, all column-major.
+inline void MultiplyMatrices(const float a[16], const float b[16], float out[16])
+{
+    for (int col = 0; col < 4; ++col)
+    {
+        for (int row = 0; row < 4; ++row)
+        {
+            out[col * 4 + row] = a[row] * b[col * 4] + a[4 + row] * b[col * 4 + 1] + a[8 + row] * b[col * 4 + 2] + a[12 + row] * b[col * 4 + 3];
+        }
+    }
+}
+
+inline bool IsLittleEndianHost()
+{
+    const uint16_t probe = 1;
+    unsigned char first;
+    memcpy(&first, &probe, 1);
+    return first == 1;
+}
@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdint>
 #include <memory>
 
 /*
@@ -8,10 +9,49 @@
     including APIs for input and rendering.
 */
 
-struct AppContext
+enum class VsyncMode
 {
+    Off,
+    On,
+    Adaptive    // Syncs when on time and tears rather than waiting a whole refresh when late. Falls back to On where unsupported.
+};
 
+struct FramePacingSettings
+{
+    VsyncMode vsync{ VsyncMode::On };
+    float targetFps{ 0.f };             // Frame rate cap, on top of vsync. Zero for none.
+    float lateFrameTolerance{ 0.25f };  // How far past its deadline a frame may run, as a fraction of the frame interval, before it counts as late.
+};
+
+constexpr int FrameTimeHistogramBins = 64;
+constexpr float FrameTimeHistogramBinMs = 0.5f; // The last bin also counts every longer frame.
+constexpr int RecentFrameCount = 256;
+
+struct FrameStats
+{
+    uint64_t frameCount{ 0 };
+    float frameTimeMs{ 0.f };       // Between the last two swaps returning, which is how often frames are presented.
+    float cpuTimeMs{ 0.f };         // The last frame's work, from polling input up to the swap. Neither the frame rate cap nor waiting for vsync counts.
+    float inputLatencyMs{ 0.f };    // From polling input to the swap that presents the result returning.
+    float averageFrameTimeMs{ 0.f };
+    float averageInputLatencyMs{ 0.f };
 
+    // A frame is late when it misses the deadline set by the frame rate cap, or the display refresh with vsync.
+    bool lastFrameLate{ false };
+    uint64_t lateFrames{ 0 };
+
+    VsyncMode activeVsync{ VsyncMode::On }; // What the driver is actually doing, see VsyncMode::Adaptive.
+    float refreshRate{ 0.f };
+
+    uint32_t frameTimeHistogram[FrameTimeHistogramBins]{};
+    float recentFrameTimesMs[RecentFrameCount]{}; // Ring buffer, the latest at recentFrameOffset - 1.
+    int recentFrameOffset{ 0 };
+};
+
+struct AppContext
+{
+    FramePacingSettings* pacing{ nullptr }; // Changes apply from the next frame on.
+    const FrameStats* frameStats{ nullptr };
 };
 
 using AppLoopFn = void(*)(const AppContext* ctx, void* userData);
@@ -23,6 +63,7 @@ struct AppCreationInfo
     int initialWidth{1280};
     int initialHeight{720};
     const char* title;
+    FramePacingSettings pacing{};
 };
 
 class Application
@@ -0,0 +1,37 @@
+#pragma once
+#include "Im3D.h"
+#include <cstddef>
+
+/*
+    Batch geometry kernels, for preparing large data sets for View3d: moving scans into the world frame,
+    framing the camera on a bounding box, shading meshes with normals.
+    Each call is vectorized with AVX2 and FMA when the CPU has them, checked once at runtime, and SSE2 otherwise,
+    and inputs large enough to be worth it are split across threads. Outputs may be the same arrays as the inputs.
+    Matrices are column-major 4x4, as passed to OpenGL.
+*/
+
+// A unit quaternion, w being the scalar part.
+struct Quat
+{
+    float x, y, z, w;
+};
+
+// Transforms points by an affine matrix. The matrix's bottom row is ignored, so there's no perspective divide.
+void TransformPoints(const float matrix[16], const Vec3* points, Vec3* out, size_t numPoints);
+// The same for points stored as separate x, y and z arrays.
+void TransformPoints(const float matrix[16], const float* x, const float* y, const float* z, float* outX, float* outY, float* outZ, size_t numPoints);
+
+// Axis-aligned bounds. With no points, boundsMin is FLT_MAX and boundsMax is -FLT_MAX.
+void ComputeBounds(const Vec3* points, size_t numPoints, Vec3& boundsMin, Vec3& boundsMax);
+void ComputeBounds(const float* x, const float* y, const float* z, size_t numPoints, Vec3& boundsMin, Vec3& boundsMax);
+
+// Area weighted vertex normals of an indexed triangle mesh. Vertices no triangle uses get zero normals.
+void ComputeNormals(const Vec3* positions, size_t numVertices, const unsigned int* indices, size_t numIndices, Vec3* normals);
+
+// Rotates every vector by the same quaternion.
+void QuaternionRotateBatch(const Quat& rotation, const Vec3* vectors, Vec3* out, size_t numVectors);
+// Rotates each vector by its own quaternion.
+void QuaternionRotateBatch(const Quat* rotations, const Vec3* vectors, Vec3* out, size_t numVectors);
+
+// The instruction set the kernels run with on this machine: "AVX2", "SSE2" or "scalar".
+const char* GetGeometryKernelIsa();
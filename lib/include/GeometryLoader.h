@@ -0,0 +1,63 @@
+#pragma once
+#include "Im3D.h"
+#include <memory>
+
+/*
+    Streaming loaders for point clouds and meshes on disk, feeding a View3d retained buffer.
+    Supported formats:
+        .ply                    ASCII, binary little endian and binary big endian. Vertex colors and faces are read if present.
+        .obj                    Vertices (with the common "v x y z r g b" color extension) and faces. Everything else is skipped.
+        .xyz, .txt, .pts, .csv  One point per line: x y z, optionally followed by r g b.
+        .bin, .raw              Packed little endian float32 x y z triples.
+
+    The file is memory mapped and parsed on worker threads in chunks, while the thread owning the GL context
+    uploads whatever is ready by calling Update() once per frame. Data shows up in the view as it loads.
+*/
+
+struct LoadProgress
+{
+    size_t bytesTotal{ 0 };
+    size_t bytesParsed{ 0 };
+    size_t verticesUploaded{ 0 };
+    size_t trianglesUploaded{ 0 };
+    bool done{ false };
+    bool failed{ false };
+
+    float GetFraction() const { return bytesTotal == 0 ? 0.f : (float)bytesParsed / (float)bytesTotal; }
+};
+
+class GeometryLoader
+{
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+
+public:
+    GeometryLoader();
+    ~GeometryLoader(); // Cancels any load in progress.
+    GeometryLoader(const GeometryLoader&) = delete;
+    GeometryLoader& operator=(const GeometryLoader&) = delete;
+
+    // Maps the file, reads its header and starts parsing in the background. Returns false if the file can't be loaded.
+    bool Open(const char* path);
+
+    /*
+        Uploads parsed data into this loader's buffer in view, creating the buffer on the first call.
+        Uploads at most roughly maxUploadBytes per call, so a fast parser can't stall the frame.
+    */
+    void Update(View3d& view, size_t maxUploadBytes = 64 << 20);
+
+    /*
+        Same as Update(), but hands the data to a callback instead of a view, e.g. to convert files without a GL context.
+        Data arrives in file order. colors is null for vertices without colors, and indices refer to all the vertices
+        delivered so far.
+    */
+    using GeometrySinkFn = void(*)(const Vec3* positions, const Vec3* colors, size_t numVertices,
+        const unsigned int* indices, size_t numIndices, void* userData);
+    void Update(GeometrySinkFn sink, void* userData, size_t maxBytes = 64 << 20);
+
+    LoadProgress GetProgress() const;
+
+    // The buffer in the view passed to Update(), to be drawn with View3d::DrawBuffer(). Zero before the first Update().
+    View3d::BufferHandle GetBuffer() const;
+};
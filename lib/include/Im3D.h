@@ -1,5 +1,7 @@
 #pragma once
 #include "imgui.h"
+#include "VertexLayout.h"
+#include <cstdint>
 #include <memory>
 /*
     Create a simple 3D view inside Dear Imgui using an immediate-mode API.
@@ -14,6 +16,51 @@ struct Vec3
     float x, y, z;
 };
 
+// How point densities are mapped to the colormap.
+enum class DensityScale
+{
+    Log,        // log(1 + count), normalized by the densest pixel.
+    Equalized   // Histogram equalized, so every color is used by roughly the same number of pixels.
+};
+
+// Colormaps for scalar values, see View3d::SetColormap().
+enum class Colormap
+{
+    Viridis,
+    Jet,
+    Diverging,  // Blue through grey to red, for values around a midpoint.
+    Custom      // The colors passed to View3d::SetCustomColormap().
+};
+
+enum class PrimitiveType
+{
+    Points,
+    Lines,      // Each pair of vertices is a segment.
+    LineStrip,
+    Triangles   // Each three vertices are a triangle.
+};
+
+// How View3d draws points, see View3d::SetPointRendering().
+enum class PointRendering
+{
+    Raster,     // As GL_POINTS, View3d::SetPointSize() pixels across.
+    Compute     // Projected and depth tested by compute shaders, a pixel each. Needs OpenGL 4.3.
+};
+
+enum class CameraProjection
+{
+    Perspective,
+    Orthographic    // Frames what the perspective camera sees at the distance of its target, so zooming works the same.
+};
+
+// CPU memory used for recording geometry between Render() calls, see View3d::SetRecordingMemoryLimits().
+struct RecordingMemoryStats
+{
+    size_t lastFrameBytes;  // Recorded for the last frame rendered.
+    size_t peakBytes;       // The most any frame has recorded.
+    size_t reservedBytes;   // Held on to for the frames to come.
+};
+
 class View3d
 {
 private:
@@ -27,16 +74,159 @@ public:
     void SetBackgroundColor(float r, float g, float b, float a = 1.f);
 
     void DrawPoints(const Vec3* points, int numPoints);
+    // Points colored by one scalar value each, through the view's colormap.
+    void DrawPoints(const Vec3* points, const float* values, int numPoints);
+
+    /*
+        Maps scalar values to colors on the GPU, for points drawn with values and buffers with scalars.
+        Values from minValue to maxValue span the colormap and the rest are clamped. Changing these only
+        updates shader uniforms, so the scalars themselves don't need uploading again.
+    */
+    void SetColormap(Colormap colormap, float minValue, float maxValue);
+    // Lookup table for Colormap::Custom, from the low end to the high end, interpolated between entries.
+    void SetCustomColormap(const ImU32* colors, int numColors);
 
     void DrawLine(const Vec3 start, const Vec3 end);
 
+    /*
+        Draws vertices of any struct with a VertexLayout, shaded by the layout's own shader, see VertexLayout.h.
+        The vertices are copied as they are, and uploaded along with the rest of the frame's geometry.
+    */
+    template<typename Vertex>
+    void DrawVertices(const Vertex* vertices, size_t numVertices, PrimitiveType type = PrimitiveType::Points)
+    {
+        DrawVertices(GetVertexFormat<Vertex>(), vertices, numVertices, type);
+    }
+    void DrawVertices(const VertexFormat& format, const void* vertices, size_t numVertices, PrimitiveType type);
+
     void DrawViewBall();
+
+    /*
+        Curved primitives, drawn as line strips (spheres as triangles) with as many segments as their size on screen
+        calls for: each is split finely enough to stay within the tessellation tolerance of the true curve, in
+        whichever viewport shows it largest, with the cameras as they are when it is drawn. Distant primitives cost
+        a handful of vertices, and close ones don't look faceted. Angles are in radians, counterclockwise about normal.
+    */
+    void DrawCircle(const Vec3& center, const Vec3& normal, float radius, const Vec3& color = Vec3{ 1.f, 1.f, 1.f });
+    // Starts at center + startOffset, projected onto the plane of the arc.
+    void DrawArc(const Vec3& center, const Vec3& normal, const Vec3& startOffset, float angle, const Vec3& color = Vec3{ 1.f, 1.f, 1.f });
+    // A cubic Bezier curve from p0 to p3.
+    void DrawBezier(const Vec3& p0, const Vec3& p1, const Vec3& p2, const Vec3& p3, const Vec3& color = Vec3{ 1.f, 1.f, 1.f });
+    // A smooth curve through every point, a Catmull-Rom spline.
+    void DrawCurve(const Vec3* points, size_t numPoints, const Vec3& color = Vec3{ 1.f, 1.f, 1.f });
+    // A solid sphere in a flat color.
+    void DrawSphere(const Vec3& center, float radius, const Vec3& color = Vec3{ 1.f, 1.f, 1.f });
+    // Largest distance in pixels between a curve and its segments. Defaults to half a pixel.
+    void SetTessellationTolerance(float pixels);
+
+    /*
+        Retained buffers keep geometry on the GPU across frames, for data too large to resubmit every frame.
+        Append to a buffer whenever data arrives, and draw it with DrawBuffer() each frame like any other primitive.
+        Buffers holding triangles are drawn as meshes, others as points. Triangle indices refer to the buffer's own vertices.
+        Vertices appended without colors are drawn in the default color.
+        Appends and updates are held until Render(), which merges the ones that overlap or touch into single
+        sub-range uploads, so the cost per frame follows how much changed rather than the size of the buffer.
+    */
+    using BufferHandle = uint32_t;
+    BufferHandle CreateBuffer();
+    void DestroyBuffer(BufferHandle buffer);
+    void AppendVertices(BufferHandle buffer, const Vec3* positions, const Vec3* colors, size_t numVertices);
+    void AppendTriangles(BufferHandle buffer, const unsigned int* indices, size_t numIndices);
+    // One scalar per vertex, for the vertices appended so far which have none yet. Buffers with scalars are colormapped.
+    void AppendScalars(BufferHandle buffer, const float* values, size_t numValues);
+    // Overwrite vertices or scalars appended earlier, from the given index on. Null positions or colors are left as they are.
+    void UpdateVertices(BufferHandle buffer, size_t firstVertex, const Vec3* positions, const Vec3* colors, size_t numVertices);
+    void UpdateScalars(BufferHandle buffer, size_t firstValue, const float* values, size_t numValues);
+    void DrawBuffer(BufferHandle buffer);
+    size_t GetBufferVertexCount(BufferHandle buffer) const;
+
+    /*
+        Draws a point set as a per-pixel density image rather than individual points, for sets too large
+        to draw or to make sense of one by one. The points are projected with the current camera and binned
+        on the CPU right away, across all cores, so they don't need to outlive this call.
+        Densities from several calls in a frame add up.
+    */
+    void DrawPointDensity(const Vec3* points, size_t numPoints, DensityScale scale = DensityScale::Log);
+
+    /*
+        Text labels at 3D positions, drawn over the view by Image(). Render() projects and culls all of them
+        in one pass, and they're written to the window's draw list as a single batch, so tens of thousands
+        of labels stay cheap. The text is copied.
+    */
+    void DrawLabel(const Vec3& position, const char* text, ImU32 color = IM_COL32_WHITE);
+    // colors may be null, for white.
+    void DrawLabels(const Vec3* positions, const char* const* texts, size_t numLabels, const ImU32* colors = nullptr);
+    // Shows at most one label per cell of cellSize pixels, preferring those recorded first. Zero shows them all.
+    void SetLabelDeclutter(float cellSize);
+
     /*
     */
     void Render();
 
+    /*
+        Geometry is recorded into chunks of a few MB which are kept from frame to frame, so recording
+        doesn't allocate once the view has seen its usual load, and a sudden huge frame adds chunks
+        rather than copying everything recorded so far. Every trimAfterFrames frames, chunks beyond
+        what the busiest of those frames needed are freed. Vertices, indices, commands and typed vertices
+        are stored separately, and none of them keeps more than maxRetainedBytes.
+    */
+    void SetRecordingMemoryLimits(size_t maxRetainedBytes, uint32_t trimAfterFrames = 120);
+    RecordingMemoryStats GetRecordingMemoryStats() const;
+
+    /*
+        Progressive rendering for scenes too large to draw in a single frame.
+        When enabled, Render() accumulates into the view's image over several frames, spending roughly
+        budgetMs of GPU time per frame. Lines and a coarse subset of the points are drawn first, then the remaining points.
+        The accumulation restarts automatically when the camera or the recorded geometry changes. Everything recorded
+        is hashed each frame to tell, which costs about as much as uploading it.
+    */
+    void SetProgressiveRendering(bool enabled, float budgetMs = 8.f);
+    // Restarts the accumulation even though nothing seems to have changed.
+    void RestartProgressiveRendering();
+    // Fraction of the scene drawn into the image so far, in [0,1]. Always 1 when progressive rendering is off.
+    float GetProgress() const;
+
+    /*
+        Split views: extra cameras onto the same recorded scene, each rendering to its own framebuffer and image.
+        Render() uploads the recorded geometry once and draws it into every viewport, so the upload is paid once
+        however many there are. Viewport 0 is the view's own camera, which always exists.
+        Point densities and labels are projected separately for each viewport.
+    */
+    using ViewportId = uint32_t;
+    ViewportId AddViewport(const ImVec2& framebufferSize); // Returns 0 on failure.
+    void RemoveViewport(ViewportId viewport);
+    void SetCamera(ViewportId viewport, const Vec3& position, const Vec3& target, const Vec3& up);
+    void SetProjection(ViewportId viewport, CameraProjection projection);
+
+    // The camera Render() will use. Matrices are column-major, as passed to OpenGL.
+    void GetCameraMatrices(float cameraFromWorld[16], float clipFromCamera[16], ViewportId viewport = 0) const;
+    ImVec2 GetFramebufferSize(ViewportId viewport = 0) const;
+
+    /*
+        Occlusion culling for scenes where most retained buffers are hidden behind others, like building models.
+        Each viewport's depth buffer is reduced on the GPU and read back asynchronously into a depth pyramid,
+        and retained buffers whose bounds are entirely behind it are skipped. The pyramid arrives a frame or
+        more late and bounds are tested from the camera it was rendered with, so while the camera or an occluder
+        moves, buffers coming into view pop in a frame or two late. Not applied to progressive rendering.
+    */
+    void SetOcclusionCulling(bool enabled);
+    // Buffers skipped by the last Render().
+    size_t GetOccludedDrawCount(ViewportId viewport = 0) const;
+
+    /*
+        Point clouds of hundreds of millions of points are limited by the fixed function point pipeline rather than
+        by memory. PointRendering::Compute draws points, recorded and retained alike, with compute shaders instead:
+        one pass keeps the nearest depth for each pixel with atomics, a second averages the colors of the points at
+        that depth, and a fullscreen pass writes the result into the view's image, depth tested against the rest of
+        the scene. Not used for progressive rendering. Returns false, and keeps rendering as before, if the context
+        doesn't support compute shaders.
+    */
+    bool SetPointRendering(PointRendering rendering);
+    // Size of points drawn with PointRendering::Raster, 5 pixels by default. Compute points are always a pixel.
+    void SetPointSize(float pixels);
+
     /*
         Equivalent of ImGui::Image(), rendering this view3d to an image.
     */
-    void Image(const ImVec2& size);
+    void Image(const ImVec2& size, ViewportId viewport = 0);
 };
\ No newline at end of file
@@ -0,0 +1,120 @@
+#pragma once
+#include "Im3D.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/*
+    ImViz's own point cloud format, made to open instantly and draw at any scale.
+
+    Points are stored in an octree where every node holds a random subsample of the points below it, so drawing
+    a node and its ancestors gives a uniformly thinned out version of that region. Each node's data is stored as
+    columns (quantized x, y and z, then r, g and b), optionally LZ4 compressed, and can be read on its own.
+    A small index of fixed size node records sits at the end of the file, and the reader just maps the file
+    and points at it, so opening costs the same whatever the size of the data.
+
+    Layout, all little endian:
+        PointCloudFileHeader
+        node data, one positions column chunk and one optional colors column chunk per node
+        PointCloudNode[numNodes], the root first, every node before its children and the children of a node contiguous
+*/
+
+constexpr uint32_t PointCloudFileVersion = 1;
+
+struct PointCloudFileHeader
+{
+    char magic[4];              // "IMPC"
+    uint32_t version;
+    uint64_t numPoints;
+    uint64_t nodeTableOffset;
+    uint32_t numNodes;
+    uint32_t flags;             // PointCloudFlags
+    float boundsMin[3];
+    float boundsMax[3];
+};
+
+enum PointCloudFlags : uint32_t
+{
+    PointCloudFlags_HasColors = 1 << 0
+};
+
+enum PointCloudCompression : uint8_t
+{
+    PointCloudCompression_Positions = 1 << 0, // The positions chunk is LZ4 compressed.
+    PointCloudCompression_Colors = 1 << 1
+};
+
+struct PointCloudNode
+{
+    uint64_t positionsOffset;
+    uint64_t colorsOffset;
+    // Tight bounds of the node's own points, which positions are quantized against.
+    float boundsMin[3];
+    float boundsMax[3];
+    // Radius of the node's cell in the octree, which bounds everything below the node too.
+    float cellCenter[3];
+    float cellRadius;
+    uint32_t numPoints;
+    uint32_t firstChild;
+    uint32_t positionsSize;     // Stored sizes in bytes, compressed or not.
+    uint32_t colorsSize;
+    uint8_t numChildren;
+    uint8_t depth;
+    uint8_t compression;        // PointCloudCompression
+    uint8_t reserved[5];
+};
+static_assert(sizeof(PointCloudNode) == 80, "PointCloudNode is an on-disk record");
+
+struct PointCloudWriteOptions
+{
+    uint32_t maxPointsPerNode{ 32768 };
+    int maxDepth{ 20 };
+    bool compress{ true };
+    // Cells with more points than this are split by ConvertToPointCloudFile() through temporary files.
+    size_t maxPointsInMemory{ size_t(1) << 25 };
+};
+
+/*
+    Writes points to a new point cloud file. colors may be null. At most UINT32_MAX points, and besides the
+    points themselves this needs about 9 bytes per point while it builds the octree.
+*/
+bool WritePointCloudFile(const char* path, const Vec3* positions, const Vec3* colors, size_t numPoints,
+    const PointCloudWriteOptions& options = PointCloudWriteOptions{});
+
+/*
+    Reads any file GeometryLoader supports and writes its vertices to a point cloud file, whatever their number.
+    The vertices are first copied to a temporary file next to destPath, 24 bytes each, and octree cells with more
+    than maxPointsInMemory points keep their sample and pass the rest on to a temporary file per octant. Only cells
+    below that size are built in memory, at about 33 bytes per point, so the default needs a little over 1 GB.
+    Expect up to twice the size of the first temporary file in disk space. Points piled up at maxDepth are built
+    in memory however many there are.
+*/
+bool ConvertToPointCloudFile(const char* sourcePath, const char* destPath,
+    const PointCloudWriteOptions& options = PointCloudWriteOptions{});
+
+/*
+    Reads point cloud files. Open() only maps the file and checks the index; nodes are decoded on demand,
+    and LoadNode() can be called from several threads at once.
+*/
+class PointCloudFile
+{
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+
+public:
+    PointCloudFile();
+    ~PointCloudFile();
+    PointCloudFile(const PointCloudFile&) = delete;
+    PointCloudFile& operator=(const PointCloudFile&) = delete;
+
+    bool Open(const char* path);
+    void Close();
+
+    const PointCloudFileHeader* GetHeader() const;
+    const PointCloudNode* GetNodes() const;
+    uint32_t GetNodeCount() const;
+
+    // Decodes a node's points. colors is left empty if the file has none.
+    bool LoadNode(uint32_t node, std::vector<Vec3>& positions, std::vector<Vec3>& colors) const;
+};
@@ -0,0 +1,39 @@
+#pragma once
+#include "Im3D.h"
+#include "PointCloudFile.h"
+#include <memory>
+
+/*
+    Draws a point cloud file in a View3d at the level of detail the camera calls for.
+    Every frame, nodes are picked from the root down in order of their size on screen, skipping those outside
+    the view, until the point budget runs out. Nodes not loaded yet are decoded on background threads and
+    uploaded to retained buffers as they arrive; the least recently drawn ones are dropped when too many are loaded.
+
+    The view passed to Draw() has to outlive the renderer, which releases its buffers on destruction.
+*/
+class PointCloudRenderer
+{
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+
+public:
+    PointCloudRenderer();
+    ~PointCloudRenderer();
+    PointCloudRenderer(const PointCloudRenderer&) = delete;
+    PointCloudRenderer& operator=(const PointCloudRenderer&) = delete;
+
+    bool Open(const char* path);
+
+    // Call once per frame while recording, before View3d::Render().
+    void Draw(View3d& view);
+
+    // Most points drawn in a frame.
+    void SetPointBudget(size_t numPoints);
+    // Nodes are refined until they cover fewer than this many pixels across.
+    void SetMinNodePixelSize(float pixels);
+
+    size_t GetDrawnPointCount() const;
+    size_t GetLoadedPointCount() const;
+    const PointCloudFile& GetFile() const;
+};
@@ -0,0 +1,114 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+/*
+    Typed vertex layouts, for drawing vertex structs other than position plus color with View3d::DrawVertices().
+    Describe a struct by specializing VertexLayout for it:
+
+        struct SensorVertex
+        {
+            Vec3 position;
+            Vec3 normal;
+            float temperature;
+            uint32_t id;
+        };
+
+        template<> struct VertexLayout<SensorVertex>
+        {
+            static constexpr VertexAttribute attributes[] = {
+                IM3D_VERTEX_ATTRIBUTE(SensorVertex, position, VertexAttributeType::Float3),
+                IM3D_VERTEX_ATTRIBUTE(SensorVertex, normal, VertexAttributeType::Float3),
+                IM3D_VERTEX_ATTRIBUTE(SensorVertex, temperature, VertexAttributeType::Float),
+                IM3D_VERTEX_ATTRIBUTE(SensorVertex, id, VertexAttributeType::UInt),
+            };
+            // Body of the GLSL function "vec4 Shade()", run per vertex, with every attribute in scope by name.
+            static constexpr const char* shader = "return vec4(normal * 0.5 + 0.5, 1.0);";
+        };
+
+    The first attribute is the position, which the view's camera transforms. The table is checked against the struct
+    at compile time. Attribute locations are the table indices, bound before the layout's shader is linked. Each view
+    builds a program and a vertex array for a layout the first time it draws it, so drawing only binds them.
+*/
+
+enum class VertexAttributeType : uint8_t
+{
+    Float,
+    Float2,
+    Float3,
+    Float4,
+    UByte4Norm, // Four bytes read as a vec4 in [0,1], e.g. a packed color.
+    Int,        // Read as an int, without conversion to float.
+    UInt        // Read as a uint, without conversion to float.
+};
+
+struct VertexAttribute
+{
+    const char* name; // Of the shader input.
+    VertexAttributeType type;
+    uint32_t offset;
+};
+
+#define IM3D_VERTEX_ATTRIBUTE(Vertex, member, type) VertexAttribute{ #member, type, (uint32_t)offsetof(Vertex, member) }
+
+template<typename Vertex>
+struct VertexLayout;
+
+// A layout ready for drawing. There's one per vertex type, which views identify it by.
+struct VertexFormat
+{
+    const VertexAttribute* attributes;
+    uint32_t numAttributes;
+    uint32_t stride;
+    const char* shader;
+};
+
+constexpr uint32_t GetVertexAttributeSize(VertexAttributeType type)
+{
+    return type == VertexAttributeType::Float ? 4
+        : type == VertexAttributeType::Float2 ? 8
+        : type == VertexAttributeType::Float3 ? 12
+        : type == VertexAttributeType::Float4 ? 16
+        : 4;
+}
+
+namespace VertexLayoutDetail
+{
+    template<typename Vertex>
+    constexpr bool AttributeFits(const VertexAttribute& attribute)
+    {
+        return attribute.offset + GetVertexAttributeSize(attribute.type) <= sizeof(Vertex);
+    }
+
+    constexpr bool AllTrue()
+    {
+        return true;
+    }
+
+    template<typename... Rest>
+    constexpr bool AllTrue(bool first, Rest... rest)
+    {
+        return first && AllTrue(rest...);
+    }
+
+    template<typename Vertex, size_t... I>
+    VertexFormat& GetFormat(std::index_sequence<I...>)
+    {
+        using Layout = VertexLayout<Vertex>;
+        static_assert(sizeof...(I) <= 16, "OpenGL only guarantees 16 vertex attributes");
+        static_assert(Layout::attributes[0].type == VertexAttributeType::Float3, "The first attribute is the position, and has to be a Float3");
+        static_assert(AllTrue(AttributeFits<Vertex>(Layout::attributes[I])...), "A vertex attribute reaches past the end of the vertex");
+
+        static constexpr VertexAttribute attributes[] = { Layout::attributes[I]... };
+        static VertexFormat format{ attributes, (uint32_t)sizeof...(I), (uint32_t)sizeof(Vertex), Layout::shader };
+        return format;
+    }
+}
+
+template<typename Vertex>
+VertexFormat& GetVertexFormat()
+{
+    using Layout = VertexLayout<Vertex>;
+    return VertexLayoutDetail::GetFormat<Vertex>(std::make_index_sequence<sizeof(Layout::attributes) / sizeof(VertexAttribute)>{});
+}